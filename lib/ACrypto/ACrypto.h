@@ -34,12 +34,21 @@
 // Block ciphers
 #include "AES128.h"
 #include "XTEA.h"
+// Expanded key cache
+#include "AES128KeyCache.h"
 // Modes of encryption
 #include "ECBMode.h"
 #include "CBCMode.h"
+#include "CTRMode.h"
+#include "XTSMode.h"
 // MACs
 #include "AES128_CMAC.h"
+#include "AES128_PMAC.h"
 // Compositions
 #include "AES128CBC_CMAC_EtM.h"
+// Authenticated encryption modes
+#include "AES128_GCM.h"
+// Multi-core bulk processing
+#include "BulkEngine.h"
 
 #endif /* __ACRYPTO_HEADERS_H */
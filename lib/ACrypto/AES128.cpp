@@ -30,7 +30,11 @@
  */
 
 #include "AES128.h"
+#include "AES128_NI.h"
 #include "aes_tables.h"
+#if defined(ACRYPTO_AES_TTABLES)
+#include "aes_ttables.h"
+#endif
 
 #define unroll_decrypt_loop
 #define unroll_encrypt_loop
@@ -59,27 +63,185 @@
 // Access an element i,j from a linear char array, indexed for convenience as the AES state.
 #define state(p,i,j) (p[i+4*j])
 
+// Word-parallel xtime: {02} * each of the four bytes of w at once.
+#define xtime4(w) ((((w) & 0x7f7f7f7fUL) << 1) ^ ((((w) >> 7) & 0x01010101UL) * 0x1b))
+// {04} * each byte, in one step: the two bits shifted out reduce to 0x1b and 0x36.
+#define fourtimes4(w) ((((w) & 0x3f3f3f3fUL) << 2) ^ ((((w) >> 6) & 0x01010101UL) * 0x1b) ^ ((((w) >> 7) & 0x01010101UL) * 0x36))
+// A column loaded as a native-order word. colrot(w,n) moves row r+n of the column into row r.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+#define colrot(w,n) brl(w,n)
+#else
+#define colrot(w,n) brr(w,n)
+#endif
+
+// Load and store a state column (or round key word) as a big-endian 32-bit word.
+#define getu32(p) (((uint32_t)(p)[0]<<24) ^ ((uint32_t)(p)[1]<<16) ^ ((uint32_t)(p)[2]<<8) ^ ((uint32_t)(p)[3]))
+#define putu32(p,w) { (p)[0]=(unsigned char)((w)>>24); (p)[1]=(unsigned char)((w)>>16); \
+                      (p)[2]=(unsigned char)((w)>>8); (p)[3]=(unsigned char)(w); }
+
+/**
+ *  tround -- one T-table encryption round on the columns s0..s3, result in t0..t3.
+ *  The ShiftRows offsets are folded into the choice of source column for each lookup.
+ */
+#define tround(s0,s1,s2,s3,t0,t1,t2,t3,rk) \
+	t0 = Te0[s0>>24] ^ Te1[(s1>>16)&0xff] ^ Te2[(s2>>8)&0xff] ^ Te3[s3&0xff] ^ getu32(rk); \
+	t1 = Te0[s1>>24] ^ Te1[(s2>>16)&0xff] ^ Te2[(s3>>8)&0xff] ^ Te3[s0&0xff] ^ getu32(rk+4); \
+	t2 = Te0[s2>>24] ^ Te1[(s3>>16)&0xff] ^ Te2[(s0>>8)&0xff] ^ Te3[s1&0xff] ^ getu32(rk+8); \
+	t3 = Te0[s3>>24] ^ Te1[(s0>>16)&0xff] ^ Te2[(s1>>8)&0xff] ^ Te3[s2&0xff] ^ getu32(rk+12);
+/**
+ *  tdround -- one T-table decryption round (equivalent inverse cipher).
+ */
+#define tdround(s0,s1,s2,s3,t0,t1,t2,t3,rk) \
+	t0 = Td0[s0>>24] ^ Td1[(s3>>16)&0xff] ^ Td2[(s2>>8)&0xff] ^ Td3[s1&0xff] ^ getu32(rk); \
+	t1 = Td0[s1>>24] ^ Td1[(s0>>16)&0xff] ^ Td2[(s3>>8)&0xff] ^ Td3[s2&0xff] ^ getu32(rk+4); \
+	t2 = Td0[s2>>24] ^ Td1[(s1>>16)&0xff] ^ Td2[(s0>>8)&0xff] ^ Td3[s3&0xff] ^ getu32(rk+8); \
+	t3 = Td0[s3>>24] ^ Td1[(s2>>16)&0xff] ^ Td2[(s1>>8)&0xff] ^ Td3[s0&0xff] ^ getu32(rk+12);
+
 AES128::AES128(unsigned char *key, TableOptions tableOptions)
 {
+	m_bAESNI = AES128_NI::available();
+	m_bConstantTime = AES128_CONSTANT_TIME_DEFAULT;
+	m_pShared = NULL;
+	rekey(key);
+	m_tableOptions = tableOptions;
+}
+
+AES128::AES128(const AES128Key *key, TableOptions tableOptions)
+{
+	m_bAESNI = AES128_NI::available();
+	m_bConstantTime = AES128_CONSTANT_TIME_DEFAULT;
+	m_pShared = NULL;
 	rekey(key);
 	m_tableOptions = tableOptions;
 }
 
+/**
+ *  Used by AES128Key to run the key expansion; the instance has no key of its own.
+ */
+AES128::AES128()
+{
+	m_bAESNI = false;
+	m_bConstantTime = false;
+	m_pShared = NULL;
+	m_tableOptions = toHeader;
+}
+
+AES128::~AES128()
+{
+	releaseShared();
+}
+
 void AES128::rekey(unsigned char *key)
 {
+	releaseShared();
 	KeyExpansion(key,m_pKeys);
+#if defined(ACRYPTO_AES_DECRYPTION_KEYS)
+	DecryptionKeyExpansion(m_pKeys,m_pDecKeys);
+#endif
+#if defined(ACRYPTO_AES_BITSLICED)
+	if ( !m_bAESNI )
+		AES128_BS::expandKeys(m_pKeys,m_bsKeys);
+#endif
+}
+
+void AES128::rekey(const AES128Key *key)
+{
+	// Acquire first, in case key is the one already in use
+	key->acquire();
+	releaseShared();
+	m_pShared = key;
+}
+
+void AES128::releaseShared()
+{
+	if ( m_pShared!=NULL )
+		m_pShared->release();
+	m_pShared = NULL;
+}
+
+bool AES128::enableAESNI(bool enable)
+{
+	bool bAESNI = enable && AES128_NI::available();
+	if ( bAESNI != m_bAESNI )
+	{
+		m_bAESNI = bAESNI;
+		// A shared key carries every schedule already
+		if ( m_pShared!=NULL )
+			return m_bAESNI;
+#if defined(ACRYPTO_AES_DECRYPTION_KEYS)
+		DecryptionKeyExpansion(m_pKeys,m_pDecKeys);
+#endif
+#if defined(ACRYPTO_AES_BITSLICED)
+		if ( !m_bAESNI )
+			AES128_BS::expandKeys(m_pKeys,m_bsKeys);
+#endif
+	}
+	return m_bAESNI;
+}
+
+bool AES128::setConstantTime(bool enable)
+{
+#if defined(ACRYPTO_AES_BITSLICED)
+	m_bConstantTime = enable;
+#else
+	(void)enable;
+#endif
+	return m_bConstantTime;
 }
 
 //static
 void AES128::encrypt(unsigned char *key, unsigned char *block)
 {
-	//
+#if defined(ACRYPTO_X86)
+	if ( AES128_NI::available() )
+	{
+		AES128_NI::encryptOnTheFly(key,block);
+		return;
+	}
+#endif
+	unsigned char rk[AES128_KEY_BYTES];
+	memcpy(rk,key,AES128_KEY_BYTES);
+	for ( int i=0; i<AES128_BLOCK_BYTES; i++ )
+		block[i] ^= rk[i];
+	for ( int round=1; round<=AES128_ROUNDS; round++ )
+	{
+		SubAndShift(block);
+		if ( round<AES128_ROUNDS )
+			MixColumns(block);
+		nextRoundKey(rk,round);
+		for ( int i=0; i<AES128_BLOCK_BYTES; i++ )
+			block[i] ^= rk[i];
+	}
+	memset(rk,0,AES128_KEY_BYTES);
 }
 
 //static
 void AES128::decrypt(unsigned char *key, unsigned char *block)
 {
-	//
+#if defined(ACRYPTO_X86)
+	if ( AES128_NI::available() )
+	{
+		AES128_NI::decryptOnTheFly(key,block);
+		return;
+	}
+#endif
+	unsigned char rk[AES128_KEY_BYTES];
+	memcpy(rk,key,AES128_KEY_BYTES);
+	for ( int round=1; round<=AES128_ROUNDS; round++ )
+		nextRoundKey(rk,round);
+
+	for ( int i=0; i<AES128_BLOCK_BYTES; i++ )
+		block[i] ^= rk[i];
+	for ( int round=AES128_ROUNDS; round>=1; round-- )
+	{
+		InvSubAndShift(block);
+		previousRoundKey(rk,round);
+		for ( int i=0; i<AES128_BLOCK_BYTES; i++ )
+			block[i] ^= rk[i];
+		if ( round>1 )
+			InvMixColumns(block);
+	}
+	memset(rk,0,AES128_KEY_BYTES);
 }
 
 /**
@@ -100,6 +262,24 @@ void AES128::decrypt(unsigned char *key, unsigned char *block)
  */
 void AES128::encrypt(unsigned char *block)
 {
+#if defined(ACRYPTO_X86)
+	if ( m_bAESNI )
+	{
+		AES128_NI::encrypt(roundKeys(),block);
+		return;
+	}
+#endif
+#if defined(ACRYPTO_AES_BITSLICED)
+	if ( m_bConstantTime )
+	{
+		AES128_BS::encrypt(bitslicedKeys(),block,block,1);
+		return;
+	}
+#endif
+
+#if defined(ACRYPTO_AES_TTABLES)
+	TableEncrypt(block);
+#else
     // XOR the first key to the first state
 	AddRoundKey(block, 0);
 
@@ -126,6 +306,7 @@ void AES128::encrypt(unsigned char *block)
 	// Now, do the final round of encryption
 	SubAndShift(block);
 	AddRoundKey(block, AES128_ROUNDS);  // add the last round key from the schedule
+#endif
 }
 
 /**
@@ -139,6 +320,24 @@ void AES128::encrypt(unsigned char *block)
  */
 void AES128::decrypt(unsigned char *block)
 {
+#if defined(ACRYPTO_X86)
+  if ( m_bAESNI )
+  {
+    AES128_NI::decrypt(decryptionRoundKeys(),block);
+    return;
+  }
+#endif
+#if defined(ACRYPTO_AES_BITSLICED)
+  if ( m_bConstantTime )
+  {
+    AES128_BS::decrypt(bitslicedKeys(),block,block,1);
+    return;
+  }
+#endif
+
+#if defined(ACRYPTO_AES_TTABLES)
+  TableDecrypt(block);
+#else
   // XOR the first key to the first state.
   AddRoundKey(block, AES128_ROUNDS);
 
@@ -165,6 +364,87 @@ void AES128::decrypt(unsigned char *block)
   // The last round is different (Round 0) -- there is no MixColumns.
   InvSubAndShift(block);
   AddRoundKey(block, 0);
+#endif
+}
+
+//static
+void AES128::encryptPair(AES128 *a, unsigned char *blockA, AES128 *b, unsigned char *blockB)
+{
+#if defined(ACRYPTO_X86)
+	if ( a->m_bAESNI && b->m_bAESNI )
+	{
+		AES128_NI::encrypt2(a->roundKeys(),blockA,b->roundKeys(),blockB);
+		return;
+	}
+#endif
+	a->encrypt(blockA);
+	b->encrypt(blockB);
+}
+
+void AES128::encryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks)
+{
+#if defined(ACRYPTO_X86)
+	if ( m_bAESNI )
+	{
+		AES128_NI::encryptBlocks(roundKeys(),in,out,nblocks);
+		return;
+	}
+#endif
+#if defined(ACRYPTO_AES_BITSLICED)
+	// In constant-time mode every batch goes through the bitsliced engine. Otherwise batches
+	// shorter than half a bitsliced group are cheaper on the single block engine.
+	if ( m_bConstantTime || nblocks>=AES128_BS_PARALLEL_BLOCKS/2 )
+	{
+		while ( nblocks>0 )
+		{
+			unsigned int n = nblocks<AES128_BS_PARALLEL_BLOCKS ? nblocks : AES128_BS_PARALLEL_BLOCKS;
+			AES128_BS::encrypt(bitslicedKeys(),in,out,n);
+			in += n*AES128_BLOCK_BYTES;
+			out += n*AES128_BLOCK_BYTES;
+			nblocks -= n;
+		}
+		return;
+	}
+#endif
+	for ( unsigned int i=0; i<nblocks; i++ )
+	{
+		if ( out!=in )
+			memcpy(out+i*AES128_BLOCK_BYTES,in+i*AES128_BLOCK_BYTES,AES128_BLOCK_BYTES);
+		encrypt(out+i*AES128_BLOCK_BYTES);
+	}
+}
+
+void AES128::decryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks)
+{
+#if defined(ACRYPTO_X86)
+	if ( m_bAESNI )
+	{
+		AES128_NI::decryptBlocks(decryptionRoundKeys(),in,out,nblocks);
+		return;
+	}
+#endif
+#if defined(ACRYPTO_AES_BITSLICED)
+	// In constant-time mode every batch goes through the bitsliced engine. Otherwise batches
+	// shorter than half a bitsliced group are cheaper on the single block engine.
+	if ( m_bConstantTime || nblocks>=AES128_BS_PARALLEL_BLOCKS/2 )
+	{
+		while ( nblocks>0 )
+		{
+			unsigned int n = nblocks<AES128_BS_PARALLEL_BLOCKS ? nblocks : AES128_BS_PARALLEL_BLOCKS;
+			AES128_BS::decrypt(bitslicedKeys(),in,out,n);
+			in += n*AES128_BLOCK_BYTES;
+			out += n*AES128_BLOCK_BYTES;
+			nblocks -= n;
+		}
+		return;
+	}
+#endif
+	for ( unsigned int i=0; i<nblocks; i++ )
+	{
+		if ( out!=in )
+			memcpy(out+i*AES128_BLOCK_BYTES,in+i*AES128_BLOCK_BYTES,AES128_BLOCK_BYTES);
+		decrypt(out+i*AES128_BLOCK_BYTES);
+	}
 }
 
 void AES128::initLookupInEEPROM(int memsize, int sboxoffset, int isboxoffset, int rconoffset)
@@ -190,6 +470,42 @@ void AES128::generateKeySchedule(const unsigned char *key, unsigned char *keys)
 	KeyExpansion(key,keys); // TODO: VALIDATE SIZE OF KEYS
 }
 
+/* ----------------------------------------------------------------------------------------------
+ * AES128Key
+ * ---------------------------------------------------------------------------------------------- */
+
+AES128Key::AES128Key(const unsigned char *key)
+{
+	AES128 expander;
+	expander.KeyExpansion(key,m_pKeys);
+#if defined(ACRYPTO_AES_DECRYPTION_KEYS)
+	expander.DecryptionKeyExpansion(m_pKeys,m_pDecKeys);
+#endif
+#if defined(ACRYPTO_AES_BITSLICED)
+	AES128_BS::expandKeys(m_pKeys,m_bsKeys);
+#endif
+	m_refs = 1;
+}
+
+void AES128Key::acquire() const
+{
+#if defined(ACRYPTO_THREADS)
+	__sync_fetch_and_add(&m_refs,1);
+#else
+	m_refs++;
+#endif
+}
+
+void AES128Key::release() const
+{
+#if defined(ACRYPTO_THREADS)
+	if ( __sync_sub_and_fetch(&m_refs,1)==0 )
+#else
+	if ( --m_refs==0 )
+#endif
+		delete this;
+}
+
 /* ----------------------------------------------------------------------------------------------
  * Private member functions
  * ---------------------------------------------------------------------------------------------- */
@@ -236,18 +552,83 @@ void AES128::KeyExpansion(const unsigned char *key, unsigned char *keys)
 	}
 }
 
+/**
+ *  nextRoundKey
+ *
+ *  One step of the key expansion in place: turns round key round-1 into round key round. The
+ *  same recurrence as KeyExpansion, for the one-shot functions which keep a single round key.
+ */
+//static
+void AES128::nextRoundKey(unsigned char *rk, int round)
+{
+	rk[0] ^= getSboxValue(rk[13]) ^ getRconValue(round);
+	rk[1] ^= getSboxValue(rk[14]);
+	rk[2] ^= getSboxValue(rk[15]);
+	rk[3] ^= getSboxValue(rk[12]);
+	for ( int i=4; i<AES128_KEY_BYTES; i++ )
+		rk[i] ^= rk[i-4];
+}
+
+/**
+ *  previousRoundKey
+ *
+ *  The inverse of nextRoundKey: turns round key round into round key round-1. The last three
+ *  words come back from the XOR chain, last first, and then give the first word.
+ */
+//static
+void AES128::previousRoundKey(unsigned char *rk, int round)
+{
+	for ( int i=AES128_KEY_BYTES-1; i>=4; i-- )
+		rk[i] ^= rk[i-4];
+	rk[0] ^= getSboxValue(rk[13]) ^ getRconValue(round);
+	rk[1] ^= getSboxValue(rk[14]);
+	rk[2] ^= getSboxValue(rk[15]);
+	rk[3] ^= getSboxValue(rk[12]);
+}
+
+/**
+ *  DecryptionKeyExpansion()
+ *
+ *  Derives the decryption schedule for the equivalent inverse cipher (FIPS-197, section 5.3.5)
+ *  from the encryption schedule in keys. The round keys are stored in the order they are
+ *  applied, with InvMixColumns applied to the nine inner round keys. The AES-NI and T-table
+ *  engines share this schedule.
+ */
+void AES128::DecryptionKeyExpansion(const unsigned char *keys, unsigned char *decKeys)
+{
+#if defined(ACRYPTO_AES_DECRYPTION_KEYS)
+	if ( m_bAESNI )
+	{
+		AES128_NI::prepareDecryptionKeys(keys,decKeys);
+		return;
+	}
+
+	memcpy(decKeys,keys+AES128_ROUNDS*16,16);
+	for ( int round=1; round<AES128_ROUNDS; ++round )
+	{
+		memcpy(decKeys+round*16,keys+(AES128_ROUNDS-round)*16,16);
+		InvMixColumns(decKeys+round*16);
+	}
+	memcpy(decKeys+AES128_ROUNDS*16,keys,16);
+#else
+	(void)keys;
+	(void)decKeys;
+#endif
+}
+
 /**
  *  AddRoundKey
  *
  *  Adds a key from the schedule (for the specified round) to the current state.
  *  Loop unrolled for a bit of performance gain
- *  The key is XOR-ed to the state
+ *  The key is XOR-ed to the state as four 32-bit words. Note: unsigned long is 64 bits wide
+ *  on LP64 hosts, hence the fixed width type.
  */
 void AES128::AddRoundKey(void *pText, int round)
 {
 	int roundOffset=round*4;
-	unsigned long *pState = (unsigned long *)pText;
-	unsigned long *pKeys = (unsigned long *)m_pKeys;
+	uint32_t *pState = (uint32_t *)pText;
+	const uint32_t *pKeys = (const uint32_t *)roundKeys();
 
 	pState[0] ^= pKeys[roundOffset];
 	pState[1] ^= pKeys[roundOffset+1];
@@ -371,6 +752,8 @@ void AES128::MixColumns(void *pText)
 	// * http://en.wikipedia.org/wiki/Rijndael_Galois_field
 	// * http://www.usenix.org/event/cardis02/full_papers/valverde/valverde_html/node12.html
 
+#if defined(__AVR__)
+	// An 8-bit core gains nothing from word operations; do the columns byte by byte.
 	unsigned char *pState = (unsigned char *)pText;
 	unsigned char a, s0;
 
@@ -400,6 +783,23 @@ void AES128::MixColumns(void *pText)
 		state(pState,3,c) ^= xtime((state(pState,3,c) ^ s0)) ^ a;
 		// Here, we need to use a temp, since the contents of s0c have been modified
 	}
+#else
+	// The same, on all four rows of a column at once. A column is four adjacent bytes of the
+	// state, so it loads as one word; the row-wise terms are rotations of it, and xtime is done
+	// on the four bytes in parallel with masks:
+	//
+	// t = s_r ^ s_r+1
+	// s'_r = xtime(t) ^ s_r+1 ^ (s_r+2 ^ s_r+3)
+	unsigned char *pState = (unsigned char *)pText;
+	for ( int c=0; c<4; c++ )
+	{
+		uint32_t w, t;
+		memcpy(&w,pState+4*c,4);
+		t = w ^ colrot(w,1);
+		w = xtime4(t) ^ colrot(w,1) ^ colrot(t,2);
+		memcpy(pState+4*c,&w,4);
+	}
+#endif
 } // MixColumns()
 
 /**
@@ -409,32 +809,141 @@ void AES128::MixColumns(void *pText)
  */
 void AES128::InvMixColumns(void *pText)
 {
+	// InvMixColumns is MixColumns after a preprocessing step (Daemen and Rijmen, sec. 4.1.3).
+	// Multiplying a column by {04}x^2 + {05} first gives
+	//
+	// u = {04} * (s_0 ^ s_2),  v = {04} * (s_1 ^ s_3)
+	// s_0 ^= u, s_1 ^= v, s_2 ^= u, s_3 ^= v
+	//
+	// This takes four xtimes per column, against a dozen per byte for the 0e/0b/0d/09
+	// products taken directly.
 	unsigned char *pState = (unsigned char *)pText;
-	unsigned char s0, s1, s2, s3;
-
 	int c;
 	for (c = 0; c < 4; c++)
 	{
-		s0 = state(pState,0,c); // S_0,0
-		s1 = state(pState,1,c); // S_1,0
-		s2 = state(pState,2,c); // S_2,0
-		s3 = state(pState,3,c); // S_3,0
-
-		// * is multiplication is GF(2^8)
-		// s'_0,c = (0x0e * s0) xor (0x0b * s1) xor (0x0d * s2) xor (0x09 * s3)
-		state(pState,0,c) = (eight(s0)^four(s0)^xtime(s0)) ^ (eight(s1)^xtime(s1)^s1) ^ (eight(s2)^four(s2)^s2) ^ (eight(s3) ^ s3);
-
-		// s'_1,c = (0x09 * s0) xor (0x0e * s1) xor (0x0b * s2) xor (0x0d * s3)
-		state(pState,1,c) = (eight(s0)^s0) ^ (eight(s1)^four(s1)^xtime(s1)) ^ (eight(s2)^xtime(s2)^s2) ^ (eight(s3)^four(s3)^s3);
-
-		// s'_2,c = (0x0d * s0) xor (0x09 * s1) xor (0x0e * s2) xor (0x0b * s3)
-		state(pState,2,c) = (eight(s0)^four(s0)^s0) ^ (eight(s1)^s1) ^ (eight(s2)^four(s2)^xtime(s2)) ^ (eight(s3)^xtime(s3)^s3);
-
-		// s'_3,c = (0x0b * s0) xor (0x0d * s1) xor (0x09 * s2) xor (0x0e * s3)
-		state(pState,3,c) = (eight(s0)^xtime(s0)^s0) ^ (eight(s1)^four(s1)^s1) ^ (eight(s2)^s2) ^ (eight(s3)^four(s3)^xtime(s3));
+#if defined(__AVR__)
+		unsigned char u, v;
+		u = state(pState,0,c) ^ state(pState,2,c);
+		u = xtime(u);
+		u = xtime(u);
+		v = state(pState,1,c) ^ state(pState,3,c);
+		v = xtime(v);
+		v = xtime(v);
+		state(pState,0,c) ^= u;
+		state(pState,1,c) ^= v;
+		state(pState,2,c) ^= u;
+		state(pState,3,c) ^= v;
+#else
+		// On the whole column: the column XORed with itself rotated by two rows holds
+		// s_0 ^ s_2 in rows 0 and 2 and s_1 ^ s_3 in rows 1 and 3. MixColumns follows on
+		// the word while it is still in a register.
+		uint32_t w, t;
+		memcpy(&w,pState+4*c,4);
+		t = w ^ colrot(w,2);
+		w ^= fourtimes4(t);
+		t = w ^ colrot(w,1);
+		w = xtime4(t) ^ colrot(w,1) ^ colrot(t,2);
+		memcpy(pState+4*c,&w,4);
+#endif
 	}
+#if defined(__AVR__)
+	MixColumns(pText);
+#endif
 } // InvMixColumns()
 
+#if defined(ACRYPTO_AES_TTABLES)
+/**
+ *  TableEncrypt
+ *
+ *  Encrypt a single block with the 32-bit T-table engine. The state is kept as four big-endian
+ *  column words; each inner round takes four table lookups per column, see aes_ttables.h.
+ *  The final round has no MixColumns and uses the plain sbox.
+ */
+void AES128::TableEncrypt(unsigned char *block)
+{
+	const unsigned char *rk = roundKeys();
+	uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+
+	s0 = getu32(block) ^ getu32(rk);
+	s1 = getu32(block+4) ^ getu32(rk+4);
+	s2 = getu32(block+8) ^ getu32(rk+8);
+	s3 = getu32(block+12) ^ getu32(rk+12);
+
+	tround(s0,s1,s2,s3,t0,t1,t2,t3,rk+16);
+	tround(t0,t1,t2,t3,s0,s1,s2,s3,rk+32);
+	tround(s0,s1,s2,s3,t0,t1,t2,t3,rk+48);
+	tround(t0,t1,t2,t3,s0,s1,s2,s3,rk+64);
+	tround(s0,s1,s2,s3,t0,t1,t2,t3,rk+80);
+	tround(t0,t1,t2,t3,s0,s1,s2,s3,rk+96);
+	tround(s0,s1,s2,s3,t0,t1,t2,t3,rk+112);
+	tround(t0,t1,t2,t3,s0,s1,s2,s3,rk+128);
+	tround(s0,s1,s2,s3,t0,t1,t2,t3,rk+144);
+
+	rk += AES128_ROUNDS*16;
+	block[0] = sbox[t0>>24] ^ rk[0];
+	block[1] = sbox[(t1>>16)&0xff] ^ rk[1];
+	block[2] = sbox[(t2>>8)&0xff] ^ rk[2];
+	block[3] = sbox[t3&0xff] ^ rk[3];
+	block[4] = sbox[t1>>24] ^ rk[4];
+	block[5] = sbox[(t2>>16)&0xff] ^ rk[5];
+	block[6] = sbox[(t3>>8)&0xff] ^ rk[6];
+	block[7] = sbox[t0&0xff] ^ rk[7];
+	block[8] = sbox[t2>>24] ^ rk[8];
+	block[9] = sbox[(t3>>16)&0xff] ^ rk[9];
+	block[10] = sbox[(t0>>8)&0xff] ^ rk[10];
+	block[11] = sbox[t1&0xff] ^ rk[11];
+	block[12] = sbox[t3>>24] ^ rk[12];
+	block[13] = sbox[(t0>>16)&0xff] ^ rk[13];
+	block[14] = sbox[(t1>>8)&0xff] ^ rk[14];
+	block[15] = sbox[t2&0xff] ^ rk[15];
+}
+
+/**
+ *  TableDecrypt
+ *
+ *  Decrypt a single block with the T-table engine, using the equivalent inverse cipher and
+ *  the precomputed decryption schedule.
+ */
+void AES128::TableDecrypt(unsigned char *block)
+{
+	const unsigned char *rk = decryptionRoundKeys();
+	uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+
+	s0 = getu32(block) ^ getu32(rk);
+	s1 = getu32(block+4) ^ getu32(rk+4);
+	s2 = getu32(block+8) ^ getu32(rk+8);
+	s3 = getu32(block+12) ^ getu32(rk+12);
+
+	tdround(s0,s1,s2,s3,t0,t1,t2,t3,rk+16);
+	tdround(t0,t1,t2,t3,s0,s1,s2,s3,rk+32);
+	tdround(s0,s1,s2,s3,t0,t1,t2,t3,rk+48);
+	tdround(t0,t1,t2,t3,s0,s1,s2,s3,rk+64);
+	tdround(s0,s1,s2,s3,t0,t1,t2,t3,rk+80);
+	tdround(t0,t1,t2,t3,s0,s1,s2,s3,rk+96);
+	tdround(s0,s1,s2,s3,t0,t1,t2,t3,rk+112);
+	tdround(t0,t1,t2,t3,s0,s1,s2,s3,rk+128);
+	tdround(s0,s1,s2,s3,t0,t1,t2,t3,rk+144);
+
+	rk += AES128_ROUNDS*16;
+	block[0] = isbox[t0>>24] ^ rk[0];
+	block[1] = isbox[(t3>>16)&0xff] ^ rk[1];
+	block[2] = isbox[(t2>>8)&0xff] ^ rk[2];
+	block[3] = isbox[t1&0xff] ^ rk[3];
+	block[4] = isbox[t1>>24] ^ rk[4];
+	block[5] = isbox[(t0>>16)&0xff] ^ rk[5];
+	block[6] = isbox[(t3>>8)&0xff] ^ rk[6];
+	block[7] = isbox[t2&0xff] ^ rk[7];
+	block[8] = isbox[t2>>24] ^ rk[8];
+	block[9] = isbox[(t1>>16)&0xff] ^ rk[9];
+	block[10] = isbox[(t0>>8)&0xff] ^ rk[10];
+	block[11] = isbox[t3&0xff] ^ rk[11];
+	block[12] = isbox[t3>>24] ^ rk[12];
+	block[13] = isbox[(t2>>16)&0xff] ^ rk[13];
+	block[14] = isbox[(t1>>8)&0xff] ^ rk[14];
+	block[15] = isbox[t0&0xff] ^ rk[15];
+}
+#endif // ACRYPTO_AES_TTABLES
+
 /**
  *  getSboxValue
  *
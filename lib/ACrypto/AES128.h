@@ -33,6 +33,7 @@
 #define __ACRYPTO_AES128_H
 
 #include <string.h>
+#include <stdint.h>
 #include "BlockCipherAlgorithm.h"
 
 #define AES128_KEY_BYTES 16
@@ -41,6 +42,37 @@
 
 enum TableOptions {toHeader, toEEPROM, toProgmem};
 
+/*
+ *  Portable engine selection. ACRYPTO_AES_TTABLES selects the 32-bit T-table engine, which
+ *  fuses SubBytes, ShiftRows and MixColumns into four table lookups per column. The tables
+ *  take 8KB, so the byte oriented compact engine remains the default on 8-bit AVR targets.
+ *  Define ACRYPTO_AES_COMPACT to force the compact engine elsewhere.
+ */
+#if !defined(__AVR__) && !defined(ACRYPTO_AES_COMPACT) && !defined(ACRYPTO_AES_TTABLES)
+#define ACRYPTO_AES_TTABLES
+#endif
+
+/*
+ *  The constant-time bitsliced engine (AES128_BS) works on 64-bit words and is left out of
+ *  8-bit AVR builds. Define ACRYPTO_AES_NO_BITSLICED to leave it out elsewhere.
+ */
+#if !defined(__AVR__) && !defined(ACRYPTO_AES_NO_BITSLICED)
+#define ACRYPTO_AES_BITSLICED
+#include "AES128_BS.h"
+#endif
+
+// Instances start in constant-time mode (see AES128::setConstantTime) wherever it is available
+#if defined(ACRYPTO_AES_BITSLICED)
+#define AES128_CONSTANT_TIME_DEFAULT true
+#else
+#define AES128_CONSTANT_TIME_DEFAULT false
+#endif
+
+// The equivalent inverse cipher schedule is only needed by the AES-NI and T-table engines.
+#if defined(ACRYPTO_X86) || defined(ACRYPTO_AES_TTABLES)
+#define ACRYPTO_AES_DECRYPTION_KEYS
+#endif
+
 /**
  *  ntransform -- normal transform macro to help with the loop unrolling
  */
@@ -50,6 +82,45 @@ enum TableOptions {toHeader, toEEPROM, toProgmem};
  */
 #define dtransform(cipher,round) InvSubAndShift(cipher);AddRoundKey(cipher,round);InvMixColumns(cipher);
 
+/**
+ *  @brief An expanded AES128 key
+ *
+ *  Holds every schedule the engines use -- the encryption round keys, the equivalent inverse
+ *  cipher round keys and the bitsliced round keys, where compiled in -- computed once by the
+ *  constructor and never changed afterwards. Any number of AES128 instances (and the modes
+ *  built on them) can run from one AES128Key without expanding the key or copying the
+ *  schedules; see AES128(const AES128Key *) and rekey(const AES128Key *).
+ *
+ *  The key is reference counted. It is created with one reference, held by its creator; every
+ *  AES128 instance using it holds another. A key on the heap is given up with release(), which
+ *  deletes it when the last reference goes, rather than with delete. A key on the stack is
+ *  never deleted by the library, but must outlive the instances using it.
+ */
+class AES128Key : public CryptoObject
+{
+	public:
+		AES128Key(const unsigned char *key);
+
+		void acquire() const;
+		void release() const;
+
+	private:
+		AES128Key(const AES128Key &);
+		AES128Key &operator=(const AES128Key &);
+
+	private:
+		friend class AES128;
+
+		unsigned char m_pKeys[AES128_KEY_BYTES*11] ACRYPTO_CACHE_ALIGNED;
+#if defined(ACRYPTO_AES_DECRYPTION_KEYS)
+		unsigned char m_pDecKeys[AES128_KEY_BYTES*11] ACRYPTO_CACHE_ALIGNED;
+#endif
+#if defined(ACRYPTO_AES_BITSLICED)
+		uint64_t m_bsKeys[AES128_BS_KEY_WORDS] ACRYPTO_CACHE_ALIGNED;
+#endif
+		mutable int m_refs;
+};
+
 /**
  *  @brief AES128 block cipher implementation
  *
@@ -60,22 +131,77 @@ enum TableOptions {toHeader, toEEPROM, toProgmem};
 class AES128 : public BlockCipherAlgorithm
 {
 	public:
+		// Compile-time parameters for the mode templates (ECBModeT, CBCModeT)
+		enum { BLOCK_BYTES = AES128_BLOCK_BYTES, KEY_BYTES = AES128_KEY_BYTES };
+		static const AlgorithmType ALGORITHM = atAES128;
+
 		AES128(unsigned char *key, TableOptions tableOptions=toHeader);
+		/**
+		 *  Construct on an expanded key, which is shared rather than copied. No key expansion
+		 *  is done.
+		 */
+		AES128(const AES128Key *key, TableOptions tableOptions=toHeader);
+		virtual ~AES128();
 
 	public:
 		virtual void rekey(unsigned char *key);
+		/**
+		 *  Switch to an expanded key. Only a reference is taken; the previous shared key, if
+		 *  any, is released.
+		 */
+		void rekey(const AES128Key *key);
 
+		/**
+		 *  One-shot encryption and decryption of a block under a raw key, with no instance and
+		 *  no stored schedule: each round key is derived from the previous one as the rounds
+		 *  run (for decryption, the schedule is first run forward to the last round key and then
+		 *  inverted round by round). Uses AES-NI where available, else the compact engine,
+		 *  which is not constant-time.
+		 */
 		static void encrypt(unsigned char *key, unsigned char *block);
 		static void decrypt(unsigned char *key, unsigned char *block);
 
 		virtual void encrypt(unsigned char *block);
 		virtual void decrypt(unsigned char *block);
 
+		/**
+		 *  Encrypt or decrypt nblocks consecutive blocks from in to out, which may be the same
+		 *  buffer. AES-NI runs eight blocks interleaved through the pipeline. Without it the
+		 *  blocks are processed eight at a time by the constant-time bitsliced engine where it
+		 *  is compiled in. Batches of less than four blocks go to the single block engine
+		 *  instead when setConstantTime(false) is in effect.
+		 */
+		virtual void encryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks);
+		virtual void decryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks);
+
+		/**
+		 *  Encrypt one block under each of two instances. With AES-NI on both the two blocks
+		 *  go through the rounds together, which is how compositions with two serial chains
+		 *  under different keys (such as EtM) keep both in flight.
+		 */
+		static void encryptPair(AES128 *a, unsigned char *blockA, AES128 *b, unsigned char *blockB);
+
 		virtual int keylength() {return AES128_KEY_BYTES;}
 		virtual int blocklength() {return AES128_BLOCK_BYTES;}
 
 		void generateKeySchedule(const unsigned char *key, unsigned char *keys); // TODO: WHY PUBLIC??
 
+		/**
+		 *  Select the AES-NI backend if the CPU supports it (the default), or force the portable
+		 *  code. Returns true if the hardware backend is in use after the call.
+		 */
+		bool enableAESNI(bool enable=true);
+		bool usesAESNI() {return m_bAESNI;}
+
+		/**
+		 *  Route single block calls and short batches through the constant-time bitsliced
+		 *  engine (the default where it is compiled in), or give them to the faster table
+		 *  engine. The table engines index their lookup tables with secret data and leak
+		 *  timing through the cache. Has no effect when AES-NI is in use, which is
+		 *  constant-time anyway. Returns true if the portable code is now constant-time.
+		 */
+		bool setConstantTime(bool enable=true);
+
 	public:
 		// Utilities
 		void initLookupInEEPROM(int memsize, int sboxoffset, int isboxoffset, int rconoffset);
@@ -83,9 +209,22 @@ class AES128 : public BlockCipherAlgorithm
 		void writeLookupsToEEPROM(int memsize, int sboxoffset, int isboxoffset, int rconoffset);
 //		void printBytes(unsigned char *pBytes, int dLength, int dLineLen=16);
 
+	private:
+		friend class AES128Key;
+		AES128();
+
 	private:
 		TableOptions m_tableOptions;
-		unsigned char m_pKeys[AES128_KEY_BYTES*11];
+		const AES128Key *m_pShared; // The shared schedules in use, or NULL for the ones below
+		unsigned char m_pKeys[AES128_KEY_BYTES*11] ACRYPTO_CACHE_ALIGNED;
+#if defined(ACRYPTO_AES_DECRYPTION_KEYS)
+		unsigned char m_pDecKeys[AES128_KEY_BYTES*11] ACRYPTO_CACHE_ALIGNED; // Equivalent inverse cipher schedule (FIPS-197, 5.3.5)
+#endif
+		bool m_bAESNI;
+		bool m_bConstantTime;
+#if defined(ACRYPTO_AES_BITSLICED)
+		uint64_t m_bsKeys[AES128_BS_KEY_WORDS] ACRYPTO_CACHE_ALIGNED; // Bitsliced schedule, only kept for the portable path
+#endif
 
 		int m_eeprom_memSize;
 		int m_sboxoffset;
@@ -95,18 +234,39 @@ class AES128 : public BlockCipherAlgorithm
 	private:
 		// Key manipulation functions
 		void KeyExpansion(const unsigned char *key, unsigned char *keys);
+		void DecryptionKeyExpansion(const unsigned char *keys, unsigned char *decKeys);
+		void releaseShared();
+
+		// The schedules in use
+		const unsigned char *roundKeys() { return m_pShared!=NULL ? m_pShared->m_pKeys : m_pKeys; }
+#if defined(ACRYPTO_AES_DECRYPTION_KEYS)
+		const unsigned char *decryptionRoundKeys() { return m_pShared!=NULL ? m_pShared->m_pDecKeys : m_pDecKeys; }
+#endif
+#if defined(ACRYPTO_AES_BITSLICED)
+		const uint64_t *bitslicedKeys() { return m_pShared!=NULL ? m_pShared->m_bsKeys : m_bsKeys; }
+#endif
 		void AddRoundKey(void *pText, int round);
 
+		// On-the-fly key schedule steps: round key round from round-1 and back
+		static void nextRoundKey(unsigned char *rk, int round);
+		static void previousRoundKey(unsigned char *rk, int round);
+
 		// Round functions
-		void SubAndShift(void *pText);
-		void MixColumns(void *pText);
-		void InvSubAndShift(void *pText);
-		void InvMixColumns(void *pText);
+		static void SubAndShift(void *pText);
+		static void MixColumns(void *pText);
+		static void InvSubAndShift(void *pText);
+		static void InvMixColumns(void *pText);
+
+#if defined(ACRYPTO_AES_TTABLES)
+		// T-table engine
+		void TableEncrypt(unsigned char *block);
+		void TableDecrypt(unsigned char *block);
+#endif
 
 		// Accessors for lookup tables
-		unsigned char getSboxValue(int index);
-		unsigned char getISboxValue(int index);
-		unsigned char getRconValue(int index);
+		static unsigned char getSboxValue(int index);
+		static unsigned char getISboxValue(int index);
+		static unsigned char getRconValue(int index);
 };
 
 #endif /* __ACRYPTO_AES128_H */
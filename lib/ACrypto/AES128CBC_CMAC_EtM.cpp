@@ -31,11 +31,16 @@
 
 #include "AES128CBC_CMAC_EtM.h"
 
-AES128CBC_CMAC_EtM::AES128CBC_CMAC_EtM(unsigned char *KE, unsigned char *KM)
+AES128CBC_CMAC_EtM::AES128CBC_CMAC_EtM(unsigned char *KE, unsigned char *KM, CryptoArena *arena)
 {
-	aescbc=NULL;
-	cmac=NULL;
-	rekey(KE,KM);
+	aescbc = new (arena) CBCMode(atAES128,KE,arena);
+	cmac = new (arena) AES128_CMAC(KM);
+}
+
+AES128CBC_CMAC_EtM::AES128CBC_CMAC_EtM(const AES128Key *KE, const AES128Key *KM, CryptoArena *arena)
+{
+	aescbc = new (arena) CBCMode(KE,arena);
+	cmac = new (arena) AES128_CMAC(KM);
 }
 
 AES128CBC_CMAC_EtM::~AES128CBC_CMAC_EtM()
@@ -48,32 +53,158 @@ AES128CBC_CMAC_EtM::~AES128CBC_CMAC_EtM()
 
 void AES128CBC_CMAC_EtM::encryptAndTag(unsigned char *message, unsigned int length, unsigned char *IV)
 {
-	aescbc->encrypt(message,length,IV);
-//	unsigned char tag[AES128_BLOCK_BYTES];
-	cmac->mac(message,length-AES128_BLOCK_BYTES,message+length);
+	encryptAndTag(message,length,message,IV);
+}
+
+void AES128CBC_CMAC_EtM::encryptAndTag(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV)
+{
+	// The MAC covers length less one block
+	if ( length<AES128_BLOCK_BYTES )
+		return;
+	if ( length%AES128_BLOCK_BYTES!=0 )
+	{
+		// The padding spills into the tag space; keep the two pass composition
+		if ( in!=out )
+			memcpy(out,in,length);
+		aescbc->encrypt(out,length,IV);
+		cmac->mac(out,length-AES128_BLOCK_BYTES,out+length);
+		return;
+	}
+
+	AES128 *aes = (AES128 *)aescbc->algorithm();
+	unsigned int blocks = length / AES128_BLOCK_BYTES;
+	unsigned char K1[AES128_BLOCK_BYTES], K2[AES128_BLOCK_BYTES], X[AES128_BLOCK_BYTES];
+	unsigned char prev[AES128_BLOCK_BYTES], block[AES128_BLOCK_BYTES];
+
+	cmac->subkeys(K1,K2);
+	memset(X,0,AES128_BLOCK_BYTES);
+	memcpy(prev,IV,AES128_BLOCK_BYTES);
+	for ( unsigned int i=0; i<blocks; i++ )
+	{
+		// C_i = E_KE(P_i XOR C_{i-1}), computed together with the CMAC step on C_{i-1}
+		const unsigned char *plain = in+i*AES128_BLOCK_BYTES;
+		for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+			block[bb] = plain[bb] ^ prev[bb];
+		if ( i==0 )
+			aes->encrypt(block);
+		else
+		{
+			for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+				X[bb] ^= prev[bb];
+			if ( i+1==blocks )
+				for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+					X[bb] ^= K1[bb];
+			AES128::encryptPair(aes,block,cmac,X);
+		}
+		memcpy(out+i*AES128_BLOCK_BYTES,block,AES128_BLOCK_BYTES);
+		memcpy(prev,block,AES128_BLOCK_BYTES);
+	}
+	if ( blocks==1 )
+		macEmpty(X,K2);
+	memcpy(out+length,X,cmac->tagLength());
 }
 
 bool AES128CBC_CMAC_EtM::decryptAndVerify(unsigned char *message, unsigned int length, unsigned char *IV)
 {
-	if ( !verify(message,length) )
+	return decryptAndVerify(message,length,message,IV);
+}
+
+bool AES128CBC_CMAC_EtM::decryptAndVerify(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV)
+{
+	if ( length<AES128_BLOCK_BYTES )
+		return false;
+	if ( length%AES128_BLOCK_BYTES!=0 )
+	{
+		if ( !verify((unsigned char *)in,length) )
+			return false;
+		aescbc->decrypt(in,length,out,IV);
+		return true;
+	}
+
+	BlockCipherAlgorithm *aes = aescbc->algorithm();
+	unsigned int blocks = length / AES128_BLOCK_BYTES;
+	unsigned char K1[AES128_BLOCK_BYTES], K2[AES128_BLOCK_BYTES], X[AES128_BLOCK_BYTES];
+	unsigned char plain[CBC_DECRYPT_CHUNK_BLOCKS*AES128_BLOCK_BYTES];
+	unsigned char cprev[AES128_BLOCK_BYTES];
+
+	cmac->subkeys(K1,K2);
+	memset(X,0,AES128_BLOCK_BYTES);
+	memcpy(cprev,IV,AES128_BLOCK_BYTES);
+	for ( unsigned int i=0; i<blocks; )
+	{
+		unsigned int n = blocks-i;
+		if ( n>CBC_DECRYPT_CHUNK_BLOCKS )
+			n = CBC_DECRYPT_CHUNK_BLOCKS;
+		const unsigned char *cipher = in+i*AES128_BLOCK_BYTES;
+
+		// MAC the chunk's ciphertext while it is in cache, then write out its plaintext
+		aes->decryptBlocks(cipher,plain,n);
+		for ( unsigned int j=0; j<n && i+j+1<blocks; j++ )
+			macBlock(X,cipher+j*AES128_BLOCK_BYTES,(i+j+2==blocks) ? K1 : NULL);
+		for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+			plain[bb] ^= cprev[bb];
+		for ( unsigned int bb=AES128_BLOCK_BYTES; bb<n*AES128_BLOCK_BYTES; bb++ )
+			plain[bb] ^= cipher[bb-AES128_BLOCK_BYTES];
+		memcpy(cprev,cipher+(n-1)*AES128_BLOCK_BYTES,AES128_BLOCK_BYTES);
+		memcpy(out+i*AES128_BLOCK_BYTES,plain,n*AES128_BLOCK_BYTES);
+		i += n;
+	}
+	if ( blocks==1 )
+		macEmpty(X,K2);
+
+	if ( !cryptoTagsEqual(X,in+length,cmac->tagLength()) )
+	{
+		if ( in==out )
+		{
+			// Put the ciphertext back; CBC encryption under the same IV reproduces it exactly
+			aescbc->encrypt(out,length,IV);
+		}
+		else
+			memset(out,0,length);
 		return false;
-	aescbc->decrypt(message,length,IV);
+	}
 	return true;
 }
 
 bool AES128CBC_CMAC_EtM::verify(unsigned char *message, unsigned int length)
 {
-	unsigned char tag[AES128_BLOCK_BYTES];
-	cmac->mac(message,length-AES128_BLOCK_BYTES,tag);
-	return (strncmp((char *)tag,(char *)(message+length),AES128_BLOCK_BYTES)==0);
+	if ( length<AES128_BLOCK_BYTES )
+		return false;
+	return cmac->verify(message,length-AES128_BLOCK_BYTES,message+length);
+}
+
+/**
+ *  One step of the CMAC chain: X = E_KM(X XOR C), with K1 folded in for the last block.
+ */
+void AES128CBC_CMAC_EtM::macBlock(unsigned char *X, const unsigned char *C, const unsigned char *K1)
+{
+	for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+		X[bb] ^= C[bb];
+	if ( K1!=NULL )
+		for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+			X[bb] ^= K1[bb];
+	cmac->encryptBlocks(X,X,1);
+}
+
+/**
+ *  The CMAC of the empty message: E_KM(10^127 XOR K2).
+ */
+void AES128CBC_CMAC_EtM::macEmpty(unsigned char *tag, const unsigned char *K2)
+{
+	for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+		tag[bb] = K2[bb];
+	tag[0] ^= 0x80;
+	cmac->encryptBlocks(tag,tag,1);
 }
 
 void AES128CBC_CMAC_EtM::rekey(unsigned char *KE, unsigned char *KM)
 {
-	if (aescbc!=NULL)
-		delete aescbc;
-	aescbc = new CBCMode(atAES128,KE);
-	if (cmac!=NULL)
-		delete cmac;
-	cmac = new AES128_CMAC(KM);
+	aescbc->rekey(KE);
+	cmac->rekey(KM);
+}
+
+void AES128CBC_CMAC_EtM::rekey(const AES128Key *KE, const AES128Key *KM)
+{
+	aescbc->rekey(KE);
+	cmac->rekey(KM);
 }
@@ -41,25 +41,43 @@
  *  This is a simple demonstration of a composition of cryptographic primitives, specifically
  *  block cipher based encryption and MAC.
  *
+ *  The tag is the CMAC of all ciphertext blocks but the last. For messages of whole blocks the
+ *  CBC and CMAC chains are run together, each ciphertext block going into the CMAC chain as
+ *  soon as it is produced (or, when decrypting, while its chunk is in cache), so the message
+ *  is only passed over once. The output is the same as running CBC and then CMAC.
+ *
+ *  The tag is AES128_BLOCK_BYTES long unless truncated with setTagLength(); wherever the tag
+ *  follows the message below it takes tagLength() bytes.
+ *
  *  @author Kristjan V. Jonsson
  *  @author Kristjan Runarsson
  */
-class AES128CBC_CMAC_EtM
+class AES128CBC_CMAC_EtM : public CryptoObject
 {
 	public:
         /**
          *  Constructor. Instantiates CBC mode AES and CMAC modules, each with a separate
-         *  128-bit key.
+         *  128-bit key. Both are placed in arena if one is given.
+         */
+		AES128CBC_CMAC_EtM(unsigned char *KE, unsigned char *KM, CryptoArena *arena=NULL);
+		/**
+         *  Constructor. Runs on expanded keys, which are shared rather than copied.
          */
-		AES128CBC_CMAC_EtM(unsigned char *KE, unsigned char *KM);
+		AES128CBC_CMAC_EtM(const AES128Key *KE, const AES128Key *KM, CryptoArena *arena=NULL);
 		virtual ~AES128CBC_CMAC_EtM();
+		/**
+         *  False if either module could not be allocated, in which case the instance must not
+         *  be used.
+         */
+		bool valid() { return aescbc!=NULL && aescbc->valid() && cmac!=NULL; }
 	public:
 		/**
          *  Encrypt and tag (MAC) a message using CBC mode AES128 encryption.
          *  The message buffer MUST be of a size which is a
          *  multiple of the cipher block length PLUS the size of the tag. The plaintext message
          *  is padded as needed, encrypted and written in the lower N-1 blocks of the message
-         *  buffer. The tag is returned in the last message block.
+         *  buffer. The tag is returned in the last message block. A length of less than one
+         *  block is rejected and the buffer left untouched.
          */
 		void encryptAndTag(unsigned char *message, unsigned int length, unsigned char *IV);
 		/**
@@ -67,10 +85,23 @@ class AES128CBC_CMAC_EtM
          *  be of a size which is a multiple of the cipher block length PLUS the size of the tag.
          *  The decrypted message (with padding intact) is returned in the lower N-1 blocks of
          *  the message buffer. The tag is NOT stripped off. The message is verified and the
-         *  result returned. The decryption is not performed if the verification fails.
+         *  result returned. If the verification fails the buffer is left holding the
+         *  ciphertext. A length of less than one block fails without touching the buffer.
          */
 		bool decryptAndVerify(unsigned char *message, unsigned int length, unsigned char *IV);
 		/**
+         *  Out-of-place encrypt and tag. Reads length bytes from in, which is left untouched,
+         *  and writes the ciphertext followed by the tag to out, which must hold length plus
+         *  tagLength() bytes.
+         */
+		void encryptAndTag(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV);
+		/**
+         *  Out-of-place decrypt and verify. Reads the ciphertext and the tag following it from
+         *  in and writes length bytes of plaintext to out; the tag is not copied. If the
+         *  verification fails out is zeroed, so no unauthenticated plaintext is released.
+         */
+		bool decryptAndVerify(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV);
+		/**
          *  Verify a tagged message. The message buffer is assumed to
          *  be of a size which is a multiple of the cipher block length PLUS the size of the tag.
          *  The function returns true if the tag is verified sucessfully.
@@ -78,9 +109,22 @@ class AES128CBC_CMAC_EtM
 		bool verify(unsigned char *message, unsigned int length);
 		/**
          *  Rekey the encryption and MAC algorithms. Distinct keys are assumed -- its generally a
-         *  bad idea to re-use any cryptographic key for more than one purpose.
+         *  bad idea to re-use any cryptographic key for more than one purpose. The existing
+         *  instances are rekeyed; nothing is allocated.
          */
 		void rekey(unsigned char *KE, unsigned char *KM);
+		/**
+         *  Rekey with expanded keys. Neither key is expanded again.
+         */
+		void rekey(const AES128Key *KE, const AES128Key *KM);
+		/**
+         *  Truncate the tags written and checked from here on. See AES128_CMAC::setTagLength.
+         */
+		bool setTagLength(unsigned int length) { return cmac->setTagLength(length); }
+		unsigned int tagLength() { return cmac->tagLength(); }
+	private:
+		void macBlock(unsigned char *X, const unsigned char *C, const unsigned char *K1);
+		void macEmpty(unsigned char *tag, const unsigned char *K2);
 	private:
 		CBCMode *aescbc;    /// The CBC mode AES encryption instance
 		AES128_CMAC *cmac;  /// The CMAC instance
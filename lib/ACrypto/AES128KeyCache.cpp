@@ -0,0 +1,211 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "AES128KeyCache.h"
+
+AES128KeyCache::AES128KeyCache(unsigned int capacity)
+{
+	m_capacity = capacity<1 ? 1 : capacity;
+
+	// Twice as many buckets as entries, rounded up to a power of two
+	m_bucketBits = 1;
+	while ( (1u<<m_bucketBits) < 2*m_capacity && m_bucketBits<31 )
+		m_bucketBits++;
+
+	m_entries = new Entry[m_capacity];
+	m_buckets = new int[1u<<m_bucketBits];
+	for ( unsigned int i=0; i<(1u<<m_bucketBits); i++ )
+		m_buckets[i] = -1;
+	for ( unsigned int i=0; i<m_capacity; i++ )
+	{
+		m_entries[i].key = NULL;
+		m_entries[i].next = (i+1<m_capacity) ? (int)(i+1) : -1;
+	}
+	m_free = 0;
+	m_newest = -1;
+	m_oldest = -1;
+	m_size = 0;
+	m_hits = 0;
+	m_misses = 0;
+#if defined(ACRYPTO_THREADS)
+	pthread_mutex_init(&m_lock,NULL);
+#endif
+}
+
+AES128KeyCache::~AES128KeyCache()
+{
+	clear();
+#if defined(ACRYPTO_THREADS)
+	pthread_mutex_destroy(&m_lock);
+#endif
+	delete [] m_entries;
+	delete [] m_buckets;
+}
+
+const AES128Key *AES128KeyCache::get(uint64_t keyId, const unsigned char *key)
+{
+	lock();
+	int entry = find(keyId);
+	if ( entry>=0 )
+	{
+		m_hits++;
+		if ( entry!=m_newest )
+		{
+			unlink(entry);
+			pushNewest(entry);
+		}
+		const AES128Key *expanded = m_entries[entry].key;
+		expanded->acquire();
+		unlock();
+		return expanded;
+	}
+	m_misses++;
+	if ( key==NULL )
+	{
+		unlock();
+		return NULL;
+	}
+	// Expand first, so that an allocation failure leaves the cache as it was
+	const AES128Key *expanded = new AES128Key(key);  // The cache's reference
+	if ( expanded==NULL )
+	{
+		unlock();
+		return NULL;
+	}
+	if ( m_free<0 )
+		drop(m_oldest);
+
+	entry = m_free;
+	m_free = m_entries[entry].next;
+	unsigned int b = bucket(keyId);
+	m_entries[entry].id = keyId;
+	m_entries[entry].key = expanded;
+	m_entries[entry].next = m_buckets[b];
+	m_buckets[b] = entry;
+	pushNewest(entry);
+	m_size++;
+
+	expanded->acquire();
+	unlock();
+	return expanded;
+}
+
+bool AES128KeyCache::remove(uint64_t keyId)
+{
+	lock();
+	int entry = find(keyId);
+	if ( entry>=0 )
+		drop(entry);
+	unlock();
+	return entry>=0;
+}
+
+void AES128KeyCache::clear()
+{
+	lock();
+	while ( m_oldest>=0 )
+		drop(m_oldest);
+	unlock();
+}
+
+/**
+ *  Fibonacci hashing of the ID onto the bucket table.
+ */
+unsigned int AES128KeyCache::bucket(uint64_t keyId)
+{
+	return (unsigned int)((keyId * 0x9e3779b97f4a7c15ULL) >> (64-m_bucketBits));
+}
+
+int AES128KeyCache::find(uint64_t keyId)
+{
+	int entry = m_buckets[bucket(keyId)];
+	while ( entry>=0 && m_entries[entry].id!=keyId )
+		entry = m_entries[entry].next;
+	return entry;
+}
+
+void AES128KeyCache::unlink(int entry)
+{
+	Entry &e = m_entries[entry];
+	if ( e.newer>=0 )
+		m_entries[e.newer].older = e.older;
+	else
+		m_newest = e.older;
+	if ( e.older>=0 )
+		m_entries[e.older].newer = e.newer;
+	else
+		m_oldest = e.newer;
+}
+
+void AES128KeyCache::pushNewest(int entry)
+{
+	Entry &e = m_entries[entry];
+	e.newer = -1;
+	e.older = m_newest;
+	if ( m_newest>=0 )
+		m_entries[m_newest].newer = entry;
+	else
+		m_oldest = entry;
+	m_newest = entry;
+}
+
+/**
+ *  Take an entry out of its hash chain and the LRU list, give up the cache's reference to the
+ *  key and return the entry to the free list.
+ */
+void AES128KeyCache::drop(int entry)
+{
+	int *link = &m_buckets[bucket(m_entries[entry].id)];
+	while ( *link!=entry )
+		link = &m_entries[*link].next;
+	*link = m_entries[entry].next;
+	unlink(entry);
+
+	m_entries[entry].key->release();
+	m_entries[entry].key = NULL;
+	m_entries[entry].next = m_free;
+	m_free = entry;
+	m_size--;
+}
+
+void AES128KeyCache::lock()
+{
+#if defined(ACRYPTO_THREADS)
+	pthread_mutex_lock(&m_lock);
+#endif
+}
+
+void AES128KeyCache::unlock()
+{
+#if defined(ACRYPTO_THREADS)
+	pthread_mutex_unlock(&m_lock);
+#endif
+}
@@ -0,0 +1,124 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_AES128KEYCACHE_H
+#define __ACRYPTO_AES128KEYCACHE_H
+
+#include <stdint.h>
+#include "AES128.h"
+
+#if defined(ACRYPTO_THREADS)
+#include <pthread.h>
+#endif
+
+/**
+ *  @brief LRU cache of expanded AES128 keys
+ *
+ *  Maps a caller chosen key ID to the AES128Key expanded from it, so that a key used for many
+ *  requests (a session key, say) is expanded once. When the cache is full the least recently
+ *  used entry is dropped. Lookups are by hash, so the cost does not grow with the capacity.
+ *
+ *  The keys handed out are reference counted (see AES128Key); dropping an entry, by eviction,
+ *  remove() or clear(), only gives up the cache's reference, so keys still held elsewhere stay
+ *  valid. With ACRYPTO_THREADS the cache may be shared between threads.
+ *
+ *  Example:
+ *
+ *      const AES128Key *key = cache.get(sessionId,sessionKey);
+ *      CBCMode cbc(key);
+ *      key->release();
+ */
+class AES128KeyCache
+{
+	public:
+		/**
+		 *  Constructor. Room for capacity expanded keys (at least one).
+		 */
+		AES128KeyCache(unsigned int capacity);
+		virtual ~AES128KeyCache();
+
+	public:
+		/**
+		 *  The expanded key for keyId, with a reference acquired for the caller which must be
+		 *  given up with release(). On a miss key is expanded and cached; on a hit key is not
+		 *  read, so an ID must never be reused for different key bytes (remove() it first).
+		 *  Returns NULL on a miss if key is NULL, or if the expanded key cannot be allocated;
+		 *  the cache is then left unchanged.
+		 */
+		const AES128Key *get(uint64_t keyId, const unsigned char *key);
+		/**
+		 *  Drop the entry for keyId, for example when the key is retired. Returns true if
+		 *  there was one.
+		 */
+		bool remove(uint64_t keyId);
+		void clear();
+
+		unsigned int size() { return m_size; }
+		unsigned int capacity() { return m_capacity; }
+		unsigned long hits() { return m_hits; }
+		unsigned long misses() { return m_misses; }
+
+	private:
+		struct Entry
+		{
+			uint64_t id;
+			const AES128Key *key;
+			int newer;   /// LRU list neighbours, -1 at the ends
+			int older;
+			int next;    /// The next entry in the hash chain, or in the free list
+		};
+
+	private:
+		unsigned int bucket(uint64_t keyId);
+		int find(uint64_t keyId);
+		void unlink(int entry);
+		void pushNewest(int entry);
+		void drop(int entry);
+		void lock();
+		void unlock();
+
+	private:
+		Entry *m_entries;
+		int *m_buckets;
+		unsigned int m_bucketBits;
+		unsigned int m_capacity;
+		unsigned int m_size;
+		int m_newest;
+		int m_oldest;
+		int m_free;
+		unsigned long m_hits;
+		unsigned long m_misses;
+#if defined(ACRYPTO_THREADS)
+		pthread_mutex_t m_lock;
+#endif
+};
+
+#endif /* __ACRYPTO_AES128KEYCACHE_H */
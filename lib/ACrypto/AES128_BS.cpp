@@ -0,0 +1,580 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "AES128.h"
+#include "AES128_BS.h"
+
+#if defined(ACRYPTO_AES_BITSLICED)
+
+//
+// State representation
+//
+// Four blocks are held in eight 64-bit words q[0..7], where q[i] holds bit i (q[7] being the
+// most significant bit) of every byte of the four blocks. Within a word, each 16-bit lane is
+// one row of the state; the four columns of the four blocks are interleaved in the lane.
+// ShiftRows is therefore a fixed bit permutation within each word, and rotating a word by 16
+// or 32 bits moves every column one or two rows down.
+//
+// Eight blocks are processed as two such groups, q[0..7] and q[8..15]. With GCC the two groups
+// share one 128-bit vector per bit plane (SSE2 on x86, NEON on ARM), so every gate works on all
+// eight blocks at once; the plane functions are templates over the word type for this reason.
+//
+
+#if defined(__GNUC__)
+#define ACRYPTO_BS_VECTOR
+typedef uint64_t bsword __attribute__((vector_size(16)));
+#define bs_flatten __attribute__((flatten))
+#else
+#define bs_flatten
+#endif
+
+template <class W> static inline W rotr32(W x)
+{
+	return (x << 32) | (x >> 32);
+}
+
+static inline uint32_t dec32le(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void enc32le(unsigned char *p, uint32_t w)
+{
+	p[0] = (unsigned char)w;
+	p[1] = (unsigned char)(w >> 8);
+	p[2] = (unsigned char)(w >> 16);
+	p[3] = (unsigned char)(w >> 24);
+}
+
+/**
+ *  Spread the four little-endian words of one block over two words, one byte per 16-bit lane.
+ */
+static inline void interleaveIn(uint64_t *q0, uint64_t *q1, const uint32_t *w)
+{
+	uint64_t x0, x1, x2, x3;
+
+	x0 = w[0];
+	x1 = w[1];
+	x2 = w[2];
+	x3 = w[3];
+	x0 |= (x0 << 16);
+	x1 |= (x1 << 16);
+	x2 |= (x2 << 16);
+	x3 |= (x3 << 16);
+	x0 &= (uint64_t)0x0000FFFF0000FFFFULL;
+	x1 &= (uint64_t)0x0000FFFF0000FFFFULL;
+	x2 &= (uint64_t)0x0000FFFF0000FFFFULL;
+	x3 &= (uint64_t)0x0000FFFF0000FFFFULL;
+	x0 |= (x0 << 8);
+	x1 |= (x1 << 8);
+	x2 |= (x2 << 8);
+	x3 |= (x3 << 8);
+	x0 &= (uint64_t)0x00FF00FF00FF00FFULL;
+	x1 &= (uint64_t)0x00FF00FF00FF00FFULL;
+	x2 &= (uint64_t)0x00FF00FF00FF00FFULL;
+	x3 &= (uint64_t)0x00FF00FF00FF00FFULL;
+	*q0 = x0 | (x2 << 8);
+	*q1 = x1 | (x3 << 8);
+}
+
+/**
+ *  Inverse of interleaveIn.
+ */
+static inline void interleaveOut(uint32_t *w, uint64_t q0, uint64_t q1)
+{
+	uint64_t x0, x1, x2, x3;
+
+	x0 = q0 & (uint64_t)0x00FF00FF00FF00FFULL;
+	x1 = q1 & (uint64_t)0x00FF00FF00FF00FFULL;
+	x2 = (q0 >> 8) & (uint64_t)0x00FF00FF00FF00FFULL;
+	x3 = (q1 >> 8) & (uint64_t)0x00FF00FF00FF00FFULL;
+	x0 |= (x0 >> 8);
+	x1 |= (x1 >> 8);
+	x2 |= (x2 >> 8);
+	x3 |= (x3 >> 8);
+	x0 &= (uint64_t)0x0000FFFF0000FFFFULL;
+	x1 &= (uint64_t)0x0000FFFF0000FFFFULL;
+	x2 &= (uint64_t)0x0000FFFF0000FFFFULL;
+	x3 &= (uint64_t)0x0000FFFF0000FFFFULL;
+	w[0] = (uint32_t)x0 | (uint32_t)(x0 >> 16);
+	w[1] = (uint32_t)x1 | (uint32_t)(x1 >> 16);
+	w[2] = (uint32_t)x2 | (uint32_t)(x2 >> 16);
+	w[3] = (uint32_t)x3 | (uint32_t)(x3 >> 16);
+}
+
+#define swapn(cl,ch,s,x,y) { \
+		uint64_t a = (x), b = (y); \
+		(x) = (a & (uint64_t)(cl)) | ((b & (uint64_t)(cl)) << (s)); \
+		(y) = ((a & (uint64_t)(ch)) >> (s)) | (b & (uint64_t)(ch)); }
+#define swap2(x,y) swapn(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define swap4(x,y) swapn(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define swap8(x,y) swapn(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+/**
+ *  Transpose between the interleaved byte representation and bit planes. The transform is
+ *  its own inverse.
+ */
+static inline void ortho(uint64_t *q)
+{
+	swap2(q[0], q[1]);
+	swap2(q[2], q[3]);
+	swap2(q[4], q[5]);
+	swap2(q[6], q[7]);
+
+	swap4(q[0], q[2]);
+	swap4(q[1], q[3]);
+	swap4(q[4], q[6]);
+	swap4(q[5], q[7]);
+
+	swap8(q[0], q[4]);
+	swap8(q[1], q[5]);
+	swap8(q[2], q[6]);
+	swap8(q[3], q[7]);
+}
+
+/**
+ *  The AES SBox as a boolean circuit: 113 gates, from J. Boyar and R. Peralta, "A depth-16
+ *  circuit for the AES S-box" (2011).
+ */
+template <class W> static void sbox8(W *q)
+{
+	W x0, x1, x2, x3, x4, x5, x6, x7;
+	W y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	W y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	W y20, y21;
+	W z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	W z10, z11, z12, z13, z14, z15, z16, z17;
+	W t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	W t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	W t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	W t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	W t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	W t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	W t60, t61, t62, t63, t64, t65, t66, t67;
+	W s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	// Top linear transformation
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	// Non-linear section
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	// Bottom linear transformation
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+/**
+ *  B(x ^ 0x63), where B is the inverse of the affine transform in the SBox. Used on both sides
+ *  of the forward circuit to get the inverse SBox: IS(x) = B(S(B(x ^ 0x63)) ^ 0x63).
+ */
+template <class W> static inline void invAffine(W *q)
+{
+	W q0, q1, q2, q3, q4, q5, q6, q7;
+
+	q0 = ~q[0];
+	q1 = ~q[1];
+	q2 = q[2];
+	q3 = q[3];
+	q4 = q[4];
+	q5 = ~q[5];
+	q6 = ~q[6];
+	q7 = q[7];
+	q[7] = q1 ^ q4 ^ q6;
+	q[6] = q0 ^ q3 ^ q5;
+	q[5] = q7 ^ q2 ^ q4;
+	q[4] = q6 ^ q1 ^ q3;
+	q[3] = q5 ^ q0 ^ q2;
+	q[2] = q4 ^ q7 ^ q1;
+	q[1] = q3 ^ q6 ^ q0;
+	q[0] = q2 ^ q5 ^ q7;
+}
+
+template <class W> static void invSbox8(W *q)
+{
+	invAffine(q);
+	sbox8(q);
+	invAffine(q);
+}
+
+template <class W> static inline void shiftRows(W *q)
+{
+	for ( int i=0; i<8; i++ )
+	{
+		W x = q[i];
+		q[i] = (x & (uint64_t)0x000000000000FFFFULL)
+			| ((x & (uint64_t)0x00000000FFF00000ULL) >> 4)
+			| ((x & (uint64_t)0x00000000000F0000ULL) << 12)
+			| ((x & (uint64_t)0x0000FF0000000000ULL) >> 8)
+			| ((x & (uint64_t)0x000000FF00000000ULL) << 8)
+			| ((x & (uint64_t)0xF000000000000000ULL) >> 12)
+			| ((x & (uint64_t)0x0FFF000000000000ULL) << 4);
+	}
+}
+
+template <class W> static inline void invShiftRows(W *q)
+{
+	for ( int i=0; i<8; i++ )
+	{
+		W x = q[i];
+		q[i] = (x & (uint64_t)0x000000000000FFFFULL)
+			| ((x & (uint64_t)0x000000000FFF0000ULL) << 4)
+			| ((x & (uint64_t)0x00000000F0000000ULL) >> 12)
+			| ((x & (uint64_t)0x000000FF00000000ULL) << 8)
+			| ((x & (uint64_t)0x0000FF0000000000ULL) >> 8)
+			| ((x & (uint64_t)0x000F000000000000ULL) << 12)
+			| ((x & (uint64_t)0xFFF0000000000000ULL) >> 4);
+	}
+}
+
+/**
+ *  MixColumns on bit planes. r holds the next row of each column; the xtime of (q ^ r) is
+ *  a plane shuffle with the top plane folded into planes 0, 1, 3 and 4 (the 0x1b reduction).
+ */
+template <class W> static inline void mixColumns(W *q)
+{
+	W q0, q1, q2, q3, q4, q5, q6, q7;
+	W r0, r1, r2, r3, r4, r5, r6, r7;
+
+	q0 = q[0]; q1 = q[1]; q2 = q[2]; q3 = q[3];
+	q4 = q[4]; q5 = q[5]; q6 = q[6]; q7 = q[7];
+	r0 = (q0 >> 16) | (q0 << 48);
+	r1 = (q1 >> 16) | (q1 << 48);
+	r2 = (q2 >> 16) | (q2 << 48);
+	r3 = (q3 >> 16) | (q3 << 48);
+	r4 = (q4 >> 16) | (q4 << 48);
+	r5 = (q5 >> 16) | (q5 << 48);
+	r6 = (q6 >> 16) | (q6 << 48);
+	r7 = (q7 >> 16) | (q7 << 48);
+
+	q[0] = q7 ^ r7 ^ r0 ^ rotr32(q0 ^ r0);
+	q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ rotr32(q1 ^ r1);
+	q[2] = q1 ^ r1 ^ r2 ^ rotr32(q2 ^ r2);
+	q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ rotr32(q3 ^ r3);
+	q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ rotr32(q4 ^ r4);
+	q[5] = q4 ^ r4 ^ r5 ^ rotr32(q5 ^ r5);
+	q[6] = q5 ^ r5 ^ r6 ^ rotr32(q6 ^ r6);
+	q[7] = q6 ^ r6 ^ r7 ^ rotr32(q7 ^ r7);
+}
+
+/**
+ *  InvMixColumns, decomposed as MixColumns after a cheap preprocessing step
+ *  (Daemen and Rijmen, sec. 4.1.3): s_i ^= {04}*(s_i ^ s_{i+2}) for every row i.
+ */
+template <class W> static inline void invMixColumns(W *q)
+{
+	W t0, t1, t2, t3, t4, t5, t6, t7;
+
+	t0 = q[0] ^ rotr32(q[0]);
+	t1 = q[1] ^ rotr32(q[1]);
+	t2 = q[2] ^ rotr32(q[2]);
+	t3 = q[3] ^ rotr32(q[3]);
+	t4 = q[4] ^ rotr32(q[4]);
+	t5 = q[5] ^ rotr32(q[5]);
+	t6 = q[6] ^ rotr32(q[6]);
+	t7 = q[7] ^ rotr32(q[7]);
+
+	// {04}*t: bit i of the product is t_{i-2}, with t6 and t7 reduced by 0x1b
+	q[0] ^= t6;
+	q[1] ^= t6 ^ t7;
+	q[2] ^= t0 ^ t7;
+	q[3] ^= t1 ^ t6;
+	q[4] ^= t2 ^ t6 ^ t7;
+	q[5] ^= t3 ^ t7;
+	q[6] ^= t4;
+	q[7] ^= t5;
+
+	mixColumns(q);
+}
+
+template <class W> static inline void addRoundKey(W *q, const uint64_t *sk)
+{
+	q[0] ^= sk[0]; q[1] ^= sk[1]; q[2] ^= sk[2]; q[3] ^= sk[3];
+	q[4] ^= sk[4]; q[5] ^= sk[5]; q[6] ^= sk[6]; q[7] ^= sk[7];
+}
+
+/**
+ *  Load up to four blocks into bit planes. Missing blocks are zero.
+ */
+static void load(uint64_t *q, const unsigned char *in, unsigned int nblocks)
+{
+	uint32_t w[4];
+	for ( unsigned int i=0; i<4; i++ )
+	{
+		if ( i<nblocks )
+		{
+			w[0] = dec32le(in+16*i);
+			w[1] = dec32le(in+16*i+4);
+			w[2] = dec32le(in+16*i+8);
+			w[3] = dec32le(in+16*i+12);
+		}
+		else
+			w[0] = w[1] = w[2] = w[3] = 0;
+		interleaveIn(&q[i],&q[i+4],w);
+	}
+	ortho(q);
+}
+
+static void store(unsigned char *out, uint64_t *q, unsigned int nblocks)
+{
+	uint32_t w[4];
+	ortho(q);
+	for ( unsigned int i=0; i<4 && i<nblocks; i++ )
+	{
+		interleaveOut(w,q[i],q[i+4]);
+		enc32le(out+16*i,w[0]);
+		enc32le(out+16*i+4,w[1]);
+		enc32le(out+16*i+8,w[2]);
+		enc32le(out+16*i+12,w[3]);
+	}
+}
+
+void AES128_BS::expandKeys(const unsigned char *keys, uint64_t *bsKeys)
+{
+	// The round key is broadcast to all four block slots and transposed like the data, so
+	// that AddRoundKey stays a plain XOR of bit planes.
+	unsigned char rk[64];
+	for ( int round=0; round<=AES128_ROUNDS; round++ )
+	{
+		for ( int i=0; i<4; i++ )
+			memcpy(rk+16*i,keys+16*round,16);
+		load(bsKeys+8*round,rk,4);
+	}
+}
+
+template <class W> static bs_flatten void encryptPlanes(W *q, const uint64_t *bsKeys)
+{
+	addRoundKey(q,bsKeys);
+	for ( int round=1; round<AES128_ROUNDS; round++ )
+	{
+		sbox8(q);
+		shiftRows(q);
+		mixColumns(q);
+		addRoundKey(q,bsKeys+8*round);
+	}
+	sbox8(q);
+	shiftRows(q);
+	addRoundKey(q,bsKeys+8*AES128_ROUNDS);
+}
+
+template <class W> static bs_flatten void decryptPlanes(W *q, const uint64_t *bsKeys)
+{
+	addRoundKey(q,bsKeys+8*AES128_ROUNDS);
+	for ( int round=AES128_ROUNDS-1; round>0; round-- )
+	{
+		invShiftRows(q);
+		invSbox8(q);
+		addRoundKey(q,bsKeys+8*round);
+		invMixColumns(q);
+	}
+	invShiftRows(q);
+	invSbox8(q);
+	addRoundKey(q,bsKeys);
+}
+
+#if defined(ACRYPTO_BS_VECTOR)
+#define runPlanes(fn,q,bsKeys,groups) { \
+		bsword v[8]; \
+		for ( int i=0; i<8; i++ ) { v[i][0] = q[i]; v[i][1] = q[i+8]; } \
+		fn(v,bsKeys); \
+		for ( int i=0; i<8; i++ ) { q[i] = v[i][0]; q[i+8] = v[i][1]; } }
+#else
+#define runPlanes(fn,q,bsKeys,groups) { \
+		fn(q,bsKeys); \
+		if ( groups==2 ) fn(q+8,bsKeys); }
+#endif
+
+void AES128_BS::encrypt(const uint64_t *bsKeys, const unsigned char *in, unsigned char *out, unsigned int nblocks)
+{
+	uint64_t q[16];
+	int groups = nblocks > 4 ? 2 : 1;
+
+	load(q,in,nblocks);
+	// The second group is only addressed when there are blocks in it
+	if ( groups==2 )
+		load(q+8,in+64,nblocks-4);
+	else
+		load(q+8,in,0);
+	runPlanes(encryptPlanes,q,bsKeys,groups);
+	store(out,q,nblocks);
+	if ( groups==2 )
+		store(out+64,q+8,nblocks-4);
+}
+
+void AES128_BS::decrypt(const uint64_t *bsKeys, const unsigned char *in, unsigned char *out, unsigned int nblocks)
+{
+	uint64_t q[16];
+	int groups = nblocks > 4 ? 2 : 1;
+
+	load(q,in,nblocks);
+	// The second group is only addressed when there are blocks in it
+	if ( groups==2 )
+		load(q+8,in+64,nblocks-4);
+	else
+		load(q+8,in,0);
+	runPlanes(decryptPlanes,q,bsKeys,groups);
+	store(out,q,nblocks);
+	if ( groups==2 )
+		store(out+64,q+8,nblocks-4);
+}
+
+#endif // ACRYPTO_AES_BITSLICED
@@ -0,0 +1,66 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_AES128_BS_H
+#define __ACRYPTO_AES128_BS_H
+
+#include <stdint.h>
+
+#define AES128_BS_PARALLEL_BLOCKS 8
+#define AES128_BS_KEY_WORDS (8*11)
+
+/**
+ *  @brief Constant-time bitsliced AES128 engine.
+ *
+ *  The engine keeps the AES state of up to eight blocks as sixteen 64-bit bit planes and
+ *  evaluates the SBox as a boolean circuit (Boyar and Peralta), so there are no table lookups
+ *  and no memory accesses that depend on the key or the data. The representation follows
+ *  the 64-bit constant-time code in BearSSL by Thomas Pornin. Short batches are padded
+ *  internally; a batch of four blocks or less costs half as much as a full one.
+ *
+ *  The bitsliced round keys are derived from the byte-ordered schedule kept by AES128.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+class AES128_BS
+{
+	public:
+		static void expandKeys(const unsigned char *keys, uint64_t *bsKeys);
+
+		/**
+		 *  Encrypt or decrypt nblocks (at most AES128_BS_PARALLEL_BLOCKS) 16-byte blocks.
+		 *  The in and out buffers may be the same.
+		 */
+		static void encrypt(const uint64_t *bsKeys, const unsigned char *in, unsigned char *out, unsigned int nblocks);
+		static void decrypt(const uint64_t *bsKeys, const unsigned char *in, unsigned char *out, unsigned int nblocks);
+};
+
+#endif /* __ACRYPTO_AES128_BS_H */
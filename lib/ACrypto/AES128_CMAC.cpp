@@ -31,15 +31,80 @@
 
 #include "AES128_CMAC.h"
 
+AES128_CMAC::AES128_CMAC(unsigned char *key) : AES128(key), m_tagLength(AES128_BLOCK_BYTES)
+{
+	// The base constructor keys the cipher through AES128::rekey
+	generateSubkeys();
+}
+
+AES128_CMAC::AES128_CMAC(const AES128Key *key) : AES128(key), m_tagLength(AES128_BLOCK_BYTES)
+{
+	generateSubkeys();
+}
+
+//virtual
+void AES128_CMAC::rekey(unsigned char *key)
+{
+	AES128::rekey(key);
+	generateSubkeys();
+}
+
+void AES128_CMAC::rekey(const AES128Key *key)
+{
+	AES128::rekey(key);
+	generateSubkeys();
+}
+
+bool AES128_CMAC::setTagLength(unsigned int length)
+{
+	if ( length<CMAC_MIN_TAG_BYTES || length>AES128_BLOCK_BYTES )
+		return false;
+	m_tagLength = length;
+	return true;
+}
+
 void AES128_CMAC::mac(unsigned char *message, unsigned int mlen, unsigned char *tag)
 {
-	aesCMac(message, mlen, tag);
+	unsigned char T[AES128_BLOCK_BYTES];
+	aesCMac(message, mlen, T);
+	memcpy(tag,T,m_tagLength);
 }
 
 //static
 void AES128_CMAC::mac(unsigned char *key, unsigned char *message, unsigned int mlen, unsigned char *tag)
 {
-	// TODO: IMPLEMENT
+	unsigned char K[AES128_BLOCK_BYTES], X[AES128_BLOCK_BYTES], last[AES128_BLOCK_BYTES];
+	unsigned int blocks = (mlen+AES128_BLOCK_BYTES-1) / AES128_BLOCK_BYTES;
+	bool complete = blocks>0 && mlen%AES128_BLOCK_BYTES==0;
+	if ( blocks==0 )
+		blocks = 1;
+
+	// Only the subkey the last block needs: K1 = dbl(E_K(0)), K2 = dbl(K1)
+	memset(X,0,AES128_BLOCK_BYTES);
+	AES128::encrypt(key,X);
+	expandMacKey(X,K);
+	if ( !complete )
+	{
+		memcpy(X,K,AES128_BLOCK_BYTES);
+		expandMacKey(X,K);
+	}
+
+	memset(X,0,AES128_BLOCK_BYTES);
+	for ( unsigned int i=0; i+1<blocks; i++ )
+	{
+		for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+			X[bb] ^= message[i*AES128_BLOCK_BYTES+bb];
+		AES128::encrypt(key,X);
+	}
+	if ( complete )
+		memcpy(last,message+(blocks-1)*AES128_BLOCK_BYTES,AES128_BLOCK_BYTES);
+	else
+		padding(message+(blocks-1)*AES128_BLOCK_BYTES,last,mlen%AES128_BLOCK_BYTES);
+	for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+		X[bb] ^= last[bb] ^ K[bb];
+	AES128::encrypt(key,X);
+	memcpy(tag,X,AES128_BLOCK_BYTES);
+	memset(K,0,AES128_BLOCK_BYTES);
 }
 
 //virtual
@@ -51,8 +116,171 @@ bool AES128_CMAC::verify(unsigned char *message, unsigned int mlen, unsigned cha
 //static
 bool AES128_CMAC::verify(unsigned char *key, unsigned char *message, unsigned int mlen, unsigned char *tag)
 {
-    //
-    return false; // TODO: IMPLEMENT
+	unsigned char expected[AES128_BLOCK_BYTES];
+	mac(key,message,mlen,expected);
+
+	return cryptoTagsEqual(expected,tag,AES128_BLOCK_BYTES);
+}
+
+unsigned int AES128_CMAC::verifyBatch(const CMACJob *jobs, unsigned int count, unsigned char *valid)
+{
+	unsigned char X[CMAC_BATCH_LANES*AES128_BLOCK_BYTES];  // The chaining value of each lane
+	const unsigned char *next[CMAC_BATCH_LANES];           // The next message block in each chain
+	unsigned int remaining[CMAC_BATCH_LANES];              // Blocks left, the last one included
+	unsigned int index[CMAC_BATCH_LANES];                  // The job each lane is working on
+	unsigned int active=0;
+	unsigned int job=0;
+	unsigned int nvalid=0;
+
+	memset(valid,0,(count+7)/8);
+	for ( ;; )
+	{
+		// Refill the lanes from the job list, keeping the active chains packed at the front
+		while ( active<CMAC_BATCH_LANES && job<count )
+		{
+			unsigned int blocks = (jobs[job].length+AES128_BLOCK_BYTES-1) / AES128_BLOCK_BYTES;
+			memset(X+active*AES128_BLOCK_BYTES,0,AES128_BLOCK_BYTES);
+			next[active] = jobs[job].message;
+			remaining[active] = blocks>0 ? blocks : 1;
+			index[active] = job;
+			active++;
+			job++;
+		}
+		if ( active==0 )
+			break;
+
+		// X = E_k(X XOR M_i) for one block of every active chain, the last block being masked
+		// with K1 or K2. The sum goes through y, which cannot alias the message, so that the
+		// compiler can do it a word at a time.
+		for ( unsigned int l=0; l<active; l++ )
+		{
+			unsigned char *x = X + l*AES128_BLOCK_BYTES;
+			const unsigned char *m = next[l];
+			unsigned char y[AES128_BLOCK_BYTES];
+			if ( remaining[l]>1 )
+			{
+				for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+					y[bb] = x[bb] ^ m[bb];
+			}
+			else
+			{
+				unsigned int tail = jobs[index[l]].length - (m-jobs[index[l]].message);
+				if ( tail==AES128_BLOCK_BYTES )
+				{
+					for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+						y[bb] = x[bb] ^ m[bb] ^ m_K1[bb];
+				}
+				else
+				{
+					unsigned char pad[AES128_BLOCK_BYTES];
+					padding((unsigned char *)m,pad,tail);
+					for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+						y[bb] = x[bb] ^ pad[bb] ^ m_K2[bb];
+				}
+			}
+			memcpy(x,y,AES128_BLOCK_BYTES);
+		}
+		encryptBlocks(X,X,active);
+
+		unsigned int l=0;
+		while ( l<active )
+		{
+			next[l] += AES128_BLOCK_BYTES;
+			if ( --remaining[l]==0 )
+			{
+				if ( cryptoTagsEqual(X+l*AES128_BLOCK_BYTES,jobs[index[l]].tag,m_tagLength) )
+				{
+					valid[index[l]/8] |= 1 << (index[l]%8);
+					nvalid++;
+				}
+				// Chain done; move the last active lane (and its state) into its place
+				active--;
+				next[l] = next[active];
+				remaining[l] = remaining[active];
+				index[l] = index[active];
+				memcpy(X+l*AES128_BLOCK_BYTES,X+active*AES128_BLOCK_BYTES,AES128_BLOCK_BYTES);
+			}
+			else
+				l++;
+		}
+	}
+	memset(X,0,sizeof(X));
+	return nvalid;
+}
+
+void AES128_CMAC::generateSubkeys()
+{
+	unsigned char L[AES128_BLOCK_BYTES];
+	memset(L,0,AES128_BLOCK_BYTES);
+	encrypt(L);
+	expandMacKey(L, m_K1);
+	expandMacKey(m_K1, m_K2);
+	memset(L,0,AES128_BLOCK_BYTES);
+}
+
+void AES128_CMAC::subkeys(unsigned char *K1, unsigned char *K2)
+{
+	memcpy(K1,m_K1,AES128_BLOCK_BYTES);
+	memcpy(K2,m_K2,AES128_BLOCK_BYTES);
+}
+
+void AES128_CMAC::init(CMACContext *ctx)
+{
+	memset(ctx->X,0,AES128_BLOCK_BYTES);
+	ctx->buffered = 0;
+}
+
+void AES128_CMAC::update(CMACContext *ctx, const unsigned char *chunk, unsigned int length)
+{
+	// The last block is treated differently, so a full buffer is only absorbed once more input
+	// turns up behind it.
+	if ( ctx->buffered>0 )
+	{
+		unsigned int n = AES128_BLOCK_BYTES - ctx->buffered;
+		if ( n>length )
+			n = length;
+		memcpy(ctx->buffer+ctx->buffered,chunk,n);
+		ctx->buffered += n;
+		chunk += n;
+		length -= n;
+		if ( length==0 )
+			return;
+		for ( int i=0; i<AES128_BLOCK_BYTES; i++ )
+			ctx->X[i] ^= ctx->buffer[i];
+		encryptBlocks(ctx->X,ctx->X,1);
+		ctx->buffered = 0;
+	}
+
+	// Whole blocks straight from the chunk, holding back the last one
+	while ( length>AES128_BLOCK_BYTES )
+	{
+		for ( int i=0; i<AES128_BLOCK_BYTES; i++ )
+			ctx->X[i] ^= chunk[i];
+		encryptBlocks(ctx->X,ctx->X,1);
+		chunk += AES128_BLOCK_BYTES;
+		length -= AES128_BLOCK_BYTES;
+	}
+	memcpy(ctx->buffer,chunk,length);
+	ctx->buffered = length;
+}
+
+void AES128_CMAC::final(CMACContext *ctx, unsigned char *tag)
+{
+	if ( ctx->buffered==AES128_BLOCK_BYTES )
+	{
+		for ( int i=0; i<AES128_BLOCK_BYTES; i++ )
+			ctx->X[i] ^= ctx->buffer[i] ^ m_K1[i];
+	}
+	else
+	{
+		unsigned char pad[AES128_BLOCK_BYTES];
+		padding(ctx->buffer, pad, ctx->buffered);
+		for ( int i=0; i<AES128_BLOCK_BYTES; i++ )
+			ctx->X[i] ^= pad[i] ^ m_K2[i];
+	}
+	encryptBlocks(ctx->X,ctx->X,1);
+	memcpy(tag,ctx->X,m_tagLength);
+	memset(ctx,0,sizeof(CMACContext));
 }
 
 // Left shifts every element of an array of length BLOCK_BYTE_SIZE. This
@@ -127,22 +355,15 @@ void AES128_CMAC::padding ( unsigned char *lastb, unsigned char *pad, unsigned l
  */
 void AES128_CMAC::aesCMac(unsigned char *M, unsigned long M_length, unsigned char *CMAC)
 {
-    unsigned char K1[AES128_BLOCK_BYTES], K2[AES128_BLOCK_BYTES],
-             L[AES128_BLOCK_BYTES], M_last[AES128_BLOCK_BYTES];
+    unsigned char *K1 = m_K1, *K2 = m_K2, M_last[AES128_BLOCK_BYTES];
 
-	memset(K1,0,AES128_BLOCK_BYTES);
-	memset(K2,0,AES128_BLOCK_BYTES);
-	memset(L,0,AES128_BLOCK_BYTES);
 	memset(M_last,0,AES128_BLOCK_BYTES);
 
     unsigned long blockCount = 0;
 
     bool isComplete = true;
 
-    // Step 1.
-	encrypt(L);
-    expandMacKey(L, K1);
-    expandMacKey(K1, K2);
+    // Step 1. The subkeys are derived when the key is set
 
     // Step 2. determine the needed number of blocks of lenght BLOCK_BYTE_SIZE.
     blockCount = (unsigned long)ceil((double) M_length / (double)AES128_BLOCK_BYTES); // TODO: Can we get by w/o double calc?
@@ -178,46 +399,26 @@ void AES128_CMAC::aesCMac(unsigned char *M, unsigned long M_length, unsigned cha
 	memset(Y,0,AES128_BLOCK_BYTES);
 
     // Step 6.
-    unsigned long i, j;
+    unsigned long i;
     for(i = 0; i < blockCount-1; i++){
         //Y := X XOR M_i;
         xorToLength(X, &M[AES128_BLOCK_BYTES * i], Y);
-        //AES-128(K,Y);
-		encrypt(Y);
-
-        // X:= AES-128(K,Y); Necessary because encryptBlock does not copy the
-        // encrypted text into a new target vector.
-        for(j = 0; j < AES128_BLOCK_BYTES; j++){
-            X[j] = Y[j];
-        }
+        // X:= AES-128(K,Y);
+		encryptBlocks(Y, X, 1);
     }
 
     // XOR and encrypt the last block of M to produce the CMAC.
     xorToLength(X, M_last, Y);
-	encrypt(Y);
 
     // Step 7. T := AES-128(K,Y); where in our case T == CMAC
-    for(i = 0; i < AES128_BLOCK_BYTES; i++){
-        CMAC[i] = Y[i];
-    }
+	encryptBlocks(Y, CMAC, 1);
 }
 
 bool AES128_CMAC::aesCMacVerify(unsigned char *M, unsigned int M_length, unsigned char * CMACm)
 {
-
 	unsigned char CMAC[AES128_BLOCK_BYTES];
 
-    mac(M, M_length, CMAC);
-
-/*    int32_ard i;
-    for(i = 0; i<BLOCK_BYTE_SIZE; i++){
-        if(CMAC[i] != CMACm[i]){
-            return 0;
-        }
-    }
-
-    return 1; */
-
-    // TODO: How about truncated MACs?
-    return ( strncmp((const char *)CMAC, (const char *)CMACm, AES128_BLOCK_BYTES)==0 );
+	// The whole (possibly truncated) tag is compared, without an early exit
+	mac(M, M_length, CMAC);
+	return cryptoTagsEqual(CMAC, CMACm, m_tagLength);
 }
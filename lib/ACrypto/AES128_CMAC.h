@@ -35,17 +35,51 @@
 #define CMAC_VALID 1
 #define CMAC_INVALID 0
 
+// The shortest tag setTagLength accepts (64 bits, as recommended by NIST SP 800-38B)
+#define CMAC_MIN_TAG_BYTES 8
+
 #include <math.h>
 #include "AES128.h"
 
+// The number of independent chains AES128_CMAC::verifyBatch runs through the cipher at once.
+#if defined(__AVR__)
+#define CMAC_BATCH_LANES 2
+#else
+#define CMAC_BATCH_LANES 8
+#endif
+
 const unsigned char constRb[] =
     {0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x0,
      0x0,0x0,0x0,0x0,0x0,0x0,0x0,0x87};
 
+/**
+ *  The state of an incremental CMAC computation. A context is used with the AES128_CMAC
+ *  instance (key) it was initialized by; one instance can run any number of contexts.
+ */
+struct CMACContext
+{
+	unsigned char X[AES128_BLOCK_BYTES];       /// The CBC-MAC chaining value
+	unsigned char buffer[AES128_BLOCK_BYTES];  /// Input held back until it is known not to be last
+	unsigned int buffered;
+};
+
+/**
+ *  A message and the tag it is expected to carry, for AES128_CMAC::verifyBatch.
+ */
+struct CMACJob
+{
+	const unsigned char *message;
+	unsigned int length;
+	const unsigned char *tag;
+};
+
 /**
  *  @brief AES128-based CMAC
  *
  *  This CMAC uses the AES128 block cipher algorithm and derives from that class in this library.
+ *  The subkeys K1 and K2 are derived once per key. Messages which are not contiguous in memory
+ *  can be MACed piecewise with init/update/final. Tags may be truncated to their leading
+ *  tagLength() bytes (RFC 4493, 2.4); all tags of an instance have that length.
  *
  *  @author Kristjan Runarsson
  *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
@@ -53,21 +87,70 @@ const unsigned char constRb[] =
 class AES128_CMAC : public AES128
 {
 	public:
-		AES128_CMAC(unsigned char *key) : AES128(key) {};
+		AES128_CMAC(unsigned char *key);
+		AES128_CMAC(const AES128Key *key);
 
 	public:
+		virtual void rekey(unsigned char *key);
+		void rekey(const AES128Key *key);
+
+		/**
+		 *  Set the length of the tags written by mac() and final() and checked by verify() and
+		 *  verifyBatch(), from CMAC_MIN_TAG_BYTES to AES128_BLOCK_BYTES (the default). A
+		 *  truncated tag is the leading bytes of the full one. Returns false, leaving the
+		 *  length as it was, if length is out of range.
+		 */
+		bool setTagLength(unsigned int length);
+		unsigned int tagLength() { return m_tagLength; }
+
 		virtual void mac(unsigned char *message, unsigned int mlen, unsigned char *tag);
+		/**
+		 *  One-shot CMAC under a raw key, with no instance: the subkeys are derived on the
+		 *  stack and every block goes through AES128::encrypt(key,block), which generates the
+		 *  round keys on the fly. Beyond a few blocks, or for a key used more than once, an
+		 *  instance is faster. The static calls always use full length tags.
+		 */
 		static void mac(unsigned char *key, unsigned char *message, unsigned int mlen, unsigned char *tag);
 		virtual bool verify(unsigned char *message, unsigned int mlen, unsigned char *tag);
 		static bool verify(unsigned char *key, unsigned char *message, unsigned int mlen, unsigned char *tag);
+		/**
+		 *  Verify a batch of messages under this key. Up to CMAC_BATCH_LANES CBC-MAC chains are
+		 *  advanced together so that the cipher gets several blocks per call, which pays off
+		 *  for many short messages. Bit i%8 of valid[i/8] is set if message i carries its tag
+		 *  and cleared otherwise, so valid must hold (count+7)/8 bytes. Returns the number of
+		 *  valid messages.
+		 */
+		unsigned int verifyBatch(const CMACJob *jobs, unsigned int count, unsigned char *valid);
+		/**
+		 *  Copy out the subkeys K1 and K2 (RFC 4493, 2.3) for compositions which run the CMAC
+		 *  chain themselves.
+		 */
+		void subkeys(unsigned char *K1, unsigned char *K2);
+
+		/**
+		 *  Incremental CMAC. update() takes chunks of any length, including zero; the tag
+		 *  written by final() is the same as mac() over the concatenated chunks. final() clears
+		 *  the context, which must be initialized again before reuse.
+		 */
+		void init(CMACContext *ctx);
+		void update(CMACContext *ctx, const unsigned char *chunk, unsigned int length);
+		void final(CMACContext *ctx, unsigned char *tag);
 
 	protected:
-		void leftShiftKey(unsigned char *orig, unsigned char *shifted);
-		void xorToLength(unsigned char *p, unsigned char *q, unsigned char *r);
-		void expandMacKey(unsigned char *origKey, unsigned char *newKey);
-		void padding ( unsigned char *lastb, unsigned char *pad, unsigned long length);
+		static void leftShiftKey(unsigned char *orig, unsigned char *shifted);
+		static void xorToLength(unsigned char *p, unsigned char *q, unsigned char *r);
+		static void expandMacKey(unsigned char *origKey, unsigned char *newKey);
+		static void padding ( unsigned char *lastb, unsigned char *pad, unsigned long length);
 		void aesCMac(unsigned char *M, unsigned long length, unsigned char *cmac);
 		bool aesCMacVerify(unsigned char *M, unsigned int M_length, unsigned char * CMACm);
+
+	private:
+		void generateSubkeys();
+
+	private:
+		unsigned char m_K1[AES128_BLOCK_BYTES];
+		unsigned char m_K2[AES128_BLOCK_BYTES];
+		unsigned int m_tagLength;
 };
 
 #endif /* __ACRYPTO_CMAC_H */
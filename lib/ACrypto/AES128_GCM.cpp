@@ -0,0 +1,484 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "AES128_GCM.h"
+
+#if defined(ACRYPTO_X86)
+
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+#define CLMUL_TARGET __attribute__((target("pclmul,ssse3,sse2")))
+
+//
+// The carry-less multiply GHASH follows the Intel white paper "Intel Carry-Less Multiplication
+// Instruction and its Usage for Computing the GCM Mode" (Gueron, Kounavis). Blocks are byte
+// reflected on load; the bit reflection is then handled by a one bit shift of the 256-bit
+// product before the reduction modulo x^128 + x^7 + x^2 + x + 1.
+//
+
+static bool clmulAvailable()
+{
+	static int s_available = -1;
+	if ( s_available < 0 )
+	{
+		unsigned int eax, ebx, ecx, edx;
+		if ( __get_cpuid(1,&eax,&ebx,&ecx,&edx) )
+			s_available = ((ecx & bit_PCLMUL) && (ecx & bit_SSSE3)) ? 1 : 0;
+		else
+			s_available = 0;
+	}
+	return s_available==1;
+}
+
+CLMUL_TARGET
+static inline __m128i clmulReflect(__m128i x)
+{
+	return _mm_shuffle_epi8(x,_mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15));
+}
+
+// Accumulate the unreduced product a*b into lo, mid and hi
+CLMUL_TARGET
+static inline void clmulAccumulate(__m128i a, __m128i b, __m128i &lo, __m128i &mid, __m128i &hi)
+{
+	lo = _mm_xor_si128(lo,_mm_clmulepi64_si128(a,b,0x00));
+	hi = _mm_xor_si128(hi,_mm_clmulepi64_si128(a,b,0x11));
+	mid = _mm_xor_si128(mid,_mm_clmulepi64_si128(a,b,0x01));
+	mid = _mm_xor_si128(mid,_mm_clmulepi64_si128(a,b,0x10));
+}
+
+CLMUL_TARGET
+static inline __m128i clmulReduce(__m128i lo, __m128i mid, __m128i hi)
+{
+	lo = _mm_xor_si128(lo,_mm_slli_si128(mid,8));
+	hi = _mm_xor_si128(hi,_mm_srli_si128(mid,8));
+
+	// Shift the 256-bit product <hi:lo> left by one bit
+	__m128i t7 = _mm_srli_epi32(lo,31);
+	__m128i t8 = _mm_srli_epi32(hi,31);
+	lo = _mm_slli_epi32(lo,1);
+	hi = _mm_slli_epi32(hi,1);
+	__m128i t9 = _mm_srli_si128(t7,12);
+	t8 = _mm_slli_si128(t8,4);
+	t7 = _mm_slli_si128(t7,4);
+	lo = _mm_or_si128(lo,t7);
+	hi = _mm_or_si128(hi,t8);
+	hi = _mm_or_si128(hi,t9);
+
+	// Reduce
+	t7 = _mm_slli_epi32(lo,31);
+	t8 = _mm_slli_epi32(lo,30);
+	t9 = _mm_slli_epi32(lo,25);
+	t7 = _mm_xor_si128(t7,_mm_xor_si128(t8,t9));
+	t8 = _mm_srli_si128(t7,4);
+	t7 = _mm_slli_si128(t7,12);
+	lo = _mm_xor_si128(lo,t7);
+	__m128i t2 = _mm_srli_epi32(lo,1);
+	__m128i t4 = _mm_srli_epi32(lo,2);
+	__m128i t5 = _mm_srli_epi32(lo,7);
+	t2 = _mm_xor_si128(t2,_mm_xor_si128(t4,_mm_xor_si128(t5,t8)));
+	lo = _mm_xor_si128(lo,t2);
+	return _mm_xor_si128(hi,lo);
+}
+
+CLMUL_TARGET
+static void clmulPowers(const unsigned char *H, unsigned char *Hpow)
+{
+	__m128i h = clmulReflect(_mm_loadu_si128((const __m128i *)H));
+	__m128i p = h;
+	_mm_storeu_si128((__m128i *)Hpow,h);
+	for ( int i=1; i<GCM_H_POWERS; i++ )
+	{
+		__m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+		clmulAccumulate(p,h,lo,mid,hi);
+		p = clmulReduce(lo,mid,hi);
+		_mm_storeu_si128((__m128i *)(Hpow+16*i),p);
+	}
+}
+
+//
+// Y = (...((Y ^ X1)*H ^ X2)*H ...)*H is computed as (Y ^ X1)*H^n ^ X2*H^(n-1) ^ ... ^ Xn*H,
+// n blocks at a time with one reduction.
+//
+CLMUL_TARGET
+static void clmulHash(const unsigned char *Hpow, unsigned char *Y, const unsigned char *data, unsigned int nblocks)
+{
+	__m128i y = clmulReflect(_mm_loadu_si128((const __m128i *)Y));
+	while ( nblocks>0 )
+	{
+		unsigned int n = nblocks<GCM_H_POWERS ? nblocks : GCM_H_POWERS;
+		__m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+		for ( unsigned int j=0; j<n; j++ )
+		{
+			__m128i x = clmulReflect(_mm_loadu_si128((const __m128i *)(data+16*j)));
+			if ( j==0 )
+				x = _mm_xor_si128(x,y);
+			clmulAccumulate(x,_mm_loadu_si128((const __m128i *)(Hpow+16*(n-1-j))),lo,mid,hi);
+		}
+		y = clmulReduce(lo,mid,hi);
+		data += 16*n;
+		nblocks -= n;
+	}
+	_mm_storeu_si128((__m128i *)Y,clmulReflect(y));
+}
+
+#endif /* ACRYPTO_X86 */
+
+// Reduction of the four bits shifted out in Shoup's method
+static const uint16_t gcmLast4[16] =
+{
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static inline uint64_t getu64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	for ( int i=0; i<8; i++ )
+		v = (v<<8) | p[i];
+	return v;
+}
+
+static inline void putu64(unsigned char *p, uint64_t v)
+{
+	for ( int i=7; i>=0; i-- )
+	{
+		p[i] = (unsigned char)v;
+		v >>= 8;
+	}
+}
+
+// The GCM counter increment: the low 32 bits of the block, big-endian, modulo 2^32
+static inline void inc32(unsigned char *counter)
+{
+	for ( int i=15; i>=12; i-- )
+		if ( ++counter[i]!=0 )
+			break;
+}
+
+AES128_GCM::AES128_GCM(unsigned char *key, CryptoArena *arena)
+{
+#if defined(ACRYPTO_X86)
+	m_bCLMUL = clmulAvailable();
+#else
+	m_bCLMUL = false;
+#endif
+	m_aes = new (arena) AES128(key);
+	if ( m_aes!=NULL )
+		prepareHash();
+}
+
+AES128_GCM::AES128_GCM(const AES128Key *key, CryptoArena *arena)
+{
+#if defined(ACRYPTO_X86)
+	m_bCLMUL = clmulAvailable();
+#else
+	m_bCLMUL = false;
+#endif
+	m_aes = new (arena) AES128(key);
+	if ( m_aes!=NULL )
+		prepareHash();
+}
+
+AES128_GCM::~AES128_GCM()
+{
+	delete m_aes;
+}
+
+void AES128_GCM::rekey(unsigned char *key)
+{
+	m_aes->rekey(key);
+	prepareHash();
+}
+
+void AES128_GCM::rekey(const AES128Key *key)
+{
+	m_aes->rekey(key);
+	prepareHash();
+}
+
+bool AES128_GCM::enableCLMUL(bool enable)
+{
+#if defined(ACRYPTO_X86)
+	m_bCLMUL = enable && clmulAvailable();
+	prepareHash();
+#else
+	(void)enable;
+#endif
+	return m_bCLMUL;
+}
+
+bool AES128_GCM::usesCLMUL()
+{
+	return m_bCLMUL;
+}
+
+/**
+ *  Derive the hash subkey H = E_K(0^128) and the tables for the selected GHASH.
+ */
+void AES128_GCM::prepareHash()
+{
+	unsigned char H[AES128_BLOCK_BYTES];
+	memset(H,0,AES128_BLOCK_BYTES);
+	m_aes->encrypt(H);
+
+#if defined(ACRYPTO_X86)
+	if ( m_bCLMUL )
+	{
+		clmulPowers(H,m_Hpow);
+		memset(H,0,AES128_BLOCK_BYTES);
+		return;
+	}
+#endif
+
+	// Shoup's 4-bit table: m_HH[i]:m_HL[i] = i*H, the nibble bits in GCM (reflected) order
+	uint64_t vh = getu64(H);
+	uint64_t vl = getu64(H+8);
+	m_HL[8] = vl;
+	m_HH[8] = vh;
+	m_HL[0] = 0;
+	m_HH[0] = 0;
+	for ( int i=4; i>0; i>>=1 )
+	{
+		uint32_t T = (uint32_t)(vl & 1) * 0xe1000000U;
+		vl = (vh<<63) | (vl>>1);
+		vh = (vh>>1) ^ ((uint64_t)T<<32);
+		m_HL[i] = vl;
+		m_HH[i] = vh;
+	}
+	for ( int i=2; i<=8; i*=2 )
+	{
+		for ( int j=1; j<i; j++ )
+		{
+			m_HH[i+j] = m_HH[i] ^ m_HH[j];
+			m_HL[i+j] = m_HL[i] ^ m_HL[j];
+		}
+	}
+	memset(H,0,AES128_BLOCK_BYTES);
+}
+
+/**
+ *  Y = Y*H in GF(2^128), four bits at a time.
+ */
+void AES128_GCM::multiplyH(unsigned char *Y)
+{
+	unsigned char lo = Y[15] & 0xf;
+	uint64_t zh = m_HH[lo];
+	uint64_t zl = m_HL[lo];
+	unsigned char rem;
+
+	for ( int i=15; i>=0; i-- )
+	{
+		lo = Y[i] & 0xf;
+		unsigned char hi = (Y[i]>>4) & 0xf;
+		if ( i!=15 )
+		{
+			rem = (unsigned char)(zl & 0xf);
+			zl = (zh<<60) | (zl>>4);
+			zh = (zh>>4) ^ ((uint64_t)gcmLast4[rem]<<48);
+			zh ^= m_HH[lo];
+			zl ^= m_HL[lo];
+		}
+		rem = (unsigned char)(zl & 0xf);
+		zl = (zh<<60) | (zl>>4);
+		zh = (zh>>4) ^ ((uint64_t)gcmLast4[rem]<<48);
+		zh ^= m_HH[hi];
+		zl ^= m_HL[hi];
+	}
+	putu64(Y,zh);
+	putu64(Y+8,zl);
+}
+
+void AES128_GCM::hashBlocks(unsigned char *Y, const unsigned char *data, unsigned int nblocks)
+{
+#if defined(ACRYPTO_X86)
+	if ( m_bCLMUL )
+	{
+		clmulHash(m_Hpow,Y,data,nblocks);
+		return;
+	}
+#endif
+	for ( unsigned int b=0; b<nblocks; b++, data+=AES128_BLOCK_BYTES )
+	{
+		for ( int i=0; i<AES128_BLOCK_BYTES; i++ )
+			Y[i] ^= data[i];
+		multiplyH(Y);
+	}
+}
+
+/**
+ *  Absorb length bytes into the GHASH state Y. A trailing partial block is zero padded.
+ */
+void AES128_GCM::hash(unsigned char *Y, const unsigned char *data, unsigned int length)
+{
+	unsigned int blocks = length / AES128_BLOCK_BYTES;
+	unsigned int rest = length % AES128_BLOCK_BYTES;
+	if ( blocks>0 )
+		hashBlocks(Y,data,blocks);
+	if ( rest>0 )
+	{
+		unsigned char last[AES128_BLOCK_BYTES];
+		memset(last,0,AES128_BLOCK_BYTES);
+		memcpy(last,data+blocks*AES128_BLOCK_BYTES,rest);
+		hashBlocks(Y,last,1);
+	}
+}
+
+/**
+ *  The pre-counter block J0: IV || 0^31 || 1 for a 96-bit IV, GHASH of the IV otherwise.
+ */
+void AES128_GCM::initCounter(const unsigned char *IV, unsigned int ivlen, unsigned char *J0)
+{
+	if ( ivlen==GCM_IV_BYTES )
+	{
+		memcpy(J0,IV,GCM_IV_BYTES);
+		J0[12] = 0;
+		J0[13] = 0;
+		J0[14] = 0;
+		J0[15] = 1;
+		return;
+	}
+	unsigned char lengths[AES128_BLOCK_BYTES];
+	memset(J0,0,AES128_BLOCK_BYTES);
+	hash(J0,IV,ivlen);
+	putu64(lengths,0);
+	putu64(lengths+8,(uint64_t)ivlen*8);
+	hashBlocks(J0,lengths,1);
+}
+
+/**
+ *  Apply the keystream starting at inc32(J0) to the message and absorb the ciphertext into Y,
+ *  GCM_PARALLEL_BLOCKS at a time. hashFirst is true when the message holds ciphertext.
+ */
+void AES128_GCM::counterMode(unsigned char *Y, const unsigned char *in, unsigned char *out,
+	unsigned int length, const unsigned char *J0, bool hashFirst)
+{
+	unsigned char counter[AES128_BLOCK_BYTES];
+	unsigned char keystream[GCM_PARALLEL_BLOCKS*AES128_BLOCK_BYTES];
+
+	memcpy(counter,J0,AES128_BLOCK_BYTES);
+	while ( length>0 )
+	{
+		unsigned int blocks = (length+AES128_BLOCK_BYTES-1) / AES128_BLOCK_BYTES;
+		if ( blocks>GCM_PARALLEL_BLOCKS )
+			blocks = GCM_PARALLEL_BLOCKS;
+		for ( unsigned int i=0; i<blocks; i++ )
+		{
+			inc32(counter);
+			memcpy(keystream+i*AES128_BLOCK_BYTES,counter,AES128_BLOCK_BYTES);
+		}
+		m_aes->encryptBlocks(keystream,keystream,blocks);
+
+		unsigned int n = blocks*AES128_BLOCK_BYTES;
+		if ( n>length )
+			n = length;
+		if ( hashFirst && Y!=NULL )
+			hash(Y,in,n);
+		// XOR in the keystream buffer and hash the ciphertext from there, so out is only written
+		for ( unsigned int i=0; i<n; i++ )
+			keystream[i] ^= in[i];
+		if ( !hashFirst && Y!=NULL )
+			hash(Y,keystream,n);
+		memcpy(out,keystream,n);
+
+		in += n;
+		out += n;
+		length -= n;
+	}
+}
+
+void AES128_GCM::finishTag(unsigned char *Y, unsigned int aadlen, unsigned int length,
+	const unsigned char *J0, unsigned char *tag)
+{
+	unsigned char lengths[AES128_BLOCK_BYTES];
+	putu64(lengths,(uint64_t)aadlen*8);
+	putu64(lengths+8,(uint64_t)length*8);
+	hashBlocks(Y,lengths,1);
+
+	memcpy(tag,J0,AES128_BLOCK_BYTES);
+	m_aes->encrypt(tag);
+	for ( int i=0; i<GCM_TAG_BYTES; i++ )
+		tag[i] ^= Y[i];
+}
+
+void AES128_GCM::encryptAndTag(unsigned char *message, unsigned int length, const unsigned char *IV,
+	unsigned int ivlen, const unsigned char *aad, unsigned int aadlen, unsigned char *tag)
+{
+	encryptAndTag(message,length,message,IV,ivlen,aad,aadlen,tag);
+}
+
+bool AES128_GCM::decryptAndVerify(unsigned char *message, unsigned int length, const unsigned char *IV,
+	unsigned int ivlen, const unsigned char *aad, unsigned int aadlen, const unsigned char *tag)
+{
+	return decryptAndVerify(message,length,message,IV,ivlen,aad,aadlen,tag);
+}
+
+void AES128_GCM::encryptAndTag(const unsigned char *in, unsigned int length, unsigned char *out,
+	const unsigned char *IV, unsigned int ivlen, const unsigned char *aad, unsigned int aadlen,
+	unsigned char *tag)
+{
+	unsigned char J0[AES128_BLOCK_BYTES];
+	unsigned char Y[AES128_BLOCK_BYTES];
+
+	initCounter(IV,ivlen,J0);
+	memset(Y,0,AES128_BLOCK_BYTES);
+	hash(Y,aad,aadlen);
+	counterMode(Y,in,out,length,J0,false);
+	finishTag(Y,aadlen,length,J0,tag);
+}
+
+bool AES128_GCM::decryptAndVerify(const unsigned char *in, unsigned int length, unsigned char *out,
+	const unsigned char *IV, unsigned int ivlen, const unsigned char *aad, unsigned int aadlen,
+	const unsigned char *tag)
+{
+	unsigned char J0[AES128_BLOCK_BYTES];
+	unsigned char Y[AES128_BLOCK_BYTES];
+	unsigned char expected[GCM_TAG_BYTES];
+
+	initCounter(IV,ivlen,J0);
+	memset(Y,0,AES128_BLOCK_BYTES);
+	hash(Y,aad,aadlen);
+	counterMode(Y,in,out,length,J0,true);
+	finishTag(Y,aadlen,length,J0,expected);
+
+	if ( !cryptoTagsEqual(expected,tag,GCM_TAG_BYTES) )
+	{
+		// In place the ciphertext is restored by applying the keystream again; otherwise the
+		// plaintext is wiped
+		if ( in==out )
+			counterMode(NULL,out,out,length,J0,false);
+		else
+			memset(out,0,length);
+		return false;
+	}
+	return true;
+}
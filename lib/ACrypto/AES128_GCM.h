@@ -0,0 +1,142 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_AES128_GCM_H
+#define __ACRYPTO_AES128_GCM_H
+
+#include <stdint.h>
+#include "AES128.h"
+
+#define GCM_TAG_BYTES 16
+#define GCM_IV_BYTES 12   // The recommended IV length; other lengths are hashed into J0
+
+// The number of counter blocks encrypted, and ciphertext blocks hashed, per step
+#if defined(__AVR__)
+#define GCM_PARALLEL_BLOCKS 1
+#else
+#define GCM_PARALLEL_BLOCKS 8
+#endif
+
+// The number of powers of H kept for the carry-less multiply GHASH
+#define GCM_H_POWERS 8
+
+/**
+ *  @brief AES128 in Galois/Counter Mode (NIST SP 800-38D).
+ *
+ *  An authenticated encryption with associated data in a single pass over the message. The
+ *  counter mode blocks are independent and go through the multi-block AES128 kernels in
+ *  groups of GCM_PARALLEL_BLOCKS.
+ *
+ *  GHASH uses the PCLMULQDQ carry-less multiply where the CPU has it. The powers H..H^8 are
+ *  precomputed so that up to eight blocks are multiplied and summed before a single reduction.
+ *  Elsewhere GHASH uses Shoup's 4-bit tables (256 bytes per key). The table lookups are
+ *  indexed by data, so unlike the carry-less multiply that path is not constant time.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+class AES128_GCM : public CryptoObject
+{
+	public:
+		/**
+		 *  The cipher is placed in arena if one is given.
+		 */
+		AES128_GCM(unsigned char *key, CryptoArena *arena=NULL);
+		/**
+		 *  Construct on an expanded key, which is shared rather than copied.
+		 */
+		AES128_GCM(const AES128Key *key, CryptoArena *arena=NULL);
+		virtual ~AES128_GCM();
+
+		/**
+		 *  False if the cipher could not be allocated, in which case the instance must not be
+		 *  used.
+		 */
+		bool valid() { return m_aes!=NULL; }
+
+	public:
+		/**
+		 *  Encrypt length bytes of message in place and compute the GCM_TAG_BYTES tag over the
+		 *  additional data and the ciphertext. No padding is needed. The IV must never be
+		 *  reused with the same key; GCM_IV_BYTES is the recommended length.
+		 */
+		void encryptAndTag(unsigned char *message, unsigned int length, const unsigned char *IV,
+			unsigned int ivlen, const unsigned char *aad, unsigned int aadlen, unsigned char *tag);
+		/**
+		 *  Decrypt length bytes of message in place and verify the tag. Decryption and GHASH
+		 *  are done in one pass; if the tag does not verify the ciphertext is restored and false
+		 *  is returned, so no unauthenticated plaintext is left in the buffer.
+		 */
+		bool decryptAndVerify(unsigned char *message, unsigned int length, const unsigned char *IV,
+			unsigned int ivlen, const unsigned char *aad, unsigned int aadlen, const unsigned char *tag);
+		/**
+		 *  Out-of-place encrypt and tag: reads length bytes from in, which is left untouched,
+		 *  and writes the ciphertext to out. Each byte is read and written once.
+		 */
+		void encryptAndTag(const unsigned char *in, unsigned int length, unsigned char *out,
+			const unsigned char *IV, unsigned int ivlen, const unsigned char *aad, unsigned int aadlen,
+			unsigned char *tag);
+		/**
+		 *  Out-of-place decrypt and verify. If the tag does not verify out is zeroed and false
+		 *  is returned.
+		 */
+		bool decryptAndVerify(const unsigned char *in, unsigned int length, unsigned char *out,
+			const unsigned char *IV, unsigned int ivlen, const unsigned char *aad, unsigned int aadlen,
+			const unsigned char *tag);
+		void rekey(unsigned char *key);
+		void rekey(const AES128Key *key);
+
+		/**
+		 *  Select the carry-less multiply GHASH. It is on by default if the CPU supports it.
+		 *  Returns true if the carry-less multiply is in use after the call.
+		 */
+		bool enableCLMUL(bool enable=true);
+		bool usesCLMUL();
+
+	private:
+		void prepareHash();
+		void initCounter(const unsigned char *IV, unsigned int ivlen, unsigned char *J0);
+		void hash(unsigned char *Y, const unsigned char *data, unsigned int length);
+		void hashBlocks(unsigned char *Y, const unsigned char *data, unsigned int nblocks);
+		void multiplyH(unsigned char *Y);
+		void counterMode(unsigned char *Y, const unsigned char *in, unsigned char *out,
+			unsigned int length, const unsigned char *J0, bool hashFirst);
+		void finishTag(unsigned char *Y, unsigned int aadlen, unsigned int length,
+			const unsigned char *J0, unsigned char *tag);
+
+	private:
+		AES128 *m_aes;
+		uint64_t m_HL[16];   /// Shoup's table, low halves of i*H
+		uint64_t m_HH[16];   /// Shoup's table, high halves of i*H
+		unsigned char m_Hpow[GCM_H_POWERS*16];   /// H..H^8, byte reflected, for the carry-less multiply
+		bool m_bCLMUL;
+};
+
+#endif /* __ACRYPTO_AES128_GCM_H */
@@ -0,0 +1,253 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "AES128_NI.h"
+
+#if defined(ACRYPTO_X86)
+
+#include <string.h>
+#include <cpuid.h>
+#include <wmmintrin.h>
+
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+
+//
+// The round keys are laid out in FIPS-197 byte order, 16 bytes per round, which is exactly
+// what the AES instructions expect in an XMM register.
+//
+#define rk(keys,round) _mm_loadu_si128((const __m128i *)((keys)+16*(round)))
+
+bool AES128_NI::available()
+{
+	static int s_available = -1;
+	if ( s_available < 0 )
+	{
+		unsigned int eax, ebx, ecx, edx;
+		if ( __get_cpuid(1,&eax,&ebx,&ecx,&edx) )
+			s_available = ((ecx & bit_AES) && (edx & bit_SSE2)) ? 1 : 0;
+		else
+			s_available = 0;
+	}
+	return s_available==1;
+}
+
+AESNI_TARGET
+void AES128_NI::prepareDecryptionKeys(const unsigned char *keys, unsigned char *decKeys)
+{
+	// The decryption schedule is stored in the order it is applied: the last encryption round
+	// key first, InvMixColumns applied to the nine inner round keys.
+	_mm_storeu_si128((__m128i *)decKeys, rk(keys,10));
+	for ( int round=1; round<10; ++round )
+		_mm_storeu_si128((__m128i *)(decKeys+16*round), _mm_aesimc_si128(rk(keys,10-round)));
+	_mm_storeu_si128((__m128i *)(decKeys+160), rk(keys,0));
+}
+
+AESNI_TARGET
+void AES128_NI::encrypt(const unsigned char *keys, unsigned char *block)
+{
+	__m128i s = _mm_loadu_si128((const __m128i *)block);
+	s = _mm_xor_si128(s, rk(keys,0));
+	s = _mm_aesenc_si128(s, rk(keys,1));
+	s = _mm_aesenc_si128(s, rk(keys,2));
+	s = _mm_aesenc_si128(s, rk(keys,3));
+	s = _mm_aesenc_si128(s, rk(keys,4));
+	s = _mm_aesenc_si128(s, rk(keys,5));
+	s = _mm_aesenc_si128(s, rk(keys,6));
+	s = _mm_aesenc_si128(s, rk(keys,7));
+	s = _mm_aesenc_si128(s, rk(keys,8));
+	s = _mm_aesenc_si128(s, rk(keys,9));
+	s = _mm_aesenclast_si128(s, rk(keys,10));
+	_mm_storeu_si128((__m128i *)block, s);
+}
+
+AESNI_TARGET
+void AES128_NI::encrypt2(const unsigned char *keysA, unsigned char *blockA, const unsigned char *keysB, unsigned char *blockB)
+{
+	__m128i a = _mm_loadu_si128((const __m128i *)blockA);
+	__m128i b = _mm_loadu_si128((const __m128i *)blockB);
+	a = _mm_xor_si128(a, rk(keysA,0));
+	b = _mm_xor_si128(b, rk(keysB,0));
+	for ( int round=1; round<10; ++round )
+	{
+		a = _mm_aesenc_si128(a, rk(keysA,round));
+		b = _mm_aesenc_si128(b, rk(keysB,round));
+	}
+	a = _mm_aesenclast_si128(a, rk(keysA,10));
+	b = _mm_aesenclast_si128(b, rk(keysB,10));
+	_mm_storeu_si128((__m128i *)blockA, a);
+	_mm_storeu_si128((__m128i *)blockB, b);
+}
+
+AESNI_TARGET
+void AES128_NI::decrypt(const unsigned char *decKeys, unsigned char *block)
+{
+	__m128i s = _mm_loadu_si128((const __m128i *)block);
+	s = _mm_xor_si128(s, rk(decKeys,0));
+	s = _mm_aesdec_si128(s, rk(decKeys,1));
+	s = _mm_aesdec_si128(s, rk(decKeys,2));
+	s = _mm_aesdec_si128(s, rk(decKeys,3));
+	s = _mm_aesdec_si128(s, rk(decKeys,4));
+	s = _mm_aesdec_si128(s, rk(decKeys,5));
+	s = _mm_aesdec_si128(s, rk(decKeys,6));
+	s = _mm_aesdec_si128(s, rk(decKeys,7));
+	s = _mm_aesdec_si128(s, rk(decKeys,8));
+	s = _mm_aesdec_si128(s, rk(decKeys,9));
+	s = _mm_aesdeclast_si128(s, rk(decKeys,10));
+	_mm_storeu_si128((__m128i *)block, s);
+}
+
+//
+// Key schedule steps for the one-shot kernels. AESKEYGENASSIST gives SubWord(RotWord(w)) ^ rcon
+// of the last word of its operand in the top lane. Forward: w'0 = w0 ^ f(w3), then each word
+// XORs in the one before it, which the three shifted XORs do for all four lanes at once.
+// Backward: k ^ (k<<32) recovers w1..w3 of the previous key, and f of the recovered w3 then
+// gives w0.
+//
+#define nextKey(k,rcon) { __m128i t = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k,rcon),0xff); \
+		k = _mm_xor_si128(k,_mm_slli_si128(k,4)); k = _mm_xor_si128(k,_mm_slli_si128(k,4)); \
+		k = _mm_xor_si128(k,_mm_slli_si128(k,4)); k = _mm_xor_si128(k,t); }
+#define previousKey(k,rcon) { k = _mm_xor_si128(k,_mm_slli_si128(k,4)); \
+		__m128i t = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(k,rcon),0xff); \
+		k = _mm_xor_si128(k,_mm_srli_si128(_mm_slli_si128(t,12),12)); }
+
+AESNI_TARGET
+void AES128_NI::encryptOnTheFly(const unsigned char *key, unsigned char *block)
+{
+	__m128i k = _mm_loadu_si128((const __m128i *)key);
+	__m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)block), k);
+	nextKey(k,0x01); s = _mm_aesenc_si128(s,k);
+	nextKey(k,0x02); s = _mm_aesenc_si128(s,k);
+	nextKey(k,0x04); s = _mm_aesenc_si128(s,k);
+	nextKey(k,0x08); s = _mm_aesenc_si128(s,k);
+	nextKey(k,0x10); s = _mm_aesenc_si128(s,k);
+	nextKey(k,0x20); s = _mm_aesenc_si128(s,k);
+	nextKey(k,0x40); s = _mm_aesenc_si128(s,k);
+	nextKey(k,0x80); s = _mm_aesenc_si128(s,k);
+	nextKey(k,0x1b); s = _mm_aesenc_si128(s,k);
+	nextKey(k,0x36); s = _mm_aesenclast_si128(s,k);
+	_mm_storeu_si128((__m128i *)block, s);
+}
+
+AESNI_TARGET
+void AES128_NI::decryptOnTheFly(const unsigned char *key, unsigned char *block)
+{
+	__m128i k = _mm_loadu_si128((const __m128i *)key);
+	nextKey(k,0x01); nextKey(k,0x02); nextKey(k,0x04); nextKey(k,0x08); nextKey(k,0x10);
+	nextKey(k,0x20); nextKey(k,0x40); nextKey(k,0x80); nextKey(k,0x1b); nextKey(k,0x36);
+
+	// The inner round keys go through InvMixColumns for the equivalent inverse cipher
+	__m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)block), k);
+	previousKey(k,0x36); s = _mm_aesdec_si128(s,_mm_aesimc_si128(k));
+	previousKey(k,0x1b); s = _mm_aesdec_si128(s,_mm_aesimc_si128(k));
+	previousKey(k,0x80); s = _mm_aesdec_si128(s,_mm_aesimc_si128(k));
+	previousKey(k,0x40); s = _mm_aesdec_si128(s,_mm_aesimc_si128(k));
+	previousKey(k,0x20); s = _mm_aesdec_si128(s,_mm_aesimc_si128(k));
+	previousKey(k,0x10); s = _mm_aesdec_si128(s,_mm_aesimc_si128(k));
+	previousKey(k,0x08); s = _mm_aesdec_si128(s,_mm_aesimc_si128(k));
+	previousKey(k,0x04); s = _mm_aesdec_si128(s,_mm_aesimc_si128(k));
+	previousKey(k,0x02); s = _mm_aesdec_si128(s,_mm_aesimc_si128(k));
+	previousKey(k,0x01); s = _mm_aesdeclast_si128(s,k);
+	_mm_storeu_si128((__m128i *)block, s);
+}
+
+//
+// Eight-way interleaved round: the same round key is applied to all blocks before moving on,
+// which hides the latency of the AES instructions.
+//
+#define round8(op,b,key) { __m128i k = (key); \
+		b[0] = op(b[0],k); b[1] = op(b[1],k); b[2] = op(b[2],k); b[3] = op(b[3],k); \
+		b[4] = op(b[4],k); b[5] = op(b[5],k); b[6] = op(b[6],k); b[7] = op(b[7],k); }
+
+AESNI_TARGET
+void AES128_NI::encryptBlocks(const unsigned char *keys, const unsigned char *in, unsigned char *out, unsigned int nblocks)
+{
+	__m128i b[8];
+	while ( nblocks>=8 )
+	{
+		for ( int i=0; i<8; i++ )
+			b[i] = _mm_loadu_si128((const __m128i *)(in+16*i));
+		round8(_mm_xor_si128,b,rk(keys,0));
+		for ( int round=1; round<10; round++ )
+			round8(_mm_aesenc_si128,b,rk(keys,round));
+		round8(_mm_aesenclast_si128,b,rk(keys,10));
+		for ( int i=0; i<8; i++ )
+			_mm_storeu_si128((__m128i *)(out+16*i),b[i]);
+		in += 128;
+		out += 128;
+		nblocks -= 8;
+	}
+	for ( unsigned int i=0; i<nblocks; i++ )
+	{
+		if ( out!=in )
+			memcpy(out+16*i,in+16*i,16);
+		encrypt(keys,out+16*i);
+	}
+}
+
+AESNI_TARGET
+void AES128_NI::decryptBlocks(const unsigned char *decKeys, const unsigned char *in, unsigned char *out, unsigned int nblocks)
+{
+	__m128i b[8];
+	while ( nblocks>=8 )
+	{
+		for ( int i=0; i<8; i++ )
+			b[i] = _mm_loadu_si128((const __m128i *)(in+16*i));
+		round8(_mm_xor_si128,b,rk(decKeys,0));
+		for ( int round=1; round<10; round++ )
+			round8(_mm_aesdec_si128,b,rk(decKeys,round));
+		round8(_mm_aesdeclast_si128,b,rk(decKeys,10));
+		for ( int i=0; i<8; i++ )
+			_mm_storeu_si128((__m128i *)(out+16*i),b[i]);
+		in += 128;
+		out += 128;
+		nblocks -= 8;
+	}
+	for ( unsigned int i=0; i<nblocks; i++ )
+	{
+		if ( out!=in )
+			memcpy(out+16*i,in+16*i,16);
+		decrypt(decKeys,out+16*i);
+	}
+}
+
+#else // !ACRYPTO_X86
+
+bool AES128_NI::available() { return false; }
+void AES128_NI::prepareDecryptionKeys(const unsigned char *, unsigned char *) {}
+void AES128_NI::encrypt(const unsigned char *, unsigned char *) {}
+void AES128_NI::encrypt2(const unsigned char *, unsigned char *, const unsigned char *, unsigned char *) {}
+void AES128_NI::decrypt(const unsigned char *, unsigned char *) {}
+void AES128_NI::encryptOnTheFly(const unsigned char *, unsigned char *) {}
+void AES128_NI::decryptOnTheFly(const unsigned char *, unsigned char *) {}
+void AES128_NI::encryptBlocks(const unsigned char *, const unsigned char *, unsigned char *, unsigned int) {}
+void AES128_NI::decryptBlocks(const unsigned char *, const unsigned char *, unsigned char *, unsigned int) {}
+
+#endif // ACRYPTO_X86
@@ -0,0 +1,79 @@
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_AES128_NI_H
+#define __ACRYPTO_AES128_NI_H
+
+#include "CryptoDefs.h"
+
+/**
+ *  @brief AES-NI backend for the AES128 class.
+ *
+ *  The kernels operate on the byte-ordered key schedules kept by AES128. Encryption uses the
+ *  regular schedule; decryption uses the equivalent inverse cipher schedule (FIPS-197, 5.3.5)
+ *  produced by prepareDecryptionKeys. On platforms other than x86 the class compiles to stubs
+ *  and available() returns false, so callers never reach the kernels.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+class AES128_NI
+{
+	public:
+		/**
+		 *  Returns true if the CPU supports the AES instructions. CPUID is queried once and the
+		 *  result cached.
+		 */
+		static bool available();
+
+		static void prepareDecryptionKeys(const unsigned char *keys, unsigned char *decKeys);
+
+		static void encrypt(const unsigned char *keys, unsigned char *block);
+		static void decrypt(const unsigned char *decKeys, unsigned char *block);
+		/**
+		 *  One-shot kernels on the raw 16-byte key. The round keys are generated with
+		 *  AESKEYGENASSIST as the rounds run and never stored; decryption runs the schedule
+		 *  forward to the last round key and then steps it back.
+		 */
+		static void encryptOnTheFly(const unsigned char *key, unsigned char *block);
+		static void decryptOnTheFly(const unsigned char *key, unsigned char *block);
+		/**
+		 *  Encrypt blockA under keysA and blockB under keysB with the rounds interleaved.
+		 */
+		static void encrypt2(const unsigned char *keysA, unsigned char *blockA, const unsigned char *keysB, unsigned char *blockB);
+
+		/**
+		 *  Multi-block kernels. Eight independent blocks are kept in flight so that the AES
+		 *  unit pipeline stays full; in and out may be the same buffer.
+		 */
+		static void encryptBlocks(const unsigned char *keys, const unsigned char *in, unsigned char *out, unsigned int nblocks);
+		static void decryptBlocks(const unsigned char *decKeys, const unsigned char *in, unsigned char *out, unsigned int nblocks);
+};
+
+#endif /* __ACRYPTO_AES128_NI_H */
@@ -0,0 +1,271 @@
+
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "AES128_PMAC.h"
+
+#if defined(ACRYPTO_THREADS)
+#include <pthread.h>
+
+#define PMAC_MAX_THREADS 64
+
+struct PMACSumJob
+{
+	AES128_PMAC *pmac;
+	const unsigned char *message;
+	unsigned int first;
+	unsigned int blocks;
+	unsigned char sigma[AES128_BLOCK_BYTES];
+};
+#endif
+
+AES128_PMAC::AES128_PMAC(unsigned char *key) : AES128(key), m_threads(1)
+{
+	// The base constructor keys the cipher through AES128::rekey
+	generateOffsets();
+}
+
+AES128_PMAC::AES128_PMAC(const AES128Key *key) : AES128(key), m_threads(1)
+{
+	generateOffsets();
+}
+
+//virtual
+void AES128_PMAC::rekey(unsigned char *key)
+{
+	AES128::rekey(key);
+	generateOffsets();
+}
+
+void AES128_PMAC::rekey(const AES128Key *key)
+{
+	AES128::rekey(key);
+	generateOffsets();
+}
+
+void AES128_PMAC::generateOffsets()
+{
+	memset(m_L[0],0,AES128_BLOCK_BYTES);
+	encrypt(m_L[0]);
+	for ( int i=1; i<PMAC_L_BLOCKS; i++ )
+		dbl(m_L[i-1],m_L[i]);
+
+	// L.x^-1: shift right, folding the dropped bit back in with x^-1 = x^127 + x^6 + x + 1
+	unsigned char carry = m_L[0][AES128_BLOCK_BYTES-1] & 1;
+	for ( int i=AES128_BLOCK_BYTES-1; i>0; i-- )
+		m_Linv[i] = (m_L[0][i] >> 1) | (m_L[0][i-1] << 7);
+	m_Linv[0] = m_L[0][0] >> 1;
+	if ( carry )
+	{
+		m_Linv[0] ^= 0x80;
+		m_Linv[AES128_BLOCK_BYTES-1] ^= 0x43;
+	}
+}
+
+//static
+void AES128_PMAC::dbl(const unsigned char *in, unsigned char *out)
+{
+	unsigned char carry = in[0] & 0x80;
+	for ( int i=0; i<AES128_BLOCK_BYTES-1; i++ )
+		out[i] = (in[i] << 1) | (in[i+1] >> 7);
+	out[AES128_BLOCK_BYTES-1] = in[AES128_BLOCK_BYTES-1] << 1;
+	if ( carry )
+		out[AES128_BLOCK_BYTES-1] ^= 0x87;
+}
+
+/**
+ *  The offset of block i (counting from one), the sum of L(j) over the bits j set in the Gray
+ *  code of i. Zero for i=0.
+ */
+void AES128_PMAC::offset(unsigned int i, unsigned char *delta)
+{
+	unsigned int gray = i ^ (i>>1);
+	unsigned char L[AES128_BLOCK_BYTES];
+	memset(delta,0,AES128_BLOCK_BYTES);
+	for ( unsigned int j=0; gray!=0; j++, gray>>=1 )
+	{
+		if ( j>=PMAC_L_BLOCKS )
+			dbl(j==PMAC_L_BLOCKS ? m_L[PMAC_L_BLOCKS-1] : L,L);
+		if ( gray & 1 )
+		{
+			const unsigned char *Lj = j<PMAC_L_BLOCKS ? m_L[j] : L;
+			for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+				delta[bb] ^= Lj[bb];
+		}
+	}
+}
+
+/**
+ *  Sum E_K(M_i XOR offset(i)) over the given blocks of the message, the first of which is block
+ *  number first, into sigma.
+ */
+void AES128_PMAC::sumBlocks(const unsigned char *message, unsigned int first, unsigned int blocks, unsigned char *sigma)
+{
+	unsigned char delta[AES128_BLOCK_BYTES], L[AES128_BLOCK_BYTES];
+	unsigned char group[PMAC_PARALLEL_BLOCKS*AES128_BLOCK_BYTES];
+
+	offset(first-1,delta);
+	memset(sigma,0,AES128_BLOCK_BYTES);
+	for ( unsigned int i=first; i<first+blocks; )
+	{
+		unsigned int n = first+blocks-i;
+		if ( n>PMAC_PARALLEL_BLOCKS )
+			n = PMAC_PARALLEL_BLOCKS;
+
+		// offset(i) = offset(i-1) XOR L(ntz(i))
+		for ( unsigned int k=0; k<n; k++ )
+		{
+			unsigned int index = i+k, ntz = 0;
+			while ( (index & 1)==0 )
+			{
+				index >>= 1;
+				ntz++;
+			}
+			const unsigned char *Lntz = m_L[ntz<PMAC_L_BLOCKS ? ntz : 0];
+			if ( ntz>=PMAC_L_BLOCKS )
+			{
+				memcpy(L,m_L[PMAC_L_BLOCKS-1],AES128_BLOCK_BYTES);
+				for ( unsigned int j=PMAC_L_BLOCKS-1; j<ntz; j++ )
+					dbl(L,L);
+				Lntz = L;
+			}
+			const unsigned char *M = message + (i+k-first)*AES128_BLOCK_BYTES;
+			unsigned char *X = group + k*AES128_BLOCK_BYTES;
+			for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+			{
+				delta[bb] ^= Lntz[bb];
+				X[bb] = M[bb] ^ delta[bb];
+			}
+		}
+		encryptBlocks(group,group,n);
+		for ( unsigned int k=0; k<n; k++ )
+			for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+				sigma[bb] ^= group[k*AES128_BLOCK_BYTES+bb];
+		i += n;
+	}
+	memset(group,0,sizeof(group));
+}
+
+#if defined(ACRYPTO_THREADS)
+//static
+void *AES128_PMAC::sumThread(void *arg)
+{
+	PMACSumJob *job = (PMACSumJob *)arg;
+	job->pmac->sumBlocks(job->message,job->first,job->blocks,job->sigma);
+	return NULL;
+}
+#endif
+
+void AES128_PMAC::sumMessage(const unsigned char *message, unsigned int blocks, unsigned char *sigma)
+{
+#if defined(ACRYPTO_THREADS)
+	unsigned int segments = blocks*AES128_BLOCK_BYTES / PMAC_PARALLEL_MIN_BYTES;
+	if ( segments > (unsigned int)m_threads )
+		segments = m_threads;
+	if ( segments > 1 )
+	{
+		// Each segment gets its first offset directly and sums its blocks on its own
+		PMACSumJob jobs[PMAC_MAX_THREADS];
+		pthread_t threads[PMAC_MAX_THREADS];
+		unsigned int perSegment = blocks / segments;
+		for ( unsigned int s=0; s<segments; s++ )
+		{
+			jobs[s].pmac = this;
+			jobs[s].message = message + s*perSegment*AES128_BLOCK_BYTES;
+			jobs[s].first = 1 + s*perSegment;
+			jobs[s].blocks = (s==segments-1) ? blocks - s*perSegment : perSegment;
+		}
+		unsigned int started = 1;
+		for ( ; started<segments; started++ )
+			if ( pthread_create(&threads[started],NULL,sumThread,&jobs[started])!=0 )
+				break;
+		sumThread(&jobs[0]);
+		for ( unsigned int s=1; s<started; s++ )
+			pthread_join(threads[s],NULL);
+		// Any segment a thread could not be started for is done here
+		for ( unsigned int s=started; s<segments; s++ )
+			sumThread(&jobs[s]);
+		memset(sigma,0,AES128_BLOCK_BYTES);
+		for ( unsigned int s=0; s<segments; s++ )
+			for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+				sigma[bb] ^= jobs[s].sigma[bb];
+		return;
+	}
+#endif
+
+	sumBlocks(message,1,blocks,sigma);
+}
+
+void AES128_PMAC::mac(const unsigned char *message, unsigned int mlen, unsigned char *tag)
+{
+	unsigned int blocks = (mlen+AES128_BLOCK_BYTES-1) / AES128_BLOCK_BYTES;
+	bool complete = blocks>0 && mlen%AES128_BLOCK_BYTES==0;
+	if ( blocks==0 )
+		blocks = 1;
+
+	// Every block but the last is encrypted independently
+	unsigned char sigma[AES128_BLOCK_BYTES];
+	sumMessage(message,blocks-1,sigma);
+
+	// The last block is added in unencrypted, with L.x^-1 if it is whole and padded if not
+	const unsigned char *last = message + (blocks-1)*AES128_BLOCK_BYTES;
+	if ( complete )
+	{
+		for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+			sigma[bb] ^= last[bb] ^ m_Linv[bb];
+	}
+	else
+	{
+		unsigned int tail = mlen - (blocks-1)*AES128_BLOCK_BYTES;
+		for ( unsigned int bb=0; bb<tail; bb++ )
+			sigma[bb] ^= last[bb];
+		sigma[tail] ^= 0x80;
+	}
+	encryptBlocks(sigma,tag,1);
+}
+
+bool AES128_PMAC::verify(const unsigned char *message, unsigned int mlen, const unsigned char *tag)
+{
+	unsigned char expected[AES128_BLOCK_BYTES];
+	mac(message,mlen,expected);
+	return cryptoTagsEqual(expected,tag,AES128_BLOCK_BYTES);
+}
+
+void AES128_PMAC::setThreads(int threads)
+{
+#if defined(ACRYPTO_THREADS)
+	if ( threads > PMAC_MAX_THREADS )
+		threads = PMAC_MAX_THREADS;
+	m_threads = threads < 1 ? 1 : threads;
+#else
+	(void)threads;
+#endif
+}
@@ -0,0 +1,109 @@
+
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_PMAC_H
+#define __ACRYPTO_PMAC_H
+
+#include "AES128.h"
+#include "AES128_CMAC.h"
+
+// Blocks handed to the cipher per call; the offsets of a group are computed up front.
+#define PMAC_PARALLEL_BLOCKS 8
+
+// The number of L(i) = L.x^i kept per key. Larger i, which only turn up every 2^i blocks, are
+// computed when needed.
+#if defined(__AVR__)
+#define PMAC_L_BLOCKS 8
+#else
+#define PMAC_L_BLOCKS 32
+#endif
+
+// With ACRYPTO_THREADS, messages are split over threads in segments of at least this size.
+#define PMAC_PARALLEL_MIN_BYTES 65536
+
+/**
+ *  @brief AES128-based PMAC
+ *
+ *  PMAC1 (Rogaway, "Efficient Instantiations of Tweakable Blockciphers and Refinements to
+ *  Modes OCB and PMAC", 2004). Every block but the last is masked with its own offset and
+ *  encrypted independently, and the results are summed; only the final block depends on the
+ *  rest. Unlike CMAC, the blocks of a message can therefore go through the cipher
+ *  PMAC_PARALLEL_BLOCKS at a time, which keeps the AES-NI or bitsliced pipelines full, and
+ *  large messages can be split over threads.
+ *
+ *  The offset of block i is the sum of L(j) over the bits j set in the Gray code of i, so a
+ *  segment starting anywhere in the message gets its first offset directly.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+class AES128_PMAC : public AES128
+{
+	public:
+		AES128_PMAC(unsigned char *key);
+		AES128_PMAC(const AES128Key *key);
+
+	public:
+		virtual void rekey(unsigned char *key);
+		void rekey(const AES128Key *key);
+
+		/**
+		 *  Compute the AES128_BLOCK_BYTES tag of mlen bytes of message.
+		 */
+		void mac(const unsigned char *message, unsigned int mlen, unsigned char *tag);
+		/**
+		 *  Recompute the tag and compare it to tag without an early exit.
+		 */
+		bool verify(const unsigned char *message, unsigned int mlen, const unsigned char *tag);
+		/**
+		 *  Set the number of threads used for messages of more than PMAC_PARALLEL_MIN_BYTES.
+		 *  The default is one thread. Without ACRYPTO_THREADS the call has no effect and the
+		 *  MAC always runs on the caller.
+		 */
+		void setThreads(int threads);
+
+	protected:
+		void offset(unsigned int i, unsigned char *delta);
+		void sumBlocks(const unsigned char *message, unsigned int first, unsigned int blocks, unsigned char *sigma);
+		void sumMessage(const unsigned char *message, unsigned int blocks, unsigned char *sigma);
+		static void dbl(const unsigned char *in, unsigned char *out);
+
+	private:
+		static void *sumThread(void *job);
+		void generateOffsets();
+
+	private:
+		unsigned char m_L[PMAC_L_BLOCKS][AES128_BLOCK_BYTES];  /// L(i) = E_K(0).x^i
+		unsigned char m_Linv[AES128_BLOCK_BYTES];              /// E_K(0).x^-1
+		int m_threads;
+};
+
+#endif /* __ACRYPTO_PMAC_H */
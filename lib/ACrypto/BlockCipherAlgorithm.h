@@ -33,7 +33,11 @@
 #define __ACRYPTO_BLOCK_CIPHER_ALGORITHM_H
 
 #include <stdlib.h>
+#include <string.h>
 #include "CryptoDefs.h"
+#include "CryptoArena.h"
+
+#define BLOCK_CIPHER_MAX_BLOCK_BYTES 16 // The largest block length of the ciphers in the library
 
 /**
  *  Abstract base class for a block cipher algorithm. All block cipher implementations should
@@ -41,12 +45,42 @@
  *
  *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
  */
-class BlockCipherAlgorithm
+class BlockCipherAlgorithm : public CryptoObject
 {
 	public:
+		virtual ~BlockCipherAlgorithm() {}
+
 		virtual void encrypt(unsigned char *message)=0;
 		virtual void decrypt(unsigned char *message)=0;
 
+		/**
+		 *  Encrypt or decrypt nblocks consecutive blocks from in to out. The buffers may be the
+		 *  same but must not otherwise overlap. The modes of operation pass as many blocks as
+		 *  they can in one call, so implementations should override these to interleave
+		 *  blocks through the cipher. The default implementation loops over the single block
+		 *  functions.
+		 */
+		virtual void encryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks)
+		{
+			int bl = blocklength();
+			for ( unsigned int i=0; i<nblocks; i++ )
+			{
+				if ( out!=in )
+					memcpy(out+i*bl,in+i*bl,bl);
+				encrypt(out+i*bl);
+			}
+		}
+		virtual void decryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks)
+		{
+			int bl = blocklength();
+			for ( unsigned int i=0; i<nblocks; i++ )
+			{
+				if ( out!=in )
+					memcpy(out+i*bl,in+i*bl,bl);
+				decrypt(out+i*bl);
+			}
+		}
+
 		virtual void rekey(unsigned char *key)=0;
 
 		virtual int keylength()=0;
@@ -0,0 +1,400 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "BulkEngine.h"
+#include "ECBMode.h"
+#include "CBCMode.h"
+#include "CTRMode.h"
+#include "XTSMode.h"
+#include "AES128CBC_CMAC_EtM.h"
+
+#if defined(ACRYPTO_THREADS)
+#include <unistd.h>
+#endif
+
+/**
+ *  A buffer cut into shards of shard bytes, the last one possibly shorter.
+ */
+struct BulkShards
+{
+	void *mode;
+	unsigned char *message;
+	unsigned int length;
+	unsigned int shard;
+	unsigned char *IV;
+	uint64_t offset;
+};
+
+/**
+ *  A batch of messages taken in groups of CBC_BATCH_LANES.
+ */
+struct BulkBatch
+{
+	void *mode;
+	CBCJob *jobs;
+	unsigned int count;
+	bool *results;
+};
+
+/**
+ *  A run of consecutive sectors cut into shards of shard sectors, the last one possibly shorter.
+ */
+struct BulkSectors
+{
+	XTSMode *mode;
+	unsigned char *data;
+	unsigned int sectorLength;
+	unsigned int count;
+	unsigned int shard;
+	uint64_t firstSector;
+};
+
+static unsigned int shardLength(BulkShards *s, unsigned int index)
+{
+	unsigned int start = index*s->shard;
+	return (s->length-start < s->shard) ? s->length-start : s->shard;
+}
+
+static void ecbEncryptShard(void *context, unsigned int index)
+{
+	// Shards are whole blocks and must not be padded, so they go to the cipher directly
+	BulkShards *s = (BulkShards *)context;
+	BlockCipherAlgorithm *cipher = ((ECBMode *)s->mode)->algorithm();
+	unsigned char *shard = s->message+index*s->shard;
+	cipher->encryptBlocks(shard,shard,shardLength(s,index)/cipher->blocklength());
+}
+
+static void ecbDecryptShard(void *context, unsigned int index)
+{
+	BulkShards *s = (BulkShards *)context;
+	((ECBMode *)s->mode)->decrypt(s->message+index*s->shard,shardLength(s,index));
+}
+
+static void ctrShard(void *context, unsigned int index)
+{
+	BulkShards *s = (BulkShards *)context;
+	((CTRMode *)s->mode)->encrypt(s->message+index*s->shard,shardLength(s,index),s->IV,
+		s->offset+(uint64_t)index*s->shard);
+}
+
+static unsigned int sectorShardCount(BulkSectors *s, unsigned int index)
+{
+	unsigned int start = index*s->shard;
+	return (s->count-start < s->shard) ? s->count-start : s->shard;
+}
+
+static void xtsEncryptShard(void *context, unsigned int index)
+{
+	BulkSectors *s = (BulkSectors *)context;
+	s->mode->encryptSectors(s->data+(size_t)(index*s->shard)*s->sectorLength,s->sectorLength,
+		sectorShardCount(s,index),s->firstSector+index*s->shard);
+}
+
+static void xtsDecryptShard(void *context, unsigned int index)
+{
+	BulkSectors *s = (BulkSectors *)context;
+	s->mode->decryptSectors(s->data+(size_t)(index*s->shard)*s->sectorLength,s->sectorLength,
+		sectorShardCount(s,index),s->firstSector+index*s->shard);
+}
+
+static unsigned int groupLength(BulkBatch *b, unsigned int index)
+{
+	unsigned int start = index*CBC_BATCH_LANES;
+	return (b->count-start < CBC_BATCH_LANES) ? b->count-start : CBC_BATCH_LANES;
+}
+
+static void cbcEncryptGroup(void *context, unsigned int index)
+{
+	BulkBatch *b = (BulkBatch *)context;
+	((CBCMode *)b->mode)->encryptBatch(b->jobs+index*CBC_BATCH_LANES,groupLength(b,index));
+}
+
+static void cbcDecryptGroup(void *context, unsigned int index)
+{
+	BulkBatch *b = (BulkBatch *)context;
+	CBCJob *jobs = b->jobs+index*CBC_BATCH_LANES;
+	for ( unsigned int i=0; i<groupLength(b,index); i++ )
+		((CBCMode *)b->mode)->decrypt(jobs[i].message,jobs[i].length,jobs[i].IV);
+}
+
+static void etmEncryptGroup(void *context, unsigned int index)
+{
+	BulkBatch *b = (BulkBatch *)context;
+	CBCJob *jobs = b->jobs+index*CBC_BATCH_LANES;
+	for ( unsigned int i=0; i<groupLength(b,index); i++ )
+		((AES128CBC_CMAC_EtM *)b->mode)->encryptAndTag(jobs[i].message,jobs[i].length,jobs[i].IV);
+}
+
+static void etmDecryptGroup(void *context, unsigned int index)
+{
+	BulkBatch *b = (BulkBatch *)context;
+	CBCJob *jobs = b->jobs+index*CBC_BATCH_LANES;
+	bool *results = b->results+index*CBC_BATCH_LANES;
+	for ( unsigned int i=0; i<groupLength(b,index); i++ )
+		results[i] = ((AES128CBC_CMAC_EtM *)b->mode)->decryptAndVerify(jobs[i].message,jobs[i].length,jobs[i].IV);
+}
+
+BulkEngine::BulkEngine(int threads)
+{
+#if defined(ACRYPTO_THREADS)
+	if ( threads<=0 )
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if ( threads<1 )
+		threads = 1;
+	if ( threads>BULK_MAX_THREADS )
+		threads = BULK_MAX_THREADS;
+
+	pthread_mutex_init(&m_call,NULL);
+	pthread_mutex_init(&m_lock,NULL);
+	pthread_cond_init(&m_wake,NULL);
+	pthread_cond_init(&m_finished,NULL);
+	m_fn = NULL;
+	m_context = NULL;
+	m_count = 0;
+	m_next = 0;
+	m_done = 0;
+	m_stop = false;
+
+	// Worker 0 is the calling thread
+	m_threads = 1;
+	for ( int t=1; t<threads; t++ )
+	{
+		if ( pthread_create(&m_workers[t],NULL,worker,this)!=0 )
+			break;
+		m_threads++;
+	}
+#else
+	(void)threads;
+	m_threads = 1;
+#endif
+}
+
+BulkEngine::~BulkEngine()
+{
+#if defined(ACRYPTO_THREADS)
+	pthread_mutex_lock(&m_lock);
+	m_stop = true;
+	pthread_cond_broadcast(&m_wake);
+	pthread_mutex_unlock(&m_lock);
+	for ( int t=1; t<m_threads; t++ )
+		pthread_join(m_workers[t],NULL);
+
+	pthread_cond_destroy(&m_finished);
+	pthread_cond_destroy(&m_wake);
+	pthread_mutex_destroy(&m_lock);
+	pthread_mutex_destroy(&m_call);
+#endif
+}
+
+#if defined(ACRYPTO_THREADS)
+//static
+void *BulkEngine::worker(void *arg)
+{
+	((BulkEngine *)arg)->work();
+	return NULL;
+}
+
+void BulkEngine::work()
+{
+	pthread_mutex_lock(&m_lock);
+	for ( ;; )
+	{
+		while ( !m_stop && (m_fn==NULL || m_next>=m_count) )
+			pthread_cond_wait(&m_wake,&m_lock);
+		if ( m_stop )
+			break;
+
+		unsigned int index = m_next++;
+		BulkFunction fn = m_fn;
+		void *context = m_context;
+		pthread_mutex_unlock(&m_lock);
+		fn(context,index);
+		pthread_mutex_lock(&m_lock);
+		if ( ++m_done==m_count )
+			pthread_cond_signal(&m_finished);
+	}
+	pthread_mutex_unlock(&m_lock);
+}
+#endif
+
+void BulkEngine::parallelFor(BulkFunction fn, void *context, unsigned int count)
+{
+#if defined(ACRYPTO_THREADS)
+	if ( m_threads>1 && count>1 )
+	{
+		pthread_mutex_lock(&m_call);
+		pthread_mutex_lock(&m_lock);
+		m_fn = fn;
+		m_context = context;
+		m_count = count;
+		m_next = 0;
+		m_done = 0;
+		pthread_cond_broadcast(&m_wake);
+
+		// Take indices alongside the workers, then wait for the ones still running
+		while ( m_next<m_count )
+		{
+			unsigned int index = m_next++;
+			pthread_mutex_unlock(&m_lock);
+			fn(context,index);
+			pthread_mutex_lock(&m_lock);
+			m_done++;
+		}
+		while ( m_done<m_count )
+			pthread_cond_wait(&m_finished,&m_lock);
+		m_fn = NULL;
+		pthread_mutex_unlock(&m_lock);
+		pthread_mutex_unlock(&m_call);
+		return;
+	}
+#endif
+	for ( unsigned int i=0; i<count; i++ )
+		fn(context,i);
+}
+
+/**
+ *  The shard size for a buffer: enough shards for BULK_SHARDS_PER_THREAD per thread, but none
+ *  under BULK_MIN_SHARD_BYTES. Shards are whole cache lines and whole cipher blocks, that is
+ *  multiples of lcm(64,blocklength).
+ */
+unsigned int BulkEngine::shardBytes(unsigned int length, unsigned int blocklength)
+{
+	unsigned int shards = m_threads*BULK_SHARDS_PER_THREAD;
+	unsigned int shard = length/shards + (length%shards!=0 ? 1 : 0);
+	unsigned int unit = 64;
+	while ( unit%blocklength!=0 )
+		unit += 64;
+	if ( shard<BULK_MIN_SHARD_BYTES )
+		shard = BULK_MIN_SHARD_BYTES;
+	return (shard+unit-1) / unit * unit;
+}
+
+/**
+ *  shardBytes() in whole sectors, for runs whose length in bytes may not fit an unsigned int.
+ */
+unsigned int BulkEngine::shardSectors(unsigned int sectorLength, unsigned int count)
+{
+	unsigned int shards = m_threads*BULK_SHARDS_PER_THREAD;
+	unsigned int shard = count/shards + (count%shards!=0 ? 1 : 0);
+	if ( (uint64_t)shard*sectorLength < BULK_MIN_SHARD_BYTES )
+		shard = (BULK_MIN_SHARD_BYTES+sectorLength-1) / sectorLength;
+	return shard;
+}
+
+void BulkEngine::ecbEncrypt(ECBMode *ecb, unsigned char *message, unsigned int length)
+{
+	int blocklength = ecb->algorithm()->blocklength();
+	unsigned int whole = length - length%blocklength;
+	BulkShards s;
+	s.mode = ecb;
+	s.message = message;
+	s.length = whole;
+	s.shard = shardBytes(whole,blocklength);
+	parallelFor(ecbEncryptShard,&s,(whole+s.shard-1)/s.shard);
+
+	// The last partial block, or the extra block of padding, is padded in place after the shards
+	ecb->encrypt(message+whole,length-whole);
+}
+
+void BulkEngine::ecbDecrypt(ECBMode *ecb, unsigned char *message, unsigned int length)
+{
+	int blocklength = ecb->algorithm()->blocklength();
+	BulkShards s;
+	s.mode = ecb;
+	s.message = message;
+	s.length = length - length%blocklength;
+	s.shard = shardBytes(s.length,blocklength);
+	parallelFor(ecbDecryptShard,&s,(s.length+s.shard-1)/s.shard);
+}
+
+void BulkEngine::ctrCrypt(CTRMode *ctr, unsigned char *message, unsigned int length, unsigned char *IV, uint64_t offset)
+{
+	BulkShards s;
+	s.mode = ctr;
+	s.message = message;
+	s.length = length;
+	s.shard = shardBytes(length,ctr->algorithm()->blocklength());
+	s.IV = IV;
+	s.offset = offset;
+	parallelFor(ctrShard,&s,(length+s.shard-1)/s.shard);
+}
+
+bool BulkEngine::xtsEncrypt(XTSMode *xts, unsigned char *data, unsigned int sectorLength, unsigned int count, uint64_t firstSector)
+{
+	if ( sectorLength<AES128_BLOCK_BYTES )
+		return false;
+	// The run must be addressable
+	if ( (uint64_t)count*sectorLength > (size_t)-1 )
+		return false;
+	if ( count==0 )
+		return true;
+	BulkSectors s = {xts,data,sectorLength,count,shardSectors(sectorLength,count),firstSector};
+	parallelFor(xtsEncryptShard,&s,count/s.shard + (count%s.shard!=0 ? 1 : 0));
+	return true;
+}
+
+bool BulkEngine::xtsDecrypt(XTSMode *xts, unsigned char *data, unsigned int sectorLength, unsigned int count, uint64_t firstSector)
+{
+	if ( sectorLength<AES128_BLOCK_BYTES )
+		return false;
+	// The run must be addressable
+	if ( (uint64_t)count*sectorLength > (size_t)-1 )
+		return false;
+	if ( count==0 )
+		return true;
+	BulkSectors s = {xts,data,sectorLength,count,shardSectors(sectorLength,count),firstSector};
+	parallelFor(xtsDecryptShard,&s,count/s.shard + (count%s.shard!=0 ? 1 : 0));
+	return true;
+}
+
+void BulkEngine::cbcEncryptBatch(CBCMode *cbc, CBCJob *jobs, unsigned int count)
+{
+	BulkBatch b = {cbc,jobs,count,NULL};
+	parallelFor(cbcEncryptGroup,&b,(count+CBC_BATCH_LANES-1)/CBC_BATCH_LANES);
+}
+
+void BulkEngine::cbcDecryptBatch(CBCMode *cbc, CBCJob *jobs, unsigned int count)
+{
+	BulkBatch b = {cbc,jobs,count,NULL};
+	parallelFor(cbcDecryptGroup,&b,(count+CBC_BATCH_LANES-1)/CBC_BATCH_LANES);
+}
+
+void BulkEngine::etmEncryptBatch(AES128CBC_CMAC_EtM *etm, CBCJob *jobs, unsigned int count)
+{
+	BulkBatch b = {etm,jobs,count,NULL};
+	parallelFor(etmEncryptGroup,&b,(count+CBC_BATCH_LANES-1)/CBC_BATCH_LANES);
+}
+
+void BulkEngine::etmDecryptBatch(AES128CBC_CMAC_EtM *etm, CBCJob *jobs, unsigned int count, bool *results)
+{
+	BulkBatch b = {etm,jobs,count,results};
+	parallelFor(etmDecryptGroup,&b,(count+CBC_BATCH_LANES-1)/CBC_BATCH_LANES);
+}
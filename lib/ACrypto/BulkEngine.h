@@ -0,0 +1,149 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_BULKENGINE_H
+#define __ACRYPTO_BULKENGINE_H
+
+#include <stdint.h>
+#include "CryptoDefs.h"
+
+#if defined(ACRYPTO_THREADS)
+#include <pthread.h>
+#endif
+
+// Large buffers are cut into shards of at least this size (a multiple of 64 bytes)
+#define BULK_MIN_SHARD_BYTES 65536
+// Shards per worker, so that an unevenly loaded core does not hold up the whole buffer
+#define BULK_SHARDS_PER_THREAD 4
+// Upper limit on the pool size
+#define BULK_MAX_THREADS 64
+
+class ECBMode;
+class CBCMode;
+class CTRMode;
+class XTSMode;
+class AES128CBC_CMAC_EtM;
+struct CBCJob;
+
+/**
+ *  The work function run by BulkEngine::parallelFor for each index.
+ */
+typedef void (*BulkFunction)(void *context, unsigned int index);
+
+/**
+ *  @brief Multi-core bulk encryption.
+ *
+ *  A pool of worker threads which shards large ECB, CTR and XTS buffers, and batches of independent
+ *  CBC and EtM messages, over all cores. The mode instances are passed in and shared by every
+ *  worker; their key schedules are only read, so one instance serves any number of threads.
+ *  A BulkEngine may itself be called from several threads, which then take turns.
+ *
+ *  Without ACRYPTO_THREADS the same calls run on the calling thread.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+class BulkEngine
+{
+	public:
+		/**
+		 *  Constructor. Starts threads-1 workers; the calling thread does its share of every
+		 *  job. Zero means one thread per online CPU. Hyperthreads count as CPUs, so on SMT
+		 *  machines set the number of physical cores for the best throughput per thread.
+		 *  Without ACRYPTO_THREADS threads is ignored and everything runs on the caller.
+		 */
+		BulkEngine(int threads=0);
+		virtual ~BulkEngine();
+
+	public:
+		int threads() { return m_threads; }
+
+		/**
+		 *  ECB over a large buffer. Same contract as ECBMode::encrypt and decrypt.
+		 */
+		void ecbEncrypt(ECBMode *ecb, unsigned char *message, unsigned int length);
+		void ecbDecrypt(ECBMode *ecb, unsigned char *message, unsigned int length);
+		/**
+		 *  CTR over a large buffer. Same contract as CTRMode::encrypt; each shard seeks to its
+		 *  own offset in the keystream.
+		 */
+		void ctrCrypt(CTRMode *ctr, unsigned char *message, unsigned int length, unsigned char *IV, uint64_t offset=0);
+		/**
+		 *  XTS over count consecutive sectors. Same contract as XTSMode::encryptSectors; the
+		 *  shards are runs of whole sectors.
+		 */
+		bool xtsEncrypt(XTSMode *xts, unsigned char *data, unsigned int sectorLength, unsigned int count, uint64_t firstSector);
+		bool xtsDecrypt(XTSMode *xts, unsigned char *data, unsigned int sectorLength, unsigned int count, uint64_t firstSector);
+		/**
+		 *  Batches of independent messages. Each worker takes groups of CBC_BATCH_LANES jobs
+		 *  for CBCMode::encryptBatch; the other calls go one message at a time.
+		 */
+		void cbcEncryptBatch(CBCMode *cbc, CBCJob *jobs, unsigned int count);
+		void cbcDecryptBatch(CBCMode *cbc, CBCJob *jobs, unsigned int count);
+		/**
+		 *  EtM batches. The message buffers must have room for the tag as for
+		 *  AES128CBC_CMAC_EtM::encryptAndTag. results[i] is set to the outcome of verifying
+		 *  message i.
+		 */
+		void etmEncryptBatch(AES128CBC_CMAC_EtM *etm, CBCJob *jobs, unsigned int count);
+		void etmDecryptBatch(AES128CBC_CMAC_EtM *etm, CBCJob *jobs, unsigned int count, bool *results);
+
+		/**
+		 *  Run fn(context,i) for i in [0,count) on the pool and return when all are done.
+		 */
+		void parallelFor(BulkFunction fn, void *context, unsigned int count);
+
+	private:
+		unsigned int shardBytes(unsigned int length, unsigned int blocklength);
+		unsigned int shardSectors(unsigned int sectorLength, unsigned int count);
+
+#if defined(ACRYPTO_THREADS)
+		static void *worker(void *arg);
+		void work();
+#endif
+
+	private:
+		int m_threads;
+#if defined(ACRYPTO_THREADS)
+		pthread_t m_workers[BULK_MAX_THREADS];
+		pthread_mutex_t m_call;       /// Serializes parallelFor callers
+		pthread_mutex_t m_lock;       /// Guards the job state below
+		pthread_cond_t m_wake;
+		pthread_cond_t m_finished;
+		BulkFunction m_fn;
+		void *m_context;
+		unsigned int m_count;
+		unsigned int m_next;
+		unsigned int m_done;
+		bool m_stop;
+#endif
+};
+
+#endif /* __ACRYPTO_BULKENGINE_H */
@@ -31,21 +31,45 @@
 
 #include "CBCMode.h"
 
-CBCMode::CBCMode(AlgorithmType algorithmType, unsigned char *key)
+#if defined(ACRYPTO_THREADS)
+#include <pthread.h>
+
+#define CBC_MAX_THREADS 64
+
+struct CBCDecryptJob
+{
+	CBCMode *mode;
+	const unsigned char *in;
+	unsigned char *out;
+	unsigned int blocks;
+	unsigned char IV[BLOCK_CIPHER_MAX_BLOCK_BYTES];
+	bool nonTemporal;
+};
+#endif
+
+CBCMode::CBCMode(AlgorithmType algorithmType, unsigned char *key, CryptoArena *arena)
 {
 	m_algorithmType=algorithmType;
+	m_threads=1;
 
 	switch(m_algorithmType)
 	{
 		case atAES128:
-			m_algorithm = new AES128(key);
+			m_algorithm = new (arena) AES128(key);
 			break;
 		case atXTEA:
-			m_algorithm = new XTEA(key);
+			m_algorithm = new (arena) XTEA(key);
 			break;
 	}
 }
 
+CBCMode::CBCMode(const AES128Key *key, CryptoArena *arena)
+{
+	m_algorithmType=atAES128;
+	m_threads=1;
+	m_algorithm = new (arena) AES128(key);
+}
+
 CBCMode::~CBCMode()
 {
 	delete m_algorithm;
@@ -53,43 +77,151 @@ CBCMode::~CBCMode()
 
 void CBCMode::encrypt(unsigned char *message, unsigned int length, unsigned char *IV)
 {
-	int blocklength = m_algorithm->blocklength();
-	int padlen = padMessage(message,length,blocklength,ptZero);
-	int blocks = padlen / blocklength;
+	encrypt(message,length,message,paddedLength(length,m_algorithm->blocklength(),m_padding),IV);
+}
 
-	//unsigned char *pCipherBytes = (unsigned char *)message;
+int CBCMode::encrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned int capacity, unsigned char *IV)
+{
+	bool nonTemporal = useNonTemporal(out,paddedLength(length,m_algorithm->blocklength(),m_padding));
+	switch(m_algorithmType)
+	{
+		case atXTEA:
+			return CBCModeT<XTEA>::encryptWith(*(XTEA *)m_algorithm,in,length,out,capacity,IV,m_padding,nonTemporal);
+		default:
+			return CBCModeT<AES128>::encryptWith(*(AES128 *)m_algorithm,in,length,out,capacity,IV,m_padding,nonTemporal);
+	}
+}
+
+void CBCMode::encryptBatch(CBCJob *jobs, unsigned int count)
+{
+	int blocklength = m_algorithm->blocklength();
+	unsigned char lanes[CBC_BATCH_LANES*BLOCK_CIPHER_MAX_BLOCK_BYTES];
+	unsigned char *next[CBC_BATCH_LANES];   // The next plaintext block in each chain
+	unsigned char *prev[CBC_BATCH_LANES];   // The previous ciphertext block, or the IV
+	unsigned int remaining[CBC_BATCH_LANES];
+	unsigned int active=0;
+	unsigned int job=0;
 
-	// CBC encrypt:  C_i = E_k(P_i XOR C_{i-1})
-	for (int i = 0; i < blocks; i++)
+	for ( ;; )
 	{
-		for (int bb=0; bb<blocklength; bb++)
+		// Refill the lanes from the job list, keeping the active chains packed at the front
+		while ( active<CBC_BATCH_LANES && job<count )
 		{
-			if ( i==0 )
-				message[bb] ^= IV[bb]; // First block needs the IV
-			else
-				message[bb+(i*blocklength)] ^= message[bb+(i*blocklength)-blocklength];
+			int padlen = padMessage(jobs[job].message,jobs[job].length,blocklength,m_padding);
+			if ( padlen>0 )
+			{
+				next[active] = jobs[job].message;
+				prev[active] = jobs[job].IV;
+				remaining[active] = padlen / blocklength;
+				active++;
+			}
+			job++;
 		}
+		if ( active==0 )
+			break;
+
+		// C_i = E_k(P_i XOR C_{i-1}) for one block of every active chain
+		for ( unsigned int l=0; l<active; l++ )
+			for ( int bb=0; bb<blocklength; bb++ )
+				lanes[l*blocklength+bb] = next[l][bb] ^ prev[l][bb];
+		m_algorithm->encryptBlocks(lanes,lanes,active);
 
-		m_algorithm->encrypt(message+(i*blocklength));
+		unsigned int l=0;
+		while ( l<active )
+		{
+			memcpy(next[l],lanes+l*blocklength,blocklength);
+			prev[l] = next[l];
+			next[l] += blocklength;
+			if ( --remaining[l]==0 )
+			{
+				// Chain done; move the last active lane (and its output) into its place
+				active--;
+				next[l] = next[active];
+				prev[l] = prev[active];
+				remaining[l] = remaining[active];
+				memcpy(lanes+l*blocklength,lanes+active*blocklength,blocklength);
+			}
+			else
+				l++;
+		}
 	}
 }
 
+#if defined(ACRYPTO_THREADS)
+//static
+void *CBCMode::decryptThread(void *arg)
+{
+	CBCDecryptJob *job = (CBCDecryptJob *)arg;
+	job->mode->decryptSegment(job->in,job->out,job->blocks,job->IV,job->nonTemporal);
+	// Streaming stores are only ordered by a fence on the thread that issued them
+	fenceOut(job->nonTemporal);
+	return NULL;
+}
+#endif
+
 void CBCMode::decrypt(unsigned char *message, unsigned int length, unsigned char *IV)
 {
-    int blocklength = m_algorithm->blocklength();
-    int blocks = length / blocklength;
+	decrypt(message,length,message,IV);
+}
+
+void CBCMode::decrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV)
+{
+	int blocklength = m_algorithm->blocklength();
+	unsigned int blocks = length / blocklength;
+	bool nonTemporal = useNonTemporal(out,length);
+
+#if defined(ACRYPTO_THREADS)
+	unsigned int segments = length / CBC_PARALLEL_MIN_BYTES;
+	if ( segments > (unsigned int)m_threads )
+		segments = m_threads;
+	if ( segments > 1 )
+	{
+		// Each segment starts from the ciphertext block preceding it, which has to be saved
+		// before the segment in front of it is decrypted in place.
+		CBCDecryptJob jobs[CBC_MAX_THREADS];
+		pthread_t threads[CBC_MAX_THREADS];
+		unsigned int perSegment = blocks / segments;
+		for ( unsigned int s=0; s<segments; s++ )
+		{
+			jobs[s].mode = this;
+			jobs[s].in = in + s*perSegment*blocklength;
+			jobs[s].out = out + s*perSegment*blocklength;
+			jobs[s].blocks = (s==segments-1) ? blocks - s*perSegment : perSegment;
+			jobs[s].nonTemporal = nonTemporal;
+			if ( s==0 )
+				memcpy(jobs[s].IV,IV,blocklength);
+			else
+				memcpy(jobs[s].IV,jobs[s].in-blocklength,blocklength);
+		}
+		unsigned int started = 1;
+		for ( ; started<segments; started++ )
+			if ( pthread_create(&threads[started],NULL,decryptThread,&jobs[started])!=0 )
+				break;
+		decryptThread(&jobs[0]);
+		for ( unsigned int s=1; s<started; s++ )
+			pthread_join(threads[s],NULL);
+		// Any segment a thread could not be started for is done here
+		for ( unsigned int s=started; s<segments; s++ )
+			decryptThread(&jobs[s]);
+		fenceOut(nonTemporal);
+		return;
+	}
+#endif
 
-	unsigned char ccur[blocklength];
-	unsigned char cprev[blocklength];
+	decryptSegment(in,out,blocks,IV,nonTemporal);
+	fenceOut(nonTemporal);
+}
 
-    memcpy(cprev,IV,blocklength);
-	for ( int i=0; i<blocks; i++ )
+void CBCMode::decryptSegment(const unsigned char *in, unsigned char *out, unsigned int blocks, const unsigned char *IV, bool nonTemporal)
+{
+	switch(m_algorithmType)
 	{
-	    memcpy(ccur,message+(i*blocklength),blocklength);
-		m_algorithm->decrypt(message+(i*blocklength));
-		for(int bb=0; bb<blocklength; bb++)
-			message[bb+(i*blocklength)] ^= cprev[bb];
-		memcpy(cprev,ccur,blocklength);
+		case atXTEA:
+			CBCModeT<XTEA>::decryptWith(*(XTEA *)m_algorithm,in,out,blocks,IV,nonTemporal);
+			break;
+		default:
+			CBCModeT<AES128>::decryptWith(*(AES128 *)m_algorithm,in,out,blocks,IV,nonTemporal);
+			break;
 	}
 }
 
@@ -98,4 +230,23 @@ void CBCMode::rekey(unsigned char *key)
 	m_algorithm->rekey(key);
 }
 
+bool CBCMode::rekey(const AES128Key *key)
+{
+	if ( m_algorithmType!=atAES128 )
+		return false;
+	((AES128 *)m_algorithm)->rekey(key);
+	return true;
+}
+
+void CBCMode::setThreads(int threads)
+{
+#if defined(ACRYPTO_THREADS)
+	if ( threads > CBC_MAX_THREADS )
+		threads = CBC_MAX_THREADS;
+	m_threads = threads < 1 ? 1 : threads;
+#else
+	(void)threads;
+#endif
+}
+
 
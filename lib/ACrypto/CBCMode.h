@@ -36,6 +36,28 @@
 #include "BlockCipherAlgorithm.h"
 #include "AES128.h"
 #include "XTEA.h"
+#include "CBCModeT.h"
+
+// With ACRYPTO_THREADS, buffers are split over threads in segments of at least this size.
+#define CBC_PARALLEL_MIN_BYTES 65536
+
+// The number of independent chains CBCMode::encryptBatch runs through the cipher at once.
+#if defined(__AVR__)
+#define CBC_BATCH_LANES 2
+#else
+#define CBC_BATCH_LANES 8
+#endif
+
+/**
+ *  A message for CBCMode::encryptBatch. The fields have the same meaning as the arguments to
+ *  CBCMode::encrypt.
+ */
+struct CBCJob
+{
+	unsigned char *message;
+	unsigned int length;
+	unsigned char *IV;
+};
 
 /**
  *  CBC-mode encryption and decryption. Works with any block cipher implementation which
@@ -50,30 +72,73 @@ class CBCMode : public CryptoModeBase
 	public:
 		/**
          *  Constructor. Instantiate a block cipher algorithm with the given key. See
-         *  CryptoDefs.h for details.
+         *  CryptoDefs.h for details. The cipher is placed in arena if one is given.
+         */
+		CBCMode(AlgorithmType algorithmType, unsigned char *key, CryptoArena *arena=NULL);
+		/**
+         *  Constructor. AES128 on an expanded key, which is shared with the caller rather than
+         *  copied, so no key expansion is done.
          */
-		CBCMode(AlgorithmType algorithmType, unsigned char *key);
+		CBCMode(const AES128Key *key, CryptoArena *arena=NULL);
 		virtual ~CBCMode();
 
 	public:
 		/**
          *  Encrypt a message stored in the buffer message. The message buffer MUST be of a
-         *  size which is a multiple of the cipher block length. However, the length parameter
-         *  should be the exact number of bytes in the plaintext itself, not the buffer size.
-         *  The message is padded as necessary and encrypted. The ciphertext is returned
-         *  in the message buffer.
+         *  size which is a multiple of the cipher block length (paddedLength() bytes). However,
+         *  the length parameter should be the exact number of bytes in the plaintext itself,
+         *  not the buffer size. The message is padded in place as selected by setPadding() and
+         *  encrypted. The ciphertext is returned in the message buffer.
          */
 		virtual void encrypt(unsigned char *message, unsigned int length, unsigned char *IV);
 		/**
+         *  Encrypt a batch of independent messages. Each message is padded and encrypted
+         *  exactly as by encrypt(), but up to CBC_BATCH_LANES chains are advanced together so
+         *  that the cipher gets several blocks per call. Useful when there are many short
+         *  messages, since a single CBC chain is strictly serial.
+         */
+		virtual void encryptBatch(CBCJob *jobs, unsigned int count);
+		/**
          *  Decrypt a message. The buffer is assumed to be of a size which is an multiple of the
          *  cipher block length. The decrypted (plaintext) message is returned with padding
          *  intact in the message buffer.
          */
 		virtual void decrypt(unsigned char *message, unsigned int length, unsigned char *IV);
 		/**
+         *  Out-of-place encryption. Reads length bytes from in once and writes the padded
+         *  ciphertext to out once; in is left untouched. Returns the ciphertext length, or -1
+         *  (writing nothing) if it exceeds capacity.
+         */
+		virtual int encrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned int capacity, unsigned char *IV);
+		/**
+         *  Out-of-place decryption of length bytes (a multiple of the block length) from in to
+         *  out, which may not overlap unless they are the same buffer.
+         */
+		virtual void decrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV);
+		/**
          *  Refresh the key for the block cipher algorithm.
          */
 		virtual void rekey(unsigned char *key);
+		/**
+         *  Switch to an expanded AES128 key without expanding it again. Only for an instance
+         *  constructed for AES128; returns false, leaving the key unchanged, otherwise.
+         */
+		virtual bool rekey(const AES128Key *key);
+		/**
+         *  Set the number of threads used to decrypt large messages. CBC decryption has no
+         *  dependency between blocks, so a message of more than CBC_PARALLEL_MIN_BYTES is split
+         *  into segments which are decrypted concurrently. The default is one thread. Without
+         *  ACRYPTO_THREADS the call has no effect and decryption always runs on the caller.
+         */
+		void setThreads(int threads);
+
+	protected:
+		void decryptSegment(const unsigned char *in, unsigned char *out, unsigned int blocks, const unsigned char *IV, bool nonTemporal);
+
+	private:
+		static void *decryptThread(void *job);
+
+		int m_threads;
 };
 
 #endif /* __ACRYPTO_CBCMODE_H */
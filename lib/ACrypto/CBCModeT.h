@@ -0,0 +1,181 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_CBCMODET_H
+#define __ACRYPTO_CBCMODET_H
+
+#include "CryptoModeBase.h"
+
+/*
+ *  CBC decryption handles this many blocks per call to the cipher, so that they can be
+ *  interleaved through the cipher pipeline. The chunk is buffered on the stack.
+ */
+#if defined(__AVR__)
+#define CBC_DECRYPT_CHUNK_BLOCKS 1
+#else
+#define CBC_DECRYPT_CHUNK_BLOCKS 8
+#endif
+
+class AES128Key;
+
+/**
+ *  CBC-mode encryption and decryption, specialized at compile time for the cipher class
+ *  Cipher (AES128, XTEA). The block length is a constant and the cipher is called without
+ *  virtual dispatch, so the XOR chain is unrolled and the cipher calls can be inlined into
+ *  the mode loop. The cipher is held by value; there is no allocation.
+ *
+ *  The static encryptWith/decryptWith kernels run on any Cipher instance. CBCMode, which
+ *  chooses the cipher at run time, switches to them once per call (or per thread segment).
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+template <class Cipher>
+class CBCModeT : public CryptoModeBase
+{
+	public:
+		enum { BLOCK_BYTES = Cipher::BLOCK_BYTES };
+
+		CBCModeT(unsigned char *key) : m_cipher(key) { attach(); }
+		/**
+		 *  AES128 only: run on a shared expanded key.
+		 */
+		CBCModeT(const AES128Key *key) : m_cipher(key) { attach(); }
+
+	public:
+		/**
+		 *  In place, as CBCMode::encrypt. The buffer must hold paddedLength() bytes.
+		 */
+		void encrypt(unsigned char *message, unsigned int length, unsigned char *IV)
+		{
+			encryptWith(m_cipher,message,length,message,paddedLength(length,BLOCK_BYTES,m_padding),IV,m_padding,false);
+		}
+		void decrypt(unsigned char *message, unsigned int length, unsigned char *IV)
+		{
+			decryptWith(m_cipher,message,message,length/BLOCK_BYTES,IV,false);
+		}
+		/**
+		 *  Out of place, as CBCMode::encrypt. Returns the ciphertext length or -1.
+		 */
+		int encrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned int capacity,
+			unsigned char *IV)
+		{
+			return encryptWith(m_cipher,in,length,out,capacity,IV,m_padding,
+				useNonTemporal(out,paddedLength(length,BLOCK_BYTES,m_padding)));
+		}
+		void decrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV)
+		{
+			decryptWith(m_cipher,in,out,length/BLOCK_BYTES,IV,useNonTemporal(out,length));
+		}
+		void rekey(unsigned char *key) { m_cipher.rekey(key); }
+		void rekey(const AES128Key *key) { m_cipher.rekey(key); }
+		Cipher &cipher() { return m_cipher; }
+
+	public:
+		static int encryptWith(Cipher &cipher, const unsigned char *in, unsigned int length, unsigned char *out,
+			unsigned int capacity, const unsigned char *IV, PaddingType padding, bool nonTemporal)
+		{
+			unsigned int padlen = paddedLength(length,BLOCK_BYTES,padding);
+			if ( padlen > capacity )
+				return -1;
+
+			unsigned int whole = length - length%BLOCK_BYTES;
+			unsigned char block[BLOCK_BYTES];
+			unsigned char last[BLOCK_BYTES];
+
+			// CBC encrypt:  C_i = E_k(P_i XOR C_{i-1}), with C_{i-1} kept in block rather than read back
+			memcpy(block,IV,BLOCK_BYTES);
+			for ( unsigned int i=0; i<padlen; i+=BLOCK_BYTES )
+			{
+				const unsigned char *plain = in+i;
+				if ( i>=whole )
+				{
+					pad(in+whole,length-whole,last,BLOCK_BYTES,BLOCK_BYTES,padding);
+					plain = last;
+				}
+				for ( int bb=0; bb<BLOCK_BYTES; bb++ )
+					block[bb] ^= plain[bb];
+				cipher.Cipher::encryptBlocks(block,block,1);
+				storeOut(out+i,block,BLOCK_BYTES,nonTemporal);
+			}
+			fenceOut(nonTemporal);
+			return padlen;
+		}
+
+		/**
+		 *  Decrypt a run of blocks from in to out, which may be the same buffer. Up to
+		 *  CBC_DECRYPT_CHUNK_BLOCKS blocks are decrypted with one call to the cipher into a
+		 *  stack buffer; the XOR chain is then applied from the ciphertext, which is still
+		 *  intact in the input, and the plaintext stored to out.
+		 */
+		static void decryptWith(Cipher &cipher, const unsigned char *in, unsigned char *out, unsigned int blocks,
+			const unsigned char *IV, bool nonTemporal)
+		{
+			unsigned char plain[CBC_DECRYPT_CHUNK_BLOCKS*BLOCK_BYTES];
+			unsigned char cprev[BLOCK_BYTES];
+
+			memcpy(cprev,IV,BLOCK_BYTES);
+			for ( unsigned int i=0; i<blocks; )
+			{
+				unsigned int n = blocks-i;
+				if ( n > CBC_DECRYPT_CHUNK_BLOCKS )
+					n = CBC_DECRYPT_CHUNK_BLOCKS;
+				const unsigned char *cipherText = in+(i*BLOCK_BYTES);
+
+				// P_i = D_k(C_i) XOR C_{i-1}
+				cipher.Cipher::decryptBlocks(cipherText,plain,n);
+				for ( int bb=0; bb<BLOCK_BYTES; bb++ )
+					plain[bb] ^= cprev[bb];
+				for ( unsigned int bb=BLOCK_BYTES; bb<n*BLOCK_BYTES; bb++ )
+					plain[bb] ^= cipherText[bb-BLOCK_BYTES];
+
+				memcpy(cprev,cipherText+(n-1)*BLOCK_BYTES,BLOCK_BYTES);
+				storeOut(out+(i*BLOCK_BYTES),plain,n*BLOCK_BYTES,nonTemporal);
+				i += n;
+			}
+			fenceOut(nonTemporal);
+		}
+
+	private:
+		void attach()
+		{
+			m_algorithmType = Cipher::ALGORITHM;
+			m_algorithm = &m_cipher;
+		}
+
+		// m_algorithm points into the object
+		CBCModeT(const CBCModeT &);
+		CBCModeT &operator=(const CBCModeT &);
+
+	private:
+		Cipher m_cipher;
+};
+
+#endif /* __ACRYPTO_CBCMODET_H */
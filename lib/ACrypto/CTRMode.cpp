@@ -0,0 +1,144 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "CTRMode.h"
+
+CTRMode::CTRMode(AlgorithmType algorithmType, unsigned char *key, CryptoArena *arena)
+{
+	m_algorithmType=algorithmType;
+
+	switch(m_algorithmType)
+	{
+		case atAES128:
+			m_algorithm = new (arena) AES128(key);
+			break;
+		case atXTEA:
+			m_algorithm = new (arena) XTEA(key);
+			break;
+	}
+}
+
+CTRMode::CTRMode(const AES128Key *key, CryptoArena *arena)
+{
+	m_algorithmType=atAES128;
+	m_algorithm = new (arena) AES128(key);
+}
+
+CTRMode::~CTRMode()
+{
+	delete m_algorithm;
+}
+
+void CTRMode::encrypt(unsigned char *message, unsigned int length, unsigned char *IV, uint64_t offset)
+{
+	encrypt(message,length,message,IV,offset);
+}
+
+void CTRMode::decrypt(unsigned char *message, unsigned int length, unsigned char *IV, uint64_t offset)
+{
+	encrypt(message,length,message,IV,offset);
+}
+
+void CTRMode::encrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV, uint64_t offset)
+{
+	int blocklength = m_algorithm->blocklength();
+	unsigned char counter[BLOCK_CIPHER_MAX_BLOCK_BYTES];
+	unsigned char keystream[CTR_PARALLEL_BLOCKS*BLOCK_CIPHER_MAX_BLOCK_BYTES];
+	bool nonTemporal = useNonTemporal(out,length);
+
+	// Seek: the block containing the offset, and the position within it
+	memcpy(counter,IV,blocklength);
+	addCounter(counter,blocklength,offset/blocklength);
+	unsigned int skip = (unsigned int)(offset % blocklength);
+
+	while ( length>0 )
+	{
+		unsigned int blocks = (skip+length+blocklength-1) / blocklength;
+		if ( blocks > CTR_PARALLEL_BLOCKS )
+			blocks = CTR_PARALLEL_BLOCKS;
+
+		for ( unsigned int i=0; i<blocks; i++ )
+		{
+			memcpy(keystream+i*blocklength,counter,blocklength);
+			addCounter(counter,blocklength,1);
+		}
+		m_algorithm->encryptBlocks(keystream,keystream,blocks);
+
+		unsigned int n = blocks*blocklength - skip;
+		if ( n > length )
+			n = length;
+		// XOR in the keystream buffer, so each output byte is written once
+		for ( unsigned int i=0; i<n; i++ )
+			keystream[skip+i] ^= in[i];
+		storeOut(out,keystream+skip,n,nonTemporal);
+
+		in += n;
+		out += n;
+		length -= n;
+		skip = 0;
+	}
+	fenceOut(nonTemporal);
+}
+
+void CTRMode::decrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV, uint64_t offset)
+{
+	encrypt(in,length,out,IV,offset);
+}
+
+void CTRMode::rekey(unsigned char *key)
+{
+	m_algorithm->rekey(key);
+}
+
+bool CTRMode::rekey(const AES128Key *key)
+{
+	if ( m_algorithmType!=atAES128 )
+		return false;
+	((AES128 *)m_algorithm)->rekey(key);
+	return true;
+}
+
+/**
+ *  Add n to the counter block, taken as a big-endian integer of blocklength bytes. The sum
+ *  wraps modulo 2^(8*blocklength).
+ */
+//static
+void CTRMode::addCounter(unsigned char *counter, int blocklength, uint64_t n)
+{
+	unsigned int carry = 0;
+	for ( int i=blocklength-1; i>=0 && (n!=0 || carry!=0); i-- )
+	{
+		unsigned int sum = counter[i] + (unsigned int)(n & 0xff) + carry;
+		counter[i] = (unsigned char)sum;
+		carry = sum >> 8;
+		n >>= 8;
+	}
+}
@@ -0,0 +1,111 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_CTRMODE_H
+#define __ACRYPTO_CTRMODE_H
+
+#include <stdint.h>
+#include "CryptoModeBase.h"
+#include "BlockCipherAlgorithm.h"
+#include "AES128.h"
+#include "XTEA.h"
+
+// The number of counter blocks encrypted per call to the cipher.
+#if defined(__AVR__)
+#define CTR_PARALLEL_BLOCKS 1
+#else
+#define CTR_PARALLEL_BLOCKS 8
+#endif
+
+/**
+ *  CTR-mode encryption and decryption (NIST SP 800-38A, section 6.5). Works with any block
+ *  cipher implementation which derives from BlockCipherBase.
+ *
+ *  The keystream block i is E_k(IV + i), where the initial counter block IV is incremented as a
+ *  single big-endian integer over the whole cipher block. Counter blocks are independent, so
+ *  CTR_PARALLEL_BLOCKS of them are encrypted per call to the cipher, and any byte offset into
+ *  the keystream can be reached directly. No padding is needed; a trailing partial block just
+ *  uses part of the last keystream block.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+class CTRMode : public CryptoModeBase
+{
+	public:
+		/**
+         *  Constructor. Instantiate a block cipher algorithm with the given key. See
+         *  CryptoDefs.h for details. The cipher is placed in arena if one is given.
+         */
+		CTRMode(AlgorithmType algorithmType, unsigned char *key, CryptoArena *arena=NULL);
+		/**
+         *  Constructor. AES128 on an expanded key, which is shared with the caller rather than
+         *  copied, so no key expansion is done.
+         */
+		CTRMode(const AES128Key *key, CryptoArena *arena=NULL);
+		virtual ~CTRMode();
+
+	public:
+		/**
+         *  Encrypt length bytes in the message buffer in place. The bytes are taken to start at
+         *  byte offset of the message encrypted under the initial counter block IV, so a record
+         *  can be encrypted or decrypted piecewise and in any order. The IV must be one cipher
+         *  block long and must never be reused with the same key.
+         */
+		virtual void encrypt(unsigned char *message, unsigned int length, unsigned char *IV, uint64_t offset=0);
+		/**
+         *  Decrypt a message or a part of one. Identical to encryption in CTR mode.
+         */
+		virtual void decrypt(unsigned char *message, unsigned int length, unsigned char *IV, uint64_t offset=0);
+		/**
+         *  Out-of-place encryption of length bytes from in to out, which may not overlap unless
+         *  they are the same buffer. Each input byte is read once and each output byte written
+         *  once; in is left untouched.
+         */
+		virtual void encrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV, uint64_t offset=0);
+		/**
+         *  Out-of-place decryption. Identical to out-of-place encryption in CTR mode.
+         */
+		virtual void decrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned char *IV, uint64_t offset=0);
+		/**
+         *  Refresh the key for the block cipher algorithm.
+         */
+		virtual void rekey(unsigned char *key);
+		/**
+         *  Switch to an expanded AES128 key without expanding it again. Only for an instance
+         *  constructed for AES128; returns false, leaving the key unchanged, otherwise.
+         */
+		virtual bool rekey(const AES128Key *key);
+
+	protected:
+		static void addCounter(unsigned char *counter, int blocklength, uint64_t n);
+};
+
+#endif /* __ACRYPTO_CTRMODE_H */
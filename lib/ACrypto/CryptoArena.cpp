@@ -0,0 +1,136 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "CryptoArena.h"
+
+#if defined(ACRYPTO_DEFINE_NEW)
+void* operator new(size_t size) { return malloc(size); }
+void operator delete(void* ptr) { if (ptr) free(ptr); }
+void* operator new[](size_t size) { return malloc(size); }
+void operator delete[](void* ptr) { if (ptr) free(ptr); }
+#endif
+
+// The first CRYPTO_ALIGN boundary at or above p
+#define alignUp(p) ((unsigned char *)(((uintptr_t)(p) + CRYPTO_ALIGN-1) & ~(uintptr_t)(CRYPTO_ALIGN-1)))
+
+CryptoArena::CryptoArena(void *buffer, size_t bytes)
+{
+	m_buffer = (unsigned char *)buffer;
+	m_capacity = bytes;
+	m_used = 0;
+	m_fallbacks = 0;
+	m_owned = false;
+}
+
+CryptoArena::CryptoArena(size_t bytes)
+{
+	// Over-allocate so the first block can be aligned
+	m_buffer = (unsigned char *)malloc(bytes + CRYPTO_ALIGN-1);
+	m_capacity = m_buffer!=NULL ? bytes + CRYPTO_ALIGN-1 : 0;
+	m_used = 0;
+	m_fallbacks = 0;
+	m_owned = true;
+}
+
+CryptoArena::~CryptoArena()
+{
+	if ( m_owned )
+		free(m_buffer);
+}
+
+void *CryptoArena::allocate(size_t bytes)
+{
+	return allocate(bytes,0);
+}
+
+void *CryptoArena::allocate(size_t bytes, size_t header)
+{
+	unsigned char *p = alignUp(m_buffer + m_used + header);
+	if ( p + bytes > m_buffer + m_capacity )
+		return NULL;
+	m_used = (p + bytes) - m_buffer;
+	return p;
+}
+
+/* ----------------------------------------------------------------------------------------------
+ * CryptoObject
+ * ---------------------------------------------------------------------------------------------- */
+
+//
+// Each object is preceded by a pointer to the malloc block it is in, or NULL if it is in an
+// arena.
+//
+#define origin(p) (((void **)(p))[-1])
+
+//static
+void *CryptoObject::operator new(size_t bytes) CRYPTO_NOTHROW
+{
+	return operator new(bytes,(CryptoArena *)NULL);
+}
+
+//static
+void *CryptoObject::operator new(size_t bytes, CryptoArena *arena) CRYPTO_NOTHROW
+{
+	unsigned char *p;
+	if ( arena!=NULL )
+	{
+		p = (unsigned char *)arena->allocate(bytes,sizeof(void *));
+		if ( p!=NULL )
+		{
+			origin(p) = NULL;
+			return p;
+		}
+		arena->m_fallbacks++;
+	}
+
+	unsigned char *block = (unsigned char *)malloc(bytes + sizeof(void *) + CRYPTO_ALIGN-1);
+	if ( block==NULL )
+		return NULL;
+	p = alignUp(block + sizeof(void *));
+	origin(p) = block;
+	return p;
+}
+
+//static
+void CryptoObject::operator delete(void *p)
+{
+	if ( p!=NULL && origin(p)!=NULL )
+		free(origin(p));
+}
+
+//static
+void CryptoObject::operator delete(void *p, CryptoArena *)
+{
+	// Only called if a constructor throws
+	operator delete(p);
+}
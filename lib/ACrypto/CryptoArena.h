@@ -0,0 +1,126 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_CRYPTO_ARENA_H
+#define __ACRYPTO_CRYPTO_ARENA_H
+
+#include <stddef.h>
+#include "CryptoDefs.h"
+
+/**
+ *  @brief A bump allocator for cipher and mode contexts.
+ *
+ *  Hands out CRYPTO_ALIGN aligned memory from one buffer, which is either supplied by the
+ *  caller (a static array, say) or allocated once by the arena. Nothing is freed one piece at a
+ *  time; reset() reclaims the whole buffer. The contexts are placed in it with
+ *  new (arena) and deleted as usual, which runs their destructors but gives no memory back:
+ *
+ *      CryptoArena arena(buffer,sizeof(buffer));
+ *      CBCMode *cbc = new (&arena) CBCMode(atAES128,key,&arena);
+ *      ...
+ *      delete cbc;
+ *      arena.reset();
+ *
+ *  The modes take the arena as a constructor argument and place their cipher in it as well.
+ *  When the arena is full the allocation falls back to the heap, and is counted by
+ *  fallbacks(), so that an undersized arena can be caught. An arena is not thread safe;
+ *  contexts allocated from it are as safe as any other.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+class CryptoArena
+{
+	public:
+		CryptoArena(void *buffer, size_t bytes);
+		/**
+		 *  Allocate a buffer of bytes from the heap, once.
+		 */
+		CryptoArena(size_t bytes);
+		virtual ~CryptoArena();
+
+	public:
+		/**
+		 *  bytes of CRYPTO_ALIGN aligned memory, or NULL if the arena is full.
+		 */
+		void *allocate(size_t bytes);
+		/**
+		 *  Reclaim everything allocated. The objects in the arena must have been deleted (or be
+		 *  abandoned) first.
+		 */
+		void reset() { m_used = 0; m_fallbacks = 0; }
+
+		size_t used() { return m_used; }
+		size_t capacity() { return m_capacity; }
+		/**
+		 *  The number of objects placed with new (arena) which did not fit and went to the
+		 *  heap instead, since construction or the last reset().
+		 */
+		unsigned int fallbacks() { return m_fallbacks; }
+
+	private:
+		friend class CryptoObject;
+		// Room for a header of header bytes in front of the aligned block
+		void *allocate(size_t bytes, size_t header);
+
+		CryptoArena(const CryptoArena &);
+		CryptoArena &operator=(const CryptoArena &);
+
+	private:
+		unsigned char *m_buffer;
+		size_t m_capacity;
+		size_t m_used;
+		unsigned int m_fallbacks;
+		bool m_owned;
+};
+
+/**
+ *  @brief Base class of the cipher and mode contexts, for their allocation.
+ *
+ *  Allocates the derived objects CRYPTO_ALIGN aligned, on the heap or in a CryptoArena, without
+ *  touching the global operator new. A pointer in front of each object records where it came
+ *  from, so delete frees heap objects and leaves arena objects to the arena.
+ *
+ *  Nothing throws: when the heap is exhausted new yields NULL, which the caller must check. The
+ *  modes report a cipher they could not allocate through valid().
+ */
+class CryptoObject
+{
+	public:
+		static void *operator new(size_t bytes) CRYPTO_NOTHROW;
+		/**
+		 *  Placement in arena; a NULL arena means the heap.
+		 */
+		static void *operator new(size_t bytes, CryptoArena *arena) CRYPTO_NOTHROW;
+		static void operator delete(void *p);
+		static void operator delete(void *p, CryptoArena *arena);
+};
+
+#endif /* __ACRYPTO_CRYPTO_ARENA_H */
@@ -33,6 +33,70 @@
 #define __ACRYPTO_CRYPTODEFS_H
 
 enum AlgorithmType {atAES128,atXTEA};
-enum PaddingType {ptZero,ptOneZeros};
+/*
+ *  Block padding. ptZero pads with zero bytes and adds nothing to a whole block (it cannot be
+ *  removed unambiguously). ptOneZeros is ISO/IEC 7816-4 (0x80 then zeros) and ptPKCS7 pads with
+ *  n bytes of value n (RFC 5652); both always add at least one byte, so a whole block of padding
+ *  follows a message which is a multiple of the block length.
+ */
+enum PaddingType {ptZero,ptOneZeros,ptPKCS7,ptISO7816=ptOneZeros};
+
+/*
+ *  Hardware acceleration. The x86 backends (AES-NI etc.) are compiled in when building with
+ *  GCC or clang for an x86 target and selected at runtime by CPUID. Define ACRYPTO_PORTABLE
+ *  to build the portable code paths only.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(ACRYPTO_PORTABLE)
+#define ACRYPTO_X86
+#endif
+
+/*
+ *  Multi-threading. Define ACRYPTO_THREADS to enable the paths that split large buffers over
+ *  several POSIX threads (link with -pthread). Never available on AVR.
+ */
+#if defined(ACRYPTO_THREADS) && defined(__AVR__)
+#undef ACRYPTO_THREADS
+#endif
+
+/*
+ *  Alignment of the key schedules and of the cipher and mode objects holding them, so that a
+ *  schedule never straddles a cache line. AVR has no cache and no RAM to spare.
+ */
+#if defined(__GNUC__) && !defined(__AVR__)
+#define CRYPTO_ALIGN 64
+#define ACRYPTO_CACHE_ALIGNED __attribute__((aligned(CRYPTO_ALIGN)))
+#else
+#define CRYPTO_ALIGN 1
+#define ACRYPTO_CACHE_ALIGNED
+#endif
+
+/*
+ *  Define ACRYPTO_DEFINE_NEW to have the library supply the global operator new and delete
+ *  (on malloc and free), for old Arduino cores which lack them. Off by default, so the host
+ *  application's allocator is left alone.
+ */
+
+/*
+ *  Exception specification of the library's allocation functions, which return NULL when out
+ *  of memory. A new-expression then yields NULL without running the constructor.
+ */
+#if __cplusplus >= 201103L
+#define CRYPTO_NOTHROW noexcept
+#else
+#define CRYPTO_NOTHROW throw()
+#endif
+
+/*
+ *  Compare two MAC tags of length bytes in time which does not depend on where they differ.
+ *  Shared by the MAC and AEAD classes for their verify paths.
+ */
+inline bool cryptoTagsEqual(const unsigned char *a, const unsigned char *b, unsigned int length)
+{
+	// Compare without an early exit
+	unsigned char diff = 0;
+	for ( unsigned int i=0; i<length; i++ )
+		diff |= a[i] ^ b[i];
+	return diff==0;
+}
 
 #endif /* __ACRYPTO_CRYPTODEFS_H */
@@ -31,46 +31,149 @@
 
 #include "CryptoModeBase.h"
 
-void* operator new(size_t size) { return malloc(size); }
-void operator delete(void* ptr) { if (ptr) free(ptr); }
+#if defined(ACRYPTO_X86)
+#include <stdint.h>
+#include <emmintrin.h>
+#endif
 
-int CryptoModeBase::padMessage(unsigned char *message, unsigned int length, unsigned int blocklen, PaddingType type)
+//static
+unsigned int CryptoModeBase::paddedLength(unsigned int length, unsigned int blocklen, PaddingType type)
+{
+	if ( type==ptZero && length%blocklen==0 )
+		return length;
+	return length - length%blocklen + blocklen;
+}
+
+/**
+ *  Fill a block holding used message bytes with padding.
+ */
+//static
+void CryptoModeBase::padBlock(unsigned char *block, unsigned int used, unsigned int blocklen, PaddingType type)
 {
 	switch(type)
 	{
-		case ptZero:
-			return zeroPadding(message,length,blocklen);
 		case ptOneZeros:
-			return oneZerosPadding(message,length,blocklen);
+			block[used] = 0x80;
+			memset(block+used+1,0x00,blocklen-used-1);
+			break;
+		case ptPKCS7:
+			memset(block+used,(int)(blocklen-used),blocklen-used);
+			break;
+		case ptZero:
 		default:
-			return zeroPadding(message,length,blocklen);
+			memset(block+used,0x00,blocklen-used);
+			break;
 	}
 }
 
-int CryptoModeBase::zeroPadding(unsigned char *message, unsigned int length, unsigned int blocklen)
+//static
+int CryptoModeBase::pad(const unsigned char *in, unsigned int length, unsigned char *out, unsigned int capacity,
+	unsigned int blocklen, PaddingType type)
 {
-	if ( length % blocklen == 0 )
+	unsigned int padlen = paddedLength(length,blocklen,type);
+	if ( padlen>capacity )
+		return -1;
+
+	unsigned int whole = length - length%blocklen;
+	if ( out!=in )
+		memmove(out,in,whole);
+	if ( padlen>whole )
+	{
+		unsigned char block[BLOCK_CIPHER_MAX_BLOCK_BYTES];
+		memcpy(block,in+whole,length-whole);
+		padBlock(block,length-whole,blocklen,type);
+		memcpy(out+whole,block,blocklen);
+	}
+	return padlen;
+}
+
+//static
+int CryptoModeBase::unpaddedLength(const unsigned char *message, unsigned int length, unsigned int blocklen,
+	PaddingType type)
+{
+	if ( type==ptZero )
 		return length;
+	if ( length==0 || length%blocklen!=0 )
+		return -1;
 
-	int dPadlen = blocklen - (length % blocklen);
-	message = (unsigned char *)realloc(message,length+dPadlen);
-	memset(message+length,0x00,dPadlen);
+	if ( type==ptPKCS7 )
+	{
+		// Check every padding byte without an early exit, to give no padding oracle timing
+		unsigned int n = message[length-1];
+		unsigned char bad = (unsigned char)(n==0 || n>blocklen);
+		for ( unsigned int i=1; i<=blocklen; i++ )
+			bad |= (unsigned char)((i<=n) & (message[length-i]!=n));
+		return bad ? -1 : (int)(length-n);
+	}
 
-	return length+dPadlen;
+	// ISO/IEC 7816-4: the last 0x80 in the final block, after which there are only zeros
+	for ( unsigned int i=length; i>length-blocklen; i-- )
+	{
+		if ( message[i-1]==0x80 )
+			return i-1;
+		if ( message[i-1]!=0x00 )
+			return -1;
+	}
+	return -1;
+}
+
+int CryptoModeBase::padMessage(unsigned char *message, unsigned int length, unsigned int blocklen, PaddingType type)
+{
+	return pad(message,length,message,paddedLength(length,blocklen,type),blocklen,type);
+}
+
+bool CryptoModeBase::useNonTemporal(const unsigned char *out, unsigned int length)
+{
+#if defined(ACRYPTO_X86)
+	return m_bNonTemporal && length>=CRYPTO_NONTEMPORAL_MIN_BYTES && ((uintptr_t)out & 15)==0;
+#else
+	(void)out;
+	(void)length;
+	return false;
+#endif
 }
 
-int CryptoModeBase::oneZerosPadding(unsigned char *message, unsigned int length, unsigned int blocklen)
+#if defined(ACRYPTO_X86)
+__attribute__((target("sse2")))
+static void streamOut(unsigned char *out, const unsigned char *src, unsigned int bytes)
 {
-	int dPadlen;
-	if ( length % blocklen == 0 )
-		dPadlen=blocklen;
-	else
-		dPadlen = blocklen - (length % blocklen);
+	for ( unsigned int i=0; i<bytes; i+=16 )
+		_mm_stream_si128((__m128i *)(out+i),_mm_loadu_si128((const __m128i *)(src+i)));
+}
 
-	message = (unsigned char *)realloc(message,length+dPadlen);
-	memset(message+length,0x00,dPadlen);
-	message[length]=0x80;
+__attribute__((target("sse2")))
+static void streamFence()
+{
+	_mm_sfence();
+}
+#endif
 
-	return length+dPadlen;
+//static
+void CryptoModeBase::storeOut(unsigned char *out, const unsigned char *src, unsigned int bytes, bool nonTemporal)
+{
+#if defined(ACRYPTO_X86)
+	if ( nonTemporal && ((uintptr_t)out & 15)==0 )
+	{
+		// Whole 16-byte units bypass the cache; a trailing 8-byte block is stored normally
+		unsigned int streamed = bytes & ~15U;
+		streamOut(out,src,streamed);
+		out += streamed;
+		src += streamed;
+		bytes -= streamed;
+	}
+#else
+	(void)nonTemporal;
+#endif
+	memcpy(out,src,bytes);
 }
 
+//static
+void CryptoModeBase::fenceOut(bool nonTemporal)
+{
+#if defined(ACRYPTO_X86)
+	if ( nonTemporal )
+		streamFence();
+#else
+	(void)nonTemporal;
+#endif
+}
@@ -37,22 +37,95 @@
 #include "BlockCipherAlgorithm.h"
 #include "CryptoDefs.h"
 
+/*
+ *  Non-temporal output (see CryptoModeBase::setNonTemporal) only pays off once the output no
+ *  longer fits in the caches, so shorter calls keep the regular stores.
+ */
+#define CRYPTO_NONTEMPORAL_MIN_BYTES (256*1024)
+// Bytes staged on the stack between the cipher and the non-temporal stores
+#define CRYPTO_NONTEMPORAL_CHUNK 512
+
 /**
  *  Base class for crypto mode implementations. See for example CBCMode.
  *
  *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
  */
-class CryptoModeBase
+class CryptoModeBase : public CryptoObject
 {
+	public:
+		CryptoModeBase() : m_padding(ptZero), m_bNonTemporal(false), m_algorithm(NULL) {}
+
+		/**
+		 *  The block cipher instance used by the mode, for compositions which drive the cipher
+		 *  directly.
+		 */
+		BlockCipherAlgorithm *algorithm() { return m_algorithm; }
+		/**
+		 *  False if the cipher could not be allocated (or the algorithm type is unknown), in
+		 *  which case the mode must not be used.
+		 */
+		virtual bool valid() { return m_algorithm!=NULL; }
+
+		/**
+		 *  Select the padding applied by encrypt(). The default is ptZero. With the other types
+		 *  the message buffer must have room for paddedLength() bytes, which is a whole block
+		 *  more than the message when it is already a multiple of the block length.
+		 */
+		void setPadding(PaddingType type) { m_padding = type; }
+		PaddingType padding() { return m_padding; }
+
+		/**
+		 *  Write the output of the out-of-place calls with non-temporal (cache bypassing)
+		 *  stores, so that encrypting a large buffer does not evict the working set. Applies
+		 *  when the output is 16-byte aligned and at least CRYPTO_NONTEMPORAL_MIN_BYTES long,
+		 *  and only on x86. Off by default.
+		 */
+		void setNonTemporal(bool enable=true) { m_bNonTemporal = enable; }
+
+	public:
+		/**
+		 *  The length of a message of length bytes after padding.
+		 */
+		static unsigned int paddedLength(unsigned int length, unsigned int blocklen, PaddingType type=ptZero);
+		/**
+		 *  Pad a message without allocating. The whole blocks of in are copied to out (nothing
+		 *  is copied when in and out are the same buffer) and the last partial block is padded
+		 *  in a stack buffer and written after them. Returns the padded length, or -1 if it
+		 *  exceeds capacity.
+		 */
+		static int pad(const unsigned char *in, unsigned int length, unsigned char *out, unsigned int capacity,
+			unsigned int blocklen, PaddingType type=ptZero);
+		/**
+		 *  The length of a padded message with the padding removed, or -1 if the padding is
+		 *  malformed. Zero padding cannot be told from message bytes, so length is returned.
+		 */
+		static int unpaddedLength(const unsigned char *message, unsigned int length, unsigned int blocklen,
+			PaddingType type=ptZero);
+
 	protected:
+		/**
+		 *  Pad a message in place. The buffer is assumed to hold paddedLength() bytes.
+		 */
 		int padMessage(unsigned char *message, unsigned int length, unsigned int blocklen, PaddingType type=ptZero);
 
+		bool useNonTemporal(const unsigned char *out, unsigned int length);
+		/**
+		 *  Copy bytes to out, with non-temporal stores for the whole 16-byte units if
+		 *  nonTemporal is set and out is aligned.
+		 */
+		static void storeOut(unsigned char *out, const unsigned char *src, unsigned int bytes, bool nonTemporal);
+		/**
+		 *  Order the non-temporal stores before anything the caller writes next.
+		 */
+		static void fenceOut(bool nonTemporal);
+
 	private:
-		int zeroPadding(unsigned char *message, unsigned int length, unsigned int blocklen);
-		int oneZerosPadding(unsigned char *message, unsigned int length, unsigned int blocklen);
+		static void padBlock(unsigned char *block, unsigned int used, unsigned int blocklen, PaddingType type);
 
 	protected:
 		bool m_bDebug;
+		PaddingType m_padding;
+		bool m_bNonTemporal;
 		AlgorithmType m_algorithmType;
 		BlockCipherAlgorithm *m_algorithm;
 };
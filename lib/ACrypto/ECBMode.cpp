@@ -31,21 +31,27 @@
 
 #include "ECBMode.h"
 
-ECBMode::ECBMode(AlgorithmType algorithmType, unsigned char *key)
+ECBMode::ECBMode(AlgorithmType algorithmType, unsigned char *key, CryptoArena *arena)
 {
 	m_algorithmType=algorithmType;
 
 	switch(m_algorithmType)
 	{
 		case atAES128:
-			m_algorithm = new AES128(key);
+			m_algorithm = new (arena) AES128(key);
 			break;
 		case atXTEA:
-			m_algorithm = new XTEA(key);
+			m_algorithm = new (arena) XTEA(key);
 			break;
 	}
 }
 
+ECBMode::ECBMode(const AES128Key *key, CryptoArena *arena)
+{
+	m_algorithmType=atAES128;
+	m_algorithm = new (arena) AES128(key);
+}
+
 ECBMode::~ECBMode()
 {
 	delete m_algorithm;
@@ -53,22 +59,49 @@ ECBMode::~ECBMode()
 
 void ECBMode::encrypt(unsigned char *message, unsigned int length)
 {
-	int padlen = padMessage(message,length,m_algorithm->blocklength(),ptZero);
-	int blocks = padlen / m_algorithm->blocklength();
-	for ( int i=0; i<blocks; ++i )
-		m_algorithm->encrypt(message+(i*m_algorithm->blocklength()));
+	encrypt(message,length,message,paddedLength(length,m_algorithm->blocklength(),m_padding));
 }
 
 void ECBMode::decrypt(unsigned char *message, unsigned int length)
 {
-	// The length should be a multiple of block length
-	if ( length % m_algorithm->blocklength() != 0 )
-		return;
+	decrypt(message,length,message);
+}
 
-	int blocks = length / m_algorithm->blocklength();
-	for ( int i=0; i<blocks; ++i )
-		m_algorithm->decrypt(message+(i*m_algorithm->blocklength()));
+int ECBMode::encrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned int capacity)
+{
+	bool nonTemporal = useNonTemporal(out,paddedLength(length,m_algorithm->blocklength(),m_padding));
+	switch(m_algorithmType)
+	{
+		case atXTEA:
+			return ECBModeT<XTEA>::encryptWith(*(XTEA *)m_algorithm,in,length,out,capacity,m_padding,nonTemporal);
+		default:
+			return ECBModeT<AES128>::encryptWith(*(AES128 *)m_algorithm,in,length,out,capacity,m_padding,nonTemporal);
+	}
 }
 
+void ECBMode::decrypt(const unsigned char *in, unsigned int length, unsigned char *out)
+{
+	bool nonTemporal = useNonTemporal(out,length);
+	switch(m_algorithmType)
+	{
+		case atXTEA:
+			ECBModeT<XTEA>::decryptWith(*(XTEA *)m_algorithm,in,length,out,nonTemporal);
+			break;
+		default:
+			ECBModeT<AES128>::decryptWith(*(AES128 *)m_algorithm,in,length,out,nonTemporal);
+			break;
+	}
+}
 
+void ECBMode::rekey(unsigned char *key)
+{
+	m_algorithm->rekey(key);
+}
 
+bool ECBMode::rekey(const AES128Key *key)
+{
+	if ( m_algorithmType!=atAES128 )
+		return false;
+	((AES128 *)m_algorithm)->rekey(key);
+	return true;
+}
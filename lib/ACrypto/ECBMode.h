@@ -37,6 +37,7 @@
 #include "BlockCipherAlgorithm.h"
 #include "AES128.h"
 #include "XTEA.h"
+#include "ECBModeT.h"
 
 /**
  *  ECB-mode encryption and decryption. Works with any block cipher implementation which
@@ -52,18 +53,23 @@ class ECBMode : public CryptoModeBase
 	public:
 		/**
          *  Constructor. Instantiate a block cipher algorithm with the given key. See
-         *  CryptoDefs.h for details.
+         *  CryptoDefs.h for details. The cipher is placed in arena if one is given.
          */
-		ECBMode(AlgorithmType algorithmType, unsigned char *key);
+		ECBMode(AlgorithmType algorithmType, unsigned char *key, CryptoArena *arena=NULL);
+		/**
+         *  Constructor. AES128 on an expanded key, which is shared with the caller rather than
+         *  copied, so no key expansion is done.
+         */
+		ECBMode(const AES128Key *key, CryptoArena *arena=NULL);
 		virtual ~ECBMode();
 
 	public:
 		/**
          *  Encrypt a message stored in the buffer message. The message buffer MUST be of a
-         *  size which is a multiple of the cipher block length. However, the length parameter
-         *  should be the exact number of bytes in the plaintext itself, not the buffer size.
-         *  The message is padded as necessary and encrypted. The ciphertext is returned
-         *  in the message buffer.
+         *  size which is a multiple of the cipher block length (paddedLength() bytes). However,
+         *  the length parameter should be the exact number of bytes in the plaintext itself,
+         *  not the buffer size. The message is padded in place as selected by setPadding() and
+         *  encrypted. The ciphertext is returned in the message buffer.
          */
 		virtual void encrypt(unsigned char *message, unsigned int length);
 		/**
@@ -73,9 +79,25 @@ class ECBMode : public CryptoModeBase
          */
 		virtual void decrypt(unsigned char *message, unsigned int length);
 		/**
+         *  Out-of-place encryption. Reads length bytes from in once and writes the padded
+         *  ciphertext to out once; in is left untouched. Returns the ciphertext length, or -1
+         *  (writing nothing) if it exceeds capacity.
+         */
+		virtual int encrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned int capacity);
+		/**
+         *  Out-of-place decryption of length bytes (a multiple of the block length) from in to
+         *  out, which may not overlap unless they are the same buffer.
+         */
+		virtual void decrypt(const unsigned char *in, unsigned int length, unsigned char *out);
+		/**
          *  Refresh the key for the block cipher algorithm.
          */
-//		virtual void rekey(unsigned char *key); // TODO: DEFINE IN CODE
+		virtual void rekey(unsigned char *key);
+		/**
+         *  Switch to an expanded AES128 key without expanding it again. Only for an instance
+         *  constructed for AES128; returns false, leaving the key unchanged, otherwise.
+         */
+		virtual bool rekey(const AES128Key *key);
 };
 
 #endif /* __ACRYPTO_ECBMODE_H */
@@ -0,0 +1,171 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_ECBMODET_H
+#define __ACRYPTO_ECBMODET_H
+
+#include "CryptoModeBase.h"
+
+class AES128Key;
+
+/**
+ *  ECB-mode encryption and decryption, specialized at compile time for the cipher class
+ *  Cipher (AES128, XTEA). The block length is a constant and the cipher is called without
+ *  virtual dispatch, so the compiler can unroll the block loops and inline into the mode.
+ *  The cipher is held by value; there is no allocation.
+ *
+ *  The static encryptWith/decryptWith kernels run on any Cipher instance. ECBMode, which
+ *  chooses the cipher at run time, switches to them once per call.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+template <class Cipher>
+class ECBModeT : public CryptoModeBase
+{
+	public:
+		enum { BLOCK_BYTES = Cipher::BLOCK_BYTES };
+
+		ECBModeT(unsigned char *key) : m_cipher(key) { attach(); }
+		/**
+		 *  AES128 only: run on a shared expanded key.
+		 */
+		ECBModeT(const AES128Key *key) : m_cipher(key) { attach(); }
+
+	public:
+		/**
+		 *  In place, as ECBMode::encrypt. The buffer must hold paddedLength() bytes.
+		 */
+		void encrypt(unsigned char *message, unsigned int length)
+		{
+			encryptWith(m_cipher,message,length,message,paddedLength(length,BLOCK_BYTES,m_padding),m_padding,false);
+		}
+		void decrypt(unsigned char *message, unsigned int length)
+		{
+			decryptWith(m_cipher,message,length,message,false);
+		}
+		/**
+		 *  Out of place, as ECBMode::encrypt. Returns the ciphertext length or -1.
+		 */
+		int encrypt(const unsigned char *in, unsigned int length, unsigned char *out, unsigned int capacity)
+		{
+			return encryptWith(m_cipher,in,length,out,capacity,m_padding,
+				useNonTemporal(out,paddedLength(length,BLOCK_BYTES,m_padding)));
+		}
+		void decrypt(const unsigned char *in, unsigned int length, unsigned char *out)
+		{
+			decryptWith(m_cipher,in,length,out,useNonTemporal(out,length));
+		}
+		void rekey(unsigned char *key) { m_cipher.rekey(key); }
+		void rekey(const AES128Key *key) { m_cipher.rekey(key); }
+		Cipher &cipher() { return m_cipher; }
+
+	public:
+		static int encryptWith(Cipher &cipher, const unsigned char *in, unsigned int length, unsigned char *out,
+			unsigned int capacity, PaddingType padding, bool nonTemporal)
+		{
+			unsigned int padlen = paddedLength(length,BLOCK_BYTES,padding);
+			if ( padlen > capacity )
+				return -1;
+
+			unsigned int whole = length - length%BLOCK_BYTES;
+			blocksOut(cipher,true,in,out,whole/BLOCK_BYTES,nonTemporal);
+			if ( padlen > whole )
+			{
+				unsigned char last[BLOCK_BYTES];
+				pad(in+whole,length-whole,last,BLOCK_BYTES,BLOCK_BYTES,padding);
+				cipher.Cipher::encryptBlocks(last,last,1);
+				storeOut(out+whole,last,BLOCK_BYTES,nonTemporal);
+			}
+			fenceOut(nonTemporal);
+			return padlen;
+		}
+
+		static void decryptWith(Cipher &cipher, const unsigned char *in, unsigned int length, unsigned char *out,
+			bool nonTemporal)
+		{
+			// The length should be a multiple of block length
+			if ( length % BLOCK_BYTES != 0 )
+				return;
+			blocksOut(cipher,false,in,out,length/BLOCK_BYTES,nonTemporal);
+			fenceOut(nonTemporal);
+		}
+
+	private:
+		/**
+		 *  Encrypt or decrypt nblocks from in to out, staged through a stack buffer for the
+		 *  non-temporal stores if nonTemporal is set.
+		 */
+		static void blocksOut(Cipher &cipher, bool encrypt, const unsigned char *in, unsigned char *out,
+			unsigned int nblocks, bool nonTemporal)
+		{
+#if defined(ACRYPTO_X86)
+			if ( nonTemporal )
+			{
+				unsigned char chunk[CRYPTO_NONTEMPORAL_CHUNK];
+				const unsigned int perChunk = CRYPTO_NONTEMPORAL_CHUNK / BLOCK_BYTES;
+				while ( nblocks>0 )
+				{
+					unsigned int n = nblocks<perChunk ? nblocks : perChunk;
+					if ( encrypt )
+						cipher.Cipher::encryptBlocks(in,chunk,n);
+					else
+						cipher.Cipher::decryptBlocks(in,chunk,n);
+					storeOut(out,chunk,n*BLOCK_BYTES,true);
+					in += n*BLOCK_BYTES;
+					out += n*BLOCK_BYTES;
+					nblocks -= n;
+				}
+				return;
+			}
+#else
+			(void)nonTemporal;
+#endif
+			if ( encrypt )
+				cipher.Cipher::encryptBlocks(in,out,nblocks);
+			else
+				cipher.Cipher::decryptBlocks(in,out,nblocks);
+		}
+
+		void attach()
+		{
+			m_algorithmType = Cipher::ALGORITHM;
+			m_algorithm = &m_cipher;
+		}
+
+		// m_algorithm points into the object
+		ECBModeT(const ECBModeT &);
+		ECBModeT &operator=(const ECBModeT &);
+
+	private:
+		Cipher m_cipher;
+};
+
+#endif /* __ACRYPTO_ECBMODET_H */
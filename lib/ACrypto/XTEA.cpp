@@ -34,45 +34,133 @@
 XTEA::XTEA(unsigned char *key, int numRounds)
 {
 	m_numRounds = numRounds;
+	m_bLegacyKeySchedule = false;
+#if defined(XTEA_ROUND_KEYS)
+	m_bRoundKeys = numRounds<=XTEA_MAX_ROUNDS;
+#endif
+	enableSIMD(true);
 	rekey(key);
 }
 
+XTEA::~XTEA()
+{
+}
+
+bool XTEA::enableSIMD(bool enable)
+{
+	m_bSIMD = enable && XTEA_SIMD::available();
+	m_bAVX2 = m_bSIMD && XTEA_SIMD::availableAVX2();
+	return m_bSIMD;
+}
+
 void XTEA::rekey(unsigned char *key)
 {
 	memcpy(m_key,key,XTEA_KEY_BYTES);
+#if defined(XTEA_ROUND_KEYS)
+	if ( m_bRoundKeys )
+		expandKey(m_key,m_numRounds,m_roundKeys,m_bLegacyKeySchedule);
+#endif
+}
+
+void XTEA::setLegacyKeySchedule(bool enable)
+{
+	m_bLegacyKeySchedule = enable;
+	rekey(m_key);
+}
+
+//static
+void XTEA::keyWords(const unsigned char *key, bool legacyKeySchedule, uint32_t *k)
+{
+	for ( int i=0; i<4; i++ )
+	{
+		if ( legacyKeySchedule )
+			k[i] = key[i];
+		else
+			k[i] = (uint32_t)key[4*i] | ((uint32_t)key[4*i+1]<<8) | ((uint32_t)key[4*i+2]<<16) |
+				((uint32_t)key[4*i+3]<<24);
+	}
+}
+
+//static
+void XTEA::expandKey(const unsigned char *key, unsigned short rounds, uint32_t *roundKeys, bool legacyKeySchedule)
+{
+	uint32_t k[4];
+	uint32_t sum=0;
+	uint32_t delta=0x9E3779B9;
+	keyWords(key,legacyKeySchedule,k);
+	for ( unsigned int i=0; i<rounds; i++ )
+	{
+		roundKeys[2*i] = sum + k[sum & 3];
+		sum += delta;
+		roundKeys[2*i+1] = sum + k[(sum>>11) & 3];
+	}
+}
+
+//static
+void XTEA::encrypt(const uint32_t *roundKeys, unsigned char *block, unsigned short rounds)
+{
+	uint32_t y, z;
+	memcpy(&y,block,4);
+	memcpy(&z,block+4,4);
+	for ( unsigned int i=0; i<rounds; i++ )
+	{
+		y += (((z << 4) ^ (z >> 5)) + z) ^ roundKeys[2*i];
+		z += (((y << 4) ^ (y >> 5)) + y) ^ roundKeys[2*i+1];
+	}
+	memcpy(block,&y,4);
+	memcpy(block+4,&z,4);
+}
+
+//static
+void XTEA::decrypt(const uint32_t *roundKeys, unsigned char *block, unsigned short rounds)
+{
+	uint32_t y, z;
+	memcpy(&y,block,4);
+	memcpy(&z,block+4,4);
+	for ( unsigned int i=rounds; i>0; i-- )
+	{
+		z -= (((y << 4) ^ (y >> 5)) + y) ^ roundKeys[2*i-1];
+		y -= (((z << 4) ^ (z >> 5)) + z) ^ roundKeys[2*i-2];
+	}
+	memcpy(block,&y,4);
+	memcpy(block+4,&z,4);
 }
 
-void XTEA::encrypt(unsigned char *key, unsigned char *block, unsigned short rounds)
+void XTEA::encrypt(unsigned char *key, unsigned char *block, unsigned short rounds, bool legacyKeySchedule)
 {
-    unsigned long y; //= (unsigned long)block;
-    unsigned long z; // = (unsigned long)(block+4);
-    unsigned long sum=0;
-    unsigned long delta=0x9E3779B9;
+    uint32_t k[4];
+    uint32_t y; //= (uint32_t)block;
+    uint32_t z; // = (uint32_t)(block+4);
+    uint32_t sum=0;
+    uint32_t delta=0x9E3779B9;
+    keyWords(key,legacyKeySchedule,k);
     memcpy((unsigned char *)&y,block,4);
     memcpy((unsigned char *)&z,block+4,4);
     for (unsigned int i=0; i < rounds; i++)
 	{
-        y += (((z << 4) ^ (z >> 5)) + z) ^ (sum + key[sum & 3]);
+        y += (((z << 4) ^ (z >> 5)) + z) ^ (sum + k[sum & 3]);
         sum += delta;
-        z += (((y << 4) ^ (y >> 5)) + y) ^ (sum + key[(sum>>11) & 3]);
+        z += (((y << 4) ^ (y >> 5)) + y) ^ (sum + k[(sum>>11) & 3]);
     }
     memcpy(block,(unsigned char *)&y,4);
     memcpy(block+4,(unsigned char *)&z,4);
 }
 
-void XTEA::decrypt(unsigned char *key, unsigned char *block, unsigned short rounds)
+void XTEA::decrypt(unsigned char *key, unsigned char *block, unsigned short rounds, bool legacyKeySchedule)
 {
-    unsigned long y; // = (unsigned long)block;
-    unsigned long z; // = (unsigned long)(block+4);
-    unsigned long delta=0x9E3779B9;
-    unsigned long sum = delta * rounds;
+    uint32_t k[4];
+    uint32_t y; // = (uint32_t)block;
+    uint32_t z; // = (uint32_t)(block+4);
+    uint32_t delta=0x9E3779B9;
+    uint32_t sum = delta * rounds;
+    keyWords(key,legacyKeySchedule,k);
     memcpy((unsigned char *)&y,block,4);
     memcpy((unsigned char *)&z,block+4,4);
     for (unsigned int i=0; i < rounds; i++)
 	{
-        z -= (((y << 4) ^ (y >> 5)) + y) ^ (sum + key[(sum>>11) & 3]);
+        z -= (((y << 4) ^ (y >> 5)) + y) ^ (sum + k[(sum>>11) & 3]);
         sum -= delta;
-        y -= (((z << 4) ^ (z >> 5)) + z) ^ (sum + key[sum & 3]);
+        y -= (((z << 4) ^ (z >> 5)) + z) ^ (sum + k[sum & 3]);
     }
     memcpy(block,(unsigned char *)&y,4);
     memcpy(block+4,(unsigned char *)&z,4);
@@ -80,11 +168,50 @@ void XTEA::decrypt(unsigned char *key, unsigned char *block, unsigned short roun
 
 void XTEA::encrypt(unsigned char *block)
 {
-	encrypt(m_key,block,m_numRounds);
+#if defined(XTEA_ROUND_KEYS)
+	if ( m_bRoundKeys )
+	{
+		encrypt(m_roundKeys,block,m_numRounds);
+		return;
+	}
+#endif
+	encrypt(m_key,block,m_numRounds,m_bLegacyKeySchedule);
 }
 
 void XTEA::decrypt(unsigned char *block)
 {
-	decrypt(m_key,block,m_numRounds);
+#if defined(XTEA_ROUND_KEYS)
+	if ( m_bRoundKeys )
+	{
+		decrypt(m_roundKeys,block,m_numRounds);
+		return;
+	}
+#endif
+	decrypt(m_key,block,m_numRounds,m_bLegacyKeySchedule);
+}
+
+void XTEA::encryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks)
+{
+	unsigned int done = 0;
+#if defined(XTEA_ROUND_KEYS)
+	if ( m_bSIMD && m_bRoundKeys )
+		done = XTEA_SIMD::encryptBlocks(m_roundKeys,m_numRounds,in,out,nblocks,m_bAVX2);
+#endif
+	if ( out!=in )
+		memcpy(out+done*XTEA_BLOCK_BYTES,in+done*XTEA_BLOCK_BYTES,(nblocks-done)*XTEA_BLOCK_BYTES);
+	for ( unsigned int i=done; i<nblocks; i++ )
+		XTEA::encrypt(out+i*XTEA_BLOCK_BYTES);
 }
 
+void XTEA::decryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks)
+{
+	unsigned int done = 0;
+#if defined(XTEA_ROUND_KEYS)
+	if ( m_bSIMD && m_bRoundKeys )
+		done = XTEA_SIMD::decryptBlocks(m_roundKeys,m_numRounds,in,out,nblocks,m_bAVX2);
+#endif
+	if ( out!=in )
+		memcpy(out+done*XTEA_BLOCK_BYTES,in+done*XTEA_BLOCK_BYTES,(nblocks-done)*XTEA_BLOCK_BYTES);
+	for ( unsigned int i=done; i<nblocks; i++ )
+		XTEA::decrypt(out+i*XTEA_BLOCK_BYTES);
+}
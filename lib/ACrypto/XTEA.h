@@ -33,12 +33,22 @@
 #define __ACRYPTO_XTEA_H
 
 #include <string.h>
+#include <stdint.h>
 #include "BlockCipherAlgorithm.h"
+#include "XTEA_SIMD.h"
 
 #define XTEA_KEY_BYTES 16
 #define XTEA_BLOCK_BYTES 8
 #define XTEA_DEFAULT_NUM_ROUNDS 32
 
+// The expanded round keys take 8 bytes per round, which is too much RAM to spend on AVR.
+#if !defined(__AVR__)
+#define XTEA_ROUND_KEYS
+#endif
+
+// Size of the inline round-key table. Instances with more rounds schedule the keys on the fly.
+#define XTEA_MAX_ROUNDS 64
+
 /**
  *  XTEA block cipher implementation.
  *
@@ -49,23 +59,71 @@
 class XTEA : public BlockCipherAlgorithm
 {
 	public:
+		// Compile-time parameters for the mode templates (ECBModeT, CBCModeT)
+		enum { BLOCK_BYTES = XTEA_BLOCK_BYTES, KEY_BYTES = XTEA_KEY_BYTES };
+		static const AlgorithmType ALGORITHM = atXTEA;
+
 		XTEA(unsigned char *key, int numRounds=XTEA_DEFAULT_NUM_ROUNDS);
+		virtual ~XTEA();
 
 	public:
 		void rekey(unsigned char *key);
 
-		static void encrypt(unsigned char *key, unsigned char *block, unsigned short rounds=XTEA_DEFAULT_NUM_ROUNDS);
-		static void decrypt(unsigned char *key, unsigned char *block, unsigned short rounds=XTEA_DEFAULT_NUM_ROUNDS);
+		/**
+		 *  The 16 key bytes are read as four little-endian 32-bit words k[0..3], as in the
+		 *  reference XTEA. With legacyKeySchedule the first four key bytes are taken as the
+		 *  words instead, which is what the library did up to now: only 32 bits of the key
+		 *  reach the cipher. Use it only to read data written in that format.
+		 */
+		static void encrypt(unsigned char *key, unsigned char *block, unsigned short rounds=XTEA_DEFAULT_NUM_ROUNDS,
+			bool legacyKeySchedule=false);
+		static void decrypt(unsigned char *key, unsigned char *block, unsigned short rounds=XTEA_DEFAULT_NUM_ROUNDS,
+			bool legacyKeySchedule=false);
+		/**
+		 *  Expand the key into the 2*rounds round keys, sum + k[sum & 3] for the first half
+		 *  of each round and sum + k[(sum>>11) & 3] for the second, so that the rounds need
+		 *  no index arithmetic. The key words are taken as by encrypt() above.
+		 */
+		static void expandKey(const unsigned char *key, unsigned short rounds, uint32_t *roundKeys,
+			bool legacyKeySchedule=false);
+		static void encrypt(const uint32_t *roundKeys, unsigned char *block, unsigned short rounds);
+		static void decrypt(const uint32_t *roundKeys, unsigned char *block, unsigned short rounds);
 
 		virtual void encrypt(unsigned char *block);
 		virtual void decrypt(unsigned char *block);
 
+		virtual void encryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks);
+		virtual void decryptBlocks(const unsigned char *in, unsigned char *out, unsigned int nblocks);
+
 		virtual int keylength() {return  XTEA_KEY_BYTES;}
 		virtual int blocklength() {return XTEA_BLOCK_BYTES;}
 
+		/**
+		 *  Select the SSE2/AVX2 backend for encryptBlocks and decryptBlocks if the CPU supports
+		 *  it (the default), or force the scalar code. Returns true if the vector backend is in
+		 *  use after the call. Runs of four or more blocks go through it; single blocks never do.
+		 */
+		bool enableSIMD(bool enable=true);
+		bool usesSIMD() {return m_bSIMD;}
+
+		/**
+		 *  Switch to the legacy key schedule (see encrypt() above) and back. Off by default.
+		 */
+		void setLegacyKeySchedule(bool enable=true);
+		bool legacyKeySchedule() {return m_bLegacyKeySchedule;}
+
 	private:
 		int m_numRounds;
+		bool m_bLegacyKeySchedule;
+		bool m_bSIMD;
+		bool m_bAVX2;
+#if defined(XTEA_ROUND_KEYS)
+		bool m_bRoundKeys;
+		uint32_t m_roundKeys[2*XTEA_MAX_ROUNDS];
+#endif
 		unsigned char m_key[XTEA_KEY_BYTES];
+
+		static void keyWords(const unsigned char *key, bool legacyKeySchedule, uint32_t *k);
 };
 
 #endif /* __ACRYPTO_XTEA_H */
@@ -0,0 +1,249 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "XTEA_SIMD.h"
+
+#if defined(ACRYPTO_X86)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+//
+// Each block is the two little-endian words y,z. A group is loaded as two registers of
+// interleaved y,z pairs and split into one register of y words and one of z words, so that
+// each lane holds one block. The AVX2 shuffles work within 128-bit lanes, which permutes the
+// blocks across the lanes, but the unpacks on the way out undo exactly that permutation.
+//
+#define SSE2_LOAD(p,y,z) \
+	{ \
+		__m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(p))); \
+		__m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)((p)+16))); \
+		y = _mm_castps_si128(_mm_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0))); \
+		z = _mm_castps_si128(_mm_shuffle_ps(a,b,_MM_SHUFFLE(3,1,3,1))); \
+	}
+#define SSE2_STORE(p,y,z) \
+	{ \
+		_mm_storeu_si128((__m128i *)(p),_mm_unpacklo_epi32(y,z)); \
+		_mm_storeu_si128((__m128i *)((p)+16),_mm_unpackhi_epi32(y,z)); \
+	}
+// ((v << 4) ^ (v >> 5)) + v
+#define SSE2_MIX(v) _mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(v,4),_mm_srli_epi32(v,5)),v)
+
+#define AVX2_LOAD(p,y,z) \
+	{ \
+		__m256 a = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(p))); \
+		__m256 b = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)((p)+32))); \
+		y = _mm256_castps_si256(_mm256_shuffle_ps(a,b,_MM_SHUFFLE(2,0,2,0))); \
+		z = _mm256_castps_si256(_mm256_shuffle_ps(a,b,_MM_SHUFFLE(3,1,3,1))); \
+	}
+#define AVX2_STORE(p,y,z) \
+	{ \
+		_mm256_storeu_si256((__m256i *)(p),_mm256_unpacklo_epi32(y,z)); \
+		_mm256_storeu_si256((__m256i *)((p)+32),_mm256_unpackhi_epi32(y,z)); \
+	}
+#define AVX2_MIX(v) _mm256_add_epi32(_mm256_xor_si256(_mm256_slli_epi32(v,4),_mm256_srli_epi32(v,5)),v)
+
+bool XTEA_SIMD::available()
+{
+	static int s_available = -1;
+	if ( s_available < 0 )
+	{
+		unsigned int eax, ebx, ecx, edx;
+		if ( __get_cpuid(1,&eax,&ebx,&ecx,&edx) )
+			s_available = (edx & bit_SSE2) ? 1 : 0;
+		else
+			s_available = 0;
+	}
+	return s_available==1;
+}
+
+bool XTEA_SIMD::availableAVX2()
+{
+	static int s_available = -1;
+	if ( s_available < 0 )
+	{
+		unsigned int eax, ebx, ecx, edx;
+		s_available = 0;
+		// The OS must save the YMM registers (OSXSAVE, and XCR0 bits 1 and 2)
+		if ( __get_cpuid(1,&eax,&ebx,&ecx,&edx) && (ecx & bit_OSXSAVE) && __get_cpuid_max(0,NULL)>=7 )
+		{
+			unsigned int xcr0, xcr0hi;
+			__asm__ ("xgetbv" : "=a"(xcr0), "=d"(xcr0hi) : "c"(0));
+			__cpuid_count(7,0,eax,ebx,ecx,edx);
+			if ( (xcr0 & 6)==6 && (ebx & bit_AVX2) )
+				s_available = 1;
+		}
+	}
+	return s_available==1;
+}
+
+//
+// The kernels run G groups side by side. Each round key is broadcast to all lanes.
+//
+template <int G>
+SSE2_TARGET
+static void sse2Encrypt(const uint32_t *roundKeys, unsigned short rounds, const unsigned char *in, unsigned char *out)
+{
+	__m128i y[G], z[G];
+	for ( int g=0; g<G; g++ )
+		SSE2_LOAD(in+32*g,y[g],z[g]);
+	for ( unsigned int i=0; i<rounds; i++ )
+	{
+		__m128i k = _mm_set1_epi32((int)roundKeys[2*i]);
+		for ( int g=0; g<G; g++ )
+			y[g] = _mm_add_epi32(y[g],_mm_xor_si128(SSE2_MIX(z[g]),k));
+		k = _mm_set1_epi32((int)roundKeys[2*i+1]);
+		for ( int g=0; g<G; g++ )
+			z[g] = _mm_add_epi32(z[g],_mm_xor_si128(SSE2_MIX(y[g]),k));
+	}
+	for ( int g=0; g<G; g++ )
+		SSE2_STORE(out+32*g,y[g],z[g]);
+}
+
+template <int G>
+SSE2_TARGET
+static void sse2Decrypt(const uint32_t *roundKeys, unsigned short rounds, const unsigned char *in, unsigned char *out)
+{
+	__m128i y[G], z[G];
+	for ( int g=0; g<G; g++ )
+		SSE2_LOAD(in+32*g,y[g],z[g]);
+	for ( unsigned int i=rounds; i>0; i-- )
+	{
+		__m128i k = _mm_set1_epi32((int)roundKeys[2*i-1]);
+		for ( int g=0; g<G; g++ )
+			z[g] = _mm_sub_epi32(z[g],_mm_xor_si128(SSE2_MIX(y[g]),k));
+		k = _mm_set1_epi32((int)roundKeys[2*i-2]);
+		for ( int g=0; g<G; g++ )
+			y[g] = _mm_sub_epi32(y[g],_mm_xor_si128(SSE2_MIX(z[g]),k));
+	}
+	for ( int g=0; g<G; g++ )
+		SSE2_STORE(out+32*g,y[g],z[g]);
+}
+
+template <int G>
+AVX2_TARGET
+static void avx2Encrypt(const uint32_t *roundKeys, unsigned short rounds, const unsigned char *in, unsigned char *out)
+{
+	__m256i y[G], z[G];
+	for ( int g=0; g<G; g++ )
+		AVX2_LOAD(in+64*g,y[g],z[g]);
+	for ( unsigned int i=0; i<rounds; i++ )
+	{
+		__m256i k = _mm256_set1_epi32((int)roundKeys[2*i]);
+		for ( int g=0; g<G; g++ )
+			y[g] = _mm256_add_epi32(y[g],_mm256_xor_si256(AVX2_MIX(z[g]),k));
+		k = _mm256_set1_epi32((int)roundKeys[2*i+1]);
+		for ( int g=0; g<G; g++ )
+			z[g] = _mm256_add_epi32(z[g],_mm256_xor_si256(AVX2_MIX(y[g]),k));
+	}
+	for ( int g=0; g<G; g++ )
+		AVX2_STORE(out+64*g,y[g],z[g]);
+}
+
+template <int G>
+AVX2_TARGET
+static void avx2Decrypt(const uint32_t *roundKeys, unsigned short rounds, const unsigned char *in, unsigned char *out)
+{
+	__m256i y[G], z[G];
+	for ( int g=0; g<G; g++ )
+		AVX2_LOAD(in+64*g,y[g],z[g]);
+	for ( unsigned int i=rounds; i>0; i-- )
+	{
+		__m256i k = _mm256_set1_epi32((int)roundKeys[2*i-1]);
+		for ( int g=0; g<G; g++ )
+			z[g] = _mm256_sub_epi32(z[g],_mm256_xor_si256(AVX2_MIX(y[g]),k));
+		k = _mm256_set1_epi32((int)roundKeys[2*i-2]);
+		for ( int g=0; g<G; g++ )
+			y[g] = _mm256_sub_epi32(y[g],_mm256_xor_si256(AVX2_MIX(z[g]),k));
+	}
+	for ( int g=0; g<G; g++ )
+		AVX2_STORE(out+64*g,y[g],z[g]);
+}
+
+//static
+unsigned int XTEA_SIMD::encryptBlocks(const uint32_t *roundKeys, unsigned short rounds, const unsigned char *in, unsigned char *out, unsigned int nblocks, bool avx2)
+{
+	unsigned int i=0;
+	if ( avx2 )
+	{
+		for ( ; i+16<=nblocks; i+=16 )
+			avx2Encrypt<2>(roundKeys,rounds,in+8*i,out+8*i);
+		if ( i+8<=nblocks )
+		{
+			avx2Encrypt<1>(roundKeys,rounds,in+8*i,out+8*i);
+			i += 8;
+		}
+	}
+	for ( ; i+8<=nblocks; i+=8 )
+		sse2Encrypt<2>(roundKeys,rounds,in+8*i,out+8*i);
+	if ( i+4<=nblocks )
+	{
+		sse2Encrypt<1>(roundKeys,rounds,in+8*i,out+8*i);
+		i += 4;
+	}
+	return i;
+}
+
+//static
+unsigned int XTEA_SIMD::decryptBlocks(const uint32_t *roundKeys, unsigned short rounds, const unsigned char *in, unsigned char *out, unsigned int nblocks, bool avx2)
+{
+	unsigned int i=0;
+	if ( avx2 )
+	{
+		for ( ; i+16<=nblocks; i+=16 )
+			avx2Decrypt<2>(roundKeys,rounds,in+8*i,out+8*i);
+		if ( i+8<=nblocks )
+		{
+			avx2Decrypt<1>(roundKeys,rounds,in+8*i,out+8*i);
+			i += 8;
+		}
+	}
+	for ( ; i+8<=nblocks; i+=8 )
+		sse2Decrypt<2>(roundKeys,rounds,in+8*i,out+8*i);
+	if ( i+4<=nblocks )
+	{
+		sse2Decrypt<1>(roundKeys,rounds,in+8*i,out+8*i);
+		i += 4;
+	}
+	return i;
+}
+
+#else // !ACRYPTO_X86
+
+bool XTEA_SIMD::available() { return false; }
+bool XTEA_SIMD::availableAVX2() { return false; }
+unsigned int XTEA_SIMD::encryptBlocks(const uint32_t *, unsigned short, const unsigned char *, unsigned char *, unsigned int, bool) { return 0; }
+unsigned int XTEA_SIMD::decryptBlocks(const uint32_t *, unsigned short, const unsigned char *, unsigned char *, unsigned int, bool) { return 0; }
+
+#endif // ACRYPTO_X86
@@ -0,0 +1,72 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_XTEA_SIMD_H
+#define __ACRYPTO_XTEA_SIMD_H
+
+#include <stdint.h>
+#include "CryptoDefs.h"
+
+/**
+ *  @brief SSE2/AVX2 backend for the XTEA class.
+ *
+ *  XTEA is all 32-bit adds, shifts and XORs, and the round key is the same for every block, so
+ *  a group of blocks runs through the rounds in lockstep with one block per vector lane: four
+ *  blocks to an SSE2 register pair, eight to an AVX2 pair. Two groups are kept in flight to
+ *  hide the latency of the round chain, so the kernels take 8 blocks (SSE2) or 16 (AVX2) per
+ *  step, then a last group of 4 or 8. The caller does the remaining blocks with the scalar
+ *  code. The round keys are the table expanded by XTEA::expandKey, broadcast to all lanes.
+ *  On platforms other than x86 the class compiles to stubs and available() returns false.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+class XTEA_SIMD
+{
+	public:
+		/**
+		 *  Returns true if the CPU supports SSE2. CPUID is queried once and the result cached.
+		 */
+		static bool available();
+		/**
+		 *  Returns true if the CPU (and OS) support AVX2.
+		 */
+		static bool availableAVX2();
+
+		/**
+		 *  Encrypt or decrypt as many whole groups of four blocks from in to out as there are
+		 *  in nblocks, on the round keys from XTEA::expandKey. in and out may be the same
+		 *  buffer. Returns the number of blocks done, a multiple of four.
+		 */
+		static unsigned int encryptBlocks(const uint32_t *roundKeys, unsigned short rounds, const unsigned char *in, unsigned char *out, unsigned int nblocks, bool avx2);
+		static unsigned int decryptBlocks(const uint32_t *roundKeys, unsigned short rounds, const unsigned char *in, unsigned char *out, unsigned int nblocks, bool avx2);
+};
+
+#endif /* __ACRYPTO_XTEA_SIMD_H */
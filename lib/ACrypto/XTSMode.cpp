@@ -0,0 +1,296 @@
+
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "XTSMode.h"
+
+#if defined(ACRYPTO_X86)
+#include <emmintrin.h>
+#endif
+
+/**
+ *  Tweaks are 128-bit little-endian integers, and a sector's chain of them is generated a group
+ *  at a time: tweakGroup writes T, T.alpha, ..., T.alpha^(n-1) to tweaks, XORs them into n
+ *  blocks from in, and leaves T.alpha^n in T for the next group. whitenOut XORs the tweaks into
+ *  the cipher output. On x86 a tweak is one SSE2 register; elsewhere it is two 64-bit halves,
+ *  and the multiplication by alpha is a pair of shifts and a conditional XOR either way.
+ */
+#if defined(ACRYPTO_X86)
+
+__attribute__((target("sse2")))
+static inline __m128i mulAlpha(__m128i t)
+{
+	// The top bits of both halves, moved to where their carries go: into bit 64, and back
+	// into the low byte as the reduction 0x87
+	__m128i carry = _mm_srai_epi32(_mm_shuffle_epi32(t,0x13),31);
+	carry = _mm_and_si128(carry,_mm_set_epi32(0,1,0,0x87));
+	return _mm_xor_si128(_mm_slli_epi64(t,1),carry);
+}
+
+__attribute__((target("sse2")))
+static void tweakGroup(const unsigned char *in, unsigned char *out, unsigned char *tweaks, unsigned char *T, unsigned int n)
+{
+	__m128i t = _mm_loadu_si128((const __m128i *)T);
+	for ( unsigned int k=0; k<n; k++ )
+	{
+		_mm_storeu_si128((__m128i *)(tweaks+16*k),t);
+		_mm_storeu_si128((__m128i *)(out+16*k),_mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+16*k)),t));
+		t = mulAlpha(t);
+	}
+	_mm_storeu_si128((__m128i *)T,t);
+}
+
+__attribute__((target("sse2")))
+static void whitenOut(unsigned char *out, const unsigned char *in, const unsigned char *tweaks, unsigned int n)
+{
+	for ( unsigned int k=0; k<n; k++ )
+		_mm_storeu_si128((__m128i *)(out+16*k),_mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+16*k)),
+			_mm_loadu_si128((const __m128i *)(tweaks+16*k))));
+}
+
+#else
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+#define LE64(v) __builtin_bswap64(v)
+#else
+#define LE64(v) (v)
+#endif
+
+static void tweakGroup(const unsigned char *in, unsigned char *out, unsigned char *tweaks, unsigned char *T, unsigned int n)
+{
+	uint64_t t[2], x[2];
+	memcpy(t,T,16);
+	uint64_t lo = LE64(t[0]), hi = LE64(t[1]);
+	for ( unsigned int k=0; k<n; k++ )
+	{
+		t[0] = LE64(lo);
+		t[1] = LE64(hi);
+		memcpy(tweaks+16*k,t,16);
+		memcpy(x,in+16*k,16);
+		x[0] ^= t[0];
+		x[1] ^= t[1];
+		memcpy(out+16*k,x,16);
+
+		uint64_t carry = hi >> 63;
+		hi = (hi<<1) | (lo>>63);
+		lo = (lo<<1) ^ (0x87 & (0-carry));
+	}
+	t[0] = LE64(lo);
+	t[1] = LE64(hi);
+	memcpy(T,t,16);
+}
+
+static void whitenOut(unsigned char *out, const unsigned char *in, const unsigned char *tweaks, unsigned int n)
+{
+	uint64_t x[2], t[2];
+	for ( unsigned int k=0; k<n; k++ )
+	{
+		memcpy(x,in+16*k,16);
+		memcpy(t,tweaks+16*k,16);
+		x[0] ^= t[0];
+		x[1] ^= t[1];
+		memcpy(out+16*k,x,16);
+	}
+}
+
+#endif
+
+XTSMode::XTSMode(unsigned char *K1, unsigned char *K2, CryptoArena *arena)
+{
+	m_algorithmType=atAES128;
+	m_algorithm = new (arena) AES128(K1);
+	m_tweakCipher = new (arena) AES128(K2);
+}
+
+XTSMode::XTSMode(const AES128Key *K1, const AES128Key *K2, CryptoArena *arena)
+{
+	m_algorithmType=atAES128;
+	m_algorithm = new (arena) AES128(K1);
+	m_tweakCipher = new (arena) AES128(K2);
+}
+
+XTSMode::~XTSMode()
+{
+	delete m_algorithm;
+	delete m_tweakCipher;
+}
+
+bool XTSMode::encrypt(unsigned char *sector, unsigned int length, uint64_t sectorNumber)
+{
+	return cryptSectors(sector,sector,length,1,sectorNumber,false);
+}
+
+bool XTSMode::decrypt(unsigned char *sector, unsigned int length, uint64_t sectorNumber)
+{
+	return cryptSectors(sector,sector,length,1,sectorNumber,true);
+}
+
+bool XTSMode::encrypt(const unsigned char *in, unsigned int length, unsigned char *out, uint64_t sectorNumber)
+{
+	return cryptSectors(in,out,length,1,sectorNumber,false);
+}
+
+bool XTSMode::decrypt(const unsigned char *in, unsigned int length, unsigned char *out, uint64_t sectorNumber)
+{
+	return cryptSectors(in,out,length,1,sectorNumber,true);
+}
+
+bool XTSMode::encryptSectors(unsigned char *data, unsigned int sectorLength, unsigned int count, uint64_t firstSector)
+{
+	return cryptSectors(data,data,sectorLength,count,firstSector,false);
+}
+
+bool XTSMode::decryptSectors(unsigned char *data, unsigned int sectorLength, unsigned int count, uint64_t firstSector)
+{
+	return cryptSectors(data,data,sectorLength,count,firstSector,true);
+}
+
+bool XTSMode::cryptSectors(const unsigned char *in, unsigned char *out, unsigned int sectorLength, unsigned int count,
+	uint64_t firstSector, bool decrypt)
+{
+	unsigned char T0[XTS_PARALLEL_BLOCKS*AES128_BLOCK_BYTES];
+
+	if ( sectorLength<AES128_BLOCK_BYTES || (uint64_t)count*sectorLength > (size_t)-1 )
+		return false;
+	for ( unsigned int s=0; s<count; )
+	{
+		unsigned int n = count-s;
+		if ( n>XTS_PARALLEL_BLOCKS )
+			n = XTS_PARALLEL_BLOCKS;
+
+		// T_0 = E_K2(sector number) for a group of sectors at once
+		memset(T0,0,n*AES128_BLOCK_BYTES);
+		for ( unsigned int k=0; k<n; k++ )
+		{
+			uint64_t sector = firstSector+s+k;
+			for ( int bb=0; bb<8; bb++, sector>>=8 )
+				T0[k*AES128_BLOCK_BYTES+bb] = (unsigned char)sector;
+		}
+		m_tweakCipher->encryptBlocks(T0,T0,n);
+
+		for ( unsigned int k=0; k<n; k++ )
+		{
+			size_t at = (size_t)(s+k)*sectorLength;
+			cryptSector(in+at,out+at,sectorLength,T0+k*AES128_BLOCK_BYTES,decrypt);
+		}
+		s += n;
+	}
+	return true;
+}
+
+void XTSMode::cryptSector(const unsigned char *in, unsigned char *out, unsigned int length, const unsigned char *T0,
+	bool decrypt)
+{
+	unsigned char tweaks[XTS_PARALLEL_BLOCKS*AES128_BLOCK_BYTES];
+	unsigned char buffer[XTS_PARALLEL_BLOCKS*AES128_BLOCK_BYTES];
+	unsigned char T[AES128_BLOCK_BYTES];
+	unsigned int tail = length % AES128_BLOCK_BYTES;
+	// With a partial block at the end, the last whole block is left for the stealing
+	unsigned int blocks = length/AES128_BLOCK_BYTES - (tail ? 1 : 0);
+
+	memcpy(T,T0,AES128_BLOCK_BYTES);
+	for ( unsigned int i=0; i<blocks; )
+	{
+		unsigned int n = blocks-i;
+		if ( n>XTS_PARALLEL_BLOCKS )
+			n = XTS_PARALLEL_BLOCKS;
+
+		// The tweak chain for the group, then one pass through the cipher
+		tweakGroup(in+i*AES128_BLOCK_BYTES,buffer,tweaks,T,n);
+		if ( decrypt )
+			m_algorithm->decryptBlocks(buffer,buffer,n);
+		else
+			m_algorithm->encryptBlocks(buffer,buffer,n);
+		whitenOut(out+i*AES128_BLOCK_BYTES,buffer,tweaks,n);
+		i += n;
+	}
+	if ( tail==0 )
+		return;
+
+	// Ciphertext stealing over the last whole block (tweak T_m-1) and the partial one (T_m).
+	// Both are read before anything is written, so in and out may be the same.
+	unsigned char Tm1[AES128_BLOCK_BYTES], Tm[AES128_BLOCK_BYTES];
+	unsigned char CC[AES128_BLOCK_BYTES], PP[AES128_BLOCK_BYTES];
+	const unsigned char *last = in+blocks*AES128_BLOCK_BYTES;
+	unsigned char *lastOut = out+blocks*AES128_BLOCK_BYTES;
+	memset(CC,0,AES128_BLOCK_BYTES);
+	memcpy(Tm,T,AES128_BLOCK_BYTES);
+	tweakGroup(CC,PP,Tm1,Tm,1);
+	if ( !decrypt )
+	{
+		// CC = E(P_m-1), whose head becomes C_m; P_m padded with its tail is encrypted to C_m-1
+		memcpy(CC,last,AES128_BLOCK_BYTES);
+		cryptBlock(CC,Tm1,false);
+		memcpy(PP,last+AES128_BLOCK_BYTES,tail);
+		memcpy(PP+tail,CC+tail,AES128_BLOCK_BYTES-tail);
+		cryptBlock(PP,Tm,false);
+		memcpy(lastOut+AES128_BLOCK_BYTES,CC,tail);
+		memcpy(lastOut,PP,AES128_BLOCK_BYTES);
+	}
+	else
+	{
+		// The reverse: C_m-1 decrypts under T_m, giving P_m and the tail of CC
+		memcpy(PP,last,AES128_BLOCK_BYTES);
+		cryptBlock(PP,Tm,true);
+		memcpy(CC,last+AES128_BLOCK_BYTES,tail);
+		memcpy(CC+tail,PP+tail,AES128_BLOCK_BYTES-tail);
+		cryptBlock(CC,Tm1,true);
+		memcpy(lastOut+AES128_BLOCK_BYTES,PP,tail);
+		memcpy(lastOut,CC,AES128_BLOCK_BYTES);
+	}
+}
+
+/**
+ *  One block under tweak T: E_K1(B XOR T) XOR T, or the inverse.
+ */
+void XTSMode::cryptBlock(unsigned char *block, const unsigned char *T, bool decrypt)
+{
+	for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+		block[bb] ^= T[bb];
+	if ( decrypt )
+		m_algorithm->decryptBlocks(block,block,1);
+	else
+		m_algorithm->encryptBlocks(block,block,1);
+	for ( int bb=0; bb<AES128_BLOCK_BYTES; bb++ )
+		block[bb] ^= T[bb];
+}
+
+void XTSMode::rekey(unsigned char *K1, unsigned char *K2)
+{
+	m_algorithm->rekey(K1);
+	m_tweakCipher->rekey(K2);
+}
+
+void XTSMode::rekey(const AES128Key *K1, const AES128Key *K2)
+{
+	((AES128 *)m_algorithm)->rekey(K1);
+	m_tweakCipher->rekey(K2);
+}
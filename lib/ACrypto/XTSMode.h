@@ -0,0 +1,119 @@
+
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#ifndef __ACRYPTO_XTSMODE_H
+#define __ACRYPTO_XTSMODE_H
+
+#include <stdint.h>
+#include "CryptoModeBase.h"
+#include "BlockCipherAlgorithm.h"
+#include "AES128.h"
+
+// The number of blocks, and of sector tweaks, encrypted per call to the cipher.
+#if defined(__AVR__)
+#define XTS_PARALLEL_BLOCKS 1
+#else
+#define XTS_PARALLEL_BLOCKS 8
+#endif
+
+/**
+ *  XTS-AES-128 (IEEE 1619-2007, NIST SP 800-38E) for sector (data unit) encryption.
+ *
+ *  Each sector is encrypted on its own under a tweak derived from its number, so any sector can
+ *  be read or rewritten without touching the others, and the ciphertext is as long as the
+ *  plaintext. Block j of sector s is C_j = E_K1(P_j XOR T_j) XOR T_j, where T_0 = E_K2(s) and
+ *  T_j = T_{j-1}.alpha in GF(2^128). The tweaks of XTS_PARALLEL_BLOCKS blocks are computed
+ *  ahead so that the blocks go through the cipher together. A sector which is not a multiple
+ *  of the block length ends in ciphertext stealing; it must still be at least one block long.
+ *
+ *  The sector number is encoded as a 128-bit little-endian integer, as in IEEE 1619.
+ *
+ *  @author Kristjan V. Jonsson (kristjanvj@gmail.com)
+ */
+class XTSMode : public CryptoModeBase
+{
+	public:
+		/**
+		 *  Constructor. AES128 with the data key K1 and the tweak key K2, which should be
+		 *  distinct. Both ciphers are placed in arena if one is given.
+		 */
+		XTSMode(unsigned char *K1, unsigned char *K2, CryptoArena *arena=NULL);
+		/**
+		 *  Constructor. Runs on expanded keys, which are shared rather than copied.
+		 */
+		XTSMode(const AES128Key *K1, const AES128Key *K2, CryptoArena *arena=NULL);
+		virtual ~XTSMode();
+
+	public:
+		/**
+		 *  Encrypt one sector of length bytes in place. length must be at least
+		 *  AES128_BLOCK_BYTES; a shorter sector is left as it is and false is returned.
+		 */
+		bool encrypt(unsigned char *sector, unsigned int length, uint64_t sectorNumber);
+		bool decrypt(unsigned char *sector, unsigned int length, uint64_t sectorNumber);
+		/**
+		 *  Out-of-place encryption and decryption of one sector from in to out, which may not
+		 *  overlap unless they are the same buffer.
+		 */
+		bool encrypt(const unsigned char *in, unsigned int length, unsigned char *out, uint64_t sectorNumber);
+		bool decrypt(const unsigned char *in, unsigned int length, unsigned char *out, uint64_t sectorNumber);
+		/**
+		 *  Encrypt count consecutive sectors of sectorLength bytes in place, numbered from
+		 *  firstSector. The tweaks of XTS_PARALLEL_BLOCKS sectors are encrypted in one call.
+		 *  Returns false, touching nothing, if sectorLength is less than AES128_BLOCK_BYTES or
+		 *  the run is longer than the address space.
+		 */
+		bool encryptSectors(unsigned char *data, unsigned int sectorLength, unsigned int count, uint64_t firstSector);
+		bool decryptSectors(unsigned char *data, unsigned int sectorLength, unsigned int count, uint64_t firstSector);
+		/**
+		 *  Refresh the data and tweak keys.
+		 */
+		void rekey(unsigned char *K1, unsigned char *K2);
+		/**
+		 *  Switch to expanded keys without expanding them again.
+		 */
+		void rekey(const AES128Key *K1, const AES128Key *K2);
+
+		virtual bool valid() { return m_algorithm!=NULL && m_tweakCipher!=NULL; }
+
+	protected:
+		bool cryptSectors(const unsigned char *in, unsigned char *out, unsigned int sectorLength, unsigned int count,
+			uint64_t firstSector, bool decrypt);
+		void cryptSector(const unsigned char *in, unsigned char *out, unsigned int length, const unsigned char *T0,
+			bool decrypt);
+		void cryptBlock(unsigned char *block, const unsigned char *T, bool decrypt);
+
+	private:
+		AES128 *m_tweakCipher;  /// AES128 under K2, which encrypts the sector numbers
+};
+
+#endif /* __ACRYPTO_XTSMODE_H */
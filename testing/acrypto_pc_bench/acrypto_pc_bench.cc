@@ -0,0 +1,718 @@
+
+/* ***********************************************************************************************
+ *
+ *  ACrypto -- The Arduino Crypto Library
+ *
+ *  Kristjan V. Jonsson
+ *  Kristjan Runarsson
+ *  Benedikt Kristinsson
+ *
+ *  (c) 2010-2011
+ *
+ * ***********************************************************************************************
+ *
+ *  Released under the GNU General Public License v. 3. See <http://www.gnu.org/licenses/gpl.html/>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * **********************************************************************************************
+ */
+
+#include "ACrypto.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(ACRYPTO_X86)
+#include <x86intrin.h>
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+/**
+ *  @file acrypto_pc_bench.cc
+ *
+ *  @brief Throughput benchmarks for the Arduino Crypto Library (ACrypto).
+ *
+ *  Every block cipher (each AES128 engine separately) and every mode and composition is timed
+ *  in place on a buffer of the given size. Each case is warmed up, then timed in samples of
+ *  at least BENCH_SAMPLE_NS; the fastest sample is reported as ns/op, MB/s and cycles/byte
+ *  (time stamp counter cycles, x86 only).
+ *
+ *  Usage: acrypto_pc_bench [--json] [--quick] [--cpu N] [--threads N] [--filter TEXT]
+ *
+ *    --json     Print the results as JSON for comparison between runs.
+ *    --quick    Stop at 1 MiB messages.
+ *    --cpu N    Pin the process to CPU N (Linux). By default it is pinned to the CPU it
+ *               starts on.
+ *    --threads  Threads for the BulkEngine cases (default: one per CPU). Needs a build with
+ *               ACRYPTO_THREADS. The workers start before the pinning and are not pinned.
+ *    --filter   Only run cases whose name contains TEXT.
+ *
+ *  Decryption cases for the authenticated compositions restore the ciphertext with memcpy
+ *  before each run; the copy is included in the time.
+ */
+
+#define BENCH_WARMUP_NS   50000000ULL    // 50 ms
+#define BENCH_SAMPLE_NS   50000000ULL    // 50 ms
+#define BENCH_SAMPLES     5
+#define BENCH_MIN_SIZE    16
+#define BENCH_MAX_SIZE    (64*1024*1024)
+#define BENCH_QUICK_SIZE  (1024*1024)
+#define BENCH_FRAME_BYTES 64             // Frame size for the batched CMAC verification
+
+static bool g_json = false;
+static bool g_first = true;
+static const char *g_filter = NULL;
+
+static unsigned char g_key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+static unsigned char g_key2[] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+static unsigned char g_IV[] = {0xf0,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa,0xfb,0xfc,0xfd,0xfe,0xff};
+
+static unsigned long long nanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long cycles()
+{
+#if defined(ACRYPTO_X86)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/**
+ *  One benchmarked operation over a buffer of length bytes.
+ */
+class Operation
+{
+	public:
+		virtual ~Operation() {}
+		virtual void run(unsigned char *buffer, unsigned int length) = 0;
+};
+
+class CipherEncrypt : public Operation
+{
+	public:
+		CipherEncrypt(BlockCipherAlgorithm *cipher, bool batch) : m_cipher(cipher), m_batch(batch) {}
+		virtual void run(unsigned char *buffer, unsigned int length)
+		{
+			unsigned int blocks = length / m_cipher->blocklength();
+			if ( m_batch )
+				m_cipher->encryptBlocks(buffer,buffer,blocks);
+			else
+				for ( unsigned int i=0; i<blocks; i++ )
+					m_cipher->encrypt(buffer+i*m_cipher->blocklength());
+		}
+	private:
+		BlockCipherAlgorithm *m_cipher;
+		bool m_batch;
+};
+
+class CipherDecrypt : public Operation
+{
+	public:
+		CipherDecrypt(BlockCipherAlgorithm *cipher, bool batch) : m_cipher(cipher), m_batch(batch) {}
+		virtual void run(unsigned char *buffer, unsigned int length)
+		{
+			unsigned int blocks = length / m_cipher->blocklength();
+			if ( m_batch )
+				m_cipher->decryptBlocks(buffer,buffer,blocks);
+			else
+				for ( unsigned int i=0; i<blocks; i++ )
+					m_cipher->decrypt(buffer+i*m_cipher->blocklength());
+		}
+	private:
+		BlockCipherAlgorithm *m_cipher;
+		bool m_batch;
+};
+
+class ECBEncrypt : public Operation
+{
+	public:
+		ECBEncrypt(ECBMode *ecb) : m_ecb(ecb) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_ecb->encrypt(buffer,length); }
+	private:
+		ECBMode *m_ecb;
+};
+
+class ECBDecrypt : public Operation
+{
+	public:
+		ECBDecrypt(ECBMode *ecb) : m_ecb(ecb) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_ecb->decrypt(buffer,length); }
+	private:
+		ECBMode *m_ecb;
+};
+
+class CBCEncrypt : public Operation
+{
+	public:
+		CBCEncrypt(CBCMode *cbc) : m_cbc(cbc) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_cbc->encrypt(buffer,length,g_IV); }
+	private:
+		CBCMode *m_cbc;
+};
+
+class CBCDecrypt : public Operation
+{
+	public:
+		CBCDecrypt(CBCMode *cbc) : m_cbc(cbc) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_cbc->decrypt(buffer,length,g_IV); }
+	private:
+		CBCMode *m_cbc;
+};
+
+template <class Cipher>
+class ECBTEncrypt : public Operation
+{
+	public:
+		ECBTEncrypt(ECBModeT<Cipher> *ecb) : m_ecb(ecb) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_ecb->encrypt(buffer,length); }
+	private:
+		ECBModeT<Cipher> *m_ecb;
+};
+
+template <class Cipher>
+class CBCTEncrypt : public Operation
+{
+	public:
+		CBCTEncrypt(CBCModeT<Cipher> *cbc) : m_cbc(cbc) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_cbc->encrypt(buffer,length,g_IV); }
+	private:
+		CBCModeT<Cipher> *m_cbc;
+};
+
+template <class Cipher>
+class CBCTDecrypt : public Operation
+{
+	public:
+		CBCTDecrypt(CBCModeT<Cipher> *cbc) : m_cbc(cbc) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_cbc->decrypt(buffer,length,g_IV); }
+	private:
+		CBCModeT<Cipher> *m_cbc;
+};
+
+class CTRCrypt : public Operation
+{
+	public:
+		CTRCrypt(CTRMode *ctr) : m_ctr(ctr) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_ctr->encrypt(buffer,length,g_IV); }
+	private:
+		CTRMode *m_ctr;
+};
+
+class BulkECBEncrypt : public Operation
+{
+	public:
+		BulkECBEncrypt(BulkEngine *bulk, ECBMode *ecb) : m_bulk(bulk), m_ecb(ecb) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_bulk->ecbEncrypt(m_ecb,buffer,length); }
+	private:
+		BulkEngine *m_bulk;
+		ECBMode *m_ecb;
+};
+
+class BulkCTRCrypt : public Operation
+{
+	public:
+		BulkCTRCrypt(BulkEngine *bulk, CTRMode *ctr) : m_bulk(bulk), m_ctr(ctr) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_bulk->ctrCrypt(m_ctr,buffer,length,g_IV); }
+	private:
+		BulkEngine *m_bulk;
+		CTRMode *m_ctr;
+};
+
+/**
+ *  The buffer as consecutive sectors of a fixed length, through the sector batch API.
+ */
+class XTSCrypt : public Operation
+{
+	public:
+		XTSCrypt(XTSMode *xts, unsigned int sectorLength, bool decrypt) : m_xts(xts), m_sectorLength(sectorLength), m_decrypt(decrypt) {}
+		virtual void run(unsigned char *buffer, unsigned int length)
+		{
+			if ( m_decrypt )
+				m_xts->decryptSectors(buffer,m_sectorLength,length/m_sectorLength,0);
+			else
+				m_xts->encryptSectors(buffer,m_sectorLength,length/m_sectorLength,0);
+		}
+	private:
+		XTSMode *m_xts;
+		unsigned int m_sectorLength;
+		bool m_decrypt;
+};
+
+class BulkXTSCrypt : public Operation
+{
+	public:
+		BulkXTSCrypt(BulkEngine *bulk, XTSMode *xts) : m_bulk(bulk), m_xts(xts) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_bulk->xtsEncrypt(m_xts,buffer,4096,length/4096,0); }
+	private:
+		BulkEngine *m_bulk;
+		XTSMode *m_xts;
+};
+
+class CMACTag : public Operation
+{
+	public:
+		CMACTag(AES128_CMAC *cmac) : m_cmac(cmac) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_cmac->mac(buffer,length,m_tag); }
+	private:
+		AES128_CMAC *m_cmac;
+		unsigned char m_tag[AES128_BLOCK_BYTES];
+};
+
+class PMACTag : public Operation
+{
+	public:
+		PMACTag(AES128_PMAC *pmac) : m_pmac(pmac) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_pmac->mac(buffer,length,m_tag); }
+	private:
+		AES128_PMAC *m_pmac;
+		unsigned char m_tag[AES128_BLOCK_BYTES];
+};
+
+/**
+ *  The buffer as a run of BENCH_FRAME_BYTES frames, each verified against a tag, one frame at
+ *  a time or through the batch API.
+ */
+class CMACVerify : public Operation
+{
+	public:
+		CMACVerify(AES128_CMAC *cmac, bool batch) : m_cmac(cmac), m_batch(batch) { memset(m_tag,0,sizeof(m_tag)); }
+		virtual void run(unsigned char *buffer, unsigned int length)
+		{
+			unsigned int frames = length / BENCH_FRAME_BYTES;
+			if ( !m_batch )
+			{
+				for ( unsigned int f=0; f<frames; f++ )
+					m_cmac->verify(buffer+f*BENCH_FRAME_BYTES,BENCH_FRAME_BYTES,m_tag);
+				return;
+			}
+			CMACJob jobs[64];
+			unsigned char valid[64/8];
+			for ( unsigned int f=0; f<frames; f+=64 )
+			{
+				unsigned int n = frames-f < 64 ? frames-f : 64;
+				for ( unsigned int j=0; j<n; j++ )
+				{
+					jobs[j].message = buffer + (f+j)*BENCH_FRAME_BYTES;
+					jobs[j].length = BENCH_FRAME_BYTES;
+					jobs[j].tag = m_tag;
+				}
+				m_cmac->verifyBatch(jobs,n,valid);
+			}
+		}
+	private:
+		AES128_CMAC *m_cmac;
+		bool m_batch;
+		unsigned char m_tag[AES128_BLOCK_BYTES];
+};
+
+/**
+ *  A block under a fresh key each time: the static one-shot call against an instance keyed
+ *  for the block.
+ */
+class OneShotEncrypt : public Operation
+{
+	public:
+		OneShotEncrypt(bool keyed) : m_keyed(keyed) {}
+		virtual void run(unsigned char *buffer, unsigned int length)
+		{
+			if ( m_keyed )
+			{
+				AES128 aes(g_key);
+				aes.encrypt(buffer);
+			}
+			else
+				AES128::encrypt(g_key,buffer);
+		}
+	private:
+		bool m_keyed;
+};
+
+class OneShotCMAC : public Operation
+{
+	public:
+		OneShotCMAC(bool keyed) : m_keyed(keyed) {}
+		virtual void run(unsigned char *buffer, unsigned int length)
+		{
+			if ( m_keyed )
+			{
+				AES128_CMAC cmac(g_key2);
+				cmac.mac(buffer,length,m_tag);
+			}
+			else
+				AES128_CMAC::mac(g_key2,buffer,length,m_tag);
+		}
+	private:
+		bool m_keyed;
+		unsigned char m_tag[AES128_BLOCK_BYTES];
+};
+
+class EtMEncrypt : public Operation
+{
+	public:
+		EtMEncrypt(AES128CBC_CMAC_EtM *etm) : m_etm(etm) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_etm->encryptAndTag(buffer,length,g_IV); }
+	private:
+		AES128CBC_CMAC_EtM *m_etm;
+};
+
+class EtMDecrypt : public Operation
+{
+	public:
+		EtMDecrypt(AES128CBC_CMAC_EtM *etm, unsigned char *record) : m_etm(etm), m_record(record) {}
+		virtual void run(unsigned char *buffer, unsigned int length)
+		{
+			memcpy(buffer,m_record,length+AES128_BLOCK_BYTES);
+			m_etm->decryptAndVerify(buffer,length,g_IV);
+		}
+	private:
+		AES128CBC_CMAC_EtM *m_etm;
+		unsigned char *m_record;
+};
+
+class GCMEncrypt : public Operation
+{
+	public:
+		GCMEncrypt(AES128_GCM *gcm) : m_gcm(gcm) {}
+		virtual void run(unsigned char *buffer, unsigned int length) { m_gcm->encryptAndTag(buffer,length,g_IV,GCM_IV_BYTES,NULL,0,m_tag); }
+	private:
+		AES128_GCM *m_gcm;
+		unsigned char m_tag[GCM_TAG_BYTES];
+};
+
+class GCMDecrypt : public Operation
+{
+	public:
+		GCMDecrypt(AES128_GCM *gcm, unsigned char *record) : m_gcm(gcm), m_record(record) {}
+		virtual void run(unsigned char *buffer, unsigned int length)
+		{
+			memcpy(buffer,m_record,length);
+			m_gcm->decryptAndVerify(buffer,length,g_IV,GCM_IV_BYTES,NULL,0,m_record+length);
+		}
+	private:
+		AES128_GCM *m_gcm;
+		unsigned char *m_record;
+};
+
+/**
+ *  Time op on length bytes and print the result. The buffer must hold length plus one block.
+ */
+void bench(const char *name, const char *algorithm, Operation *op, unsigned char *buffer, unsigned int length)
+{
+	char fullName[128];
+	snprintf(fullName,sizeof(fullName),"%s/%s/%u",name,algorithm,length);
+	if ( g_filter!=NULL && strstr(fullName,g_filter)==NULL )
+		return;
+
+	// Warm-up, which also tells roughly how long one run takes
+	unsigned long long runs = 0;
+	unsigned long long start = nanoseconds();
+	unsigned long long elapsed;
+	do
+	{
+		op->run(buffer,length);
+		runs++;
+		elapsed = nanoseconds()-start;
+	} while ( elapsed<BENCH_WARMUP_NS );
+
+	unsigned long long iterations = runs*BENCH_SAMPLE_NS/elapsed;
+	if ( iterations<1 )
+		iterations = 1;
+
+	double bestNs = 0, bestCycles = 0;
+	for ( int s=0; s<BENCH_SAMPLES; s++ )
+	{
+		unsigned long long t0 = nanoseconds();
+		unsigned long long c0 = cycles();
+		for ( unsigned long long i=0; i<iterations; i++ )
+			op->run(buffer,length);
+		unsigned long long c1 = cycles();
+		unsigned long long t1 = nanoseconds();
+		double ns = (double)(t1-t0)/iterations;
+		if ( s==0 || ns<bestNs )
+		{
+			bestNs = ns;
+			bestCycles = (double)(c1-c0)/iterations;
+		}
+		// Long runs are not worth repeating five times
+		if ( s>=1 && (t1-t0)>4*BENCH_SAMPLE_NS )
+			break;
+	}
+
+	double mbps = length/bestNs*1000.0;
+	double cpb = bestCycles/length;
+	if ( g_json )
+	{
+		printf("%s\n    {\"name\": \"%s\", \"algorithm\": \"%s\", \"bytes\": %u, \"iterations\": %llu, "
+			"\"ns_per_op\": %.1f, \"mb_per_s\": %.2f, \"cycles_per_byte\": %.3f}",
+			g_first ? "" : ",",name,algorithm,length,iterations,bestNs,mbps,cpb);
+		g_first = false;
+	}
+	else
+		printf("%-14s %-16s %9u B %14.1f ns/op %9.2f MB/s %8.2f cycles/B\n",name,algorithm,length,bestNs,mbps,cpb);
+	fflush(stdout);
+}
+
+void benchCipher(const char *algorithm, BlockCipherAlgorithm *cipher, unsigned char *buffer)
+{
+	// Single blocks through the virtual interface, and runs of eight through the batch API
+	CipherEncrypt encrypt(cipher,false), encryptBatch(cipher,true);
+	CipherDecrypt decrypt(cipher,false), decryptBatch(cipher,true);
+	unsigned int one = cipher->blocklength(), eight = 8*cipher->blocklength();
+	bench("block_encrypt",algorithm,&encrypt,buffer,one);
+	bench("block_decrypt",algorithm,&decrypt,buffer,one);
+	bench("batch_encrypt",algorithm,&encryptBatch,buffer,eight);
+	bench("batch_decrypt",algorithm,&decryptBatch,buffer,eight);
+}
+
+/**
+ *  Calls which do not reuse the key, so the key setup is part of every operation.
+ */
+void benchOneShot(unsigned char *buffer)
+{
+	OneShotEncrypt oneShot(false), keyed(true);
+	OneShotCMAC oneShotCMAC(false), keyedCMAC(true);
+	bench("oneshot_block","AES128",&oneShot,buffer,AES128_BLOCK_BYTES);
+	bench("keyed_block","AES128",&keyed,buffer,AES128_BLOCK_BYTES);
+	bench("oneshot_cmac","AES128",&oneShotCMAC,buffer,64);
+	bench("keyed_cmac","AES128",&keyedCMAC,buffer,64);
+}
+
+void benchModes(const char *algorithm, AlgorithmType type, unsigned char *buffer, unsigned int maxSize)
+{
+	ECBMode ecb(type,g_key);
+	CBCMode cbc(type,g_key);
+	CTRMode ctr(type,g_key);
+	ECBEncrypt ecbEncrypt(&ecb);
+	ECBDecrypt ecbDecrypt(&ecb);
+	CBCEncrypt cbcEncrypt(&cbc);
+	CBCDecrypt cbcDecrypt(&cbc);
+	CTRCrypt ctrCrypt(&ctr);
+
+	for ( unsigned int size=BENCH_MIN_SIZE; size<=maxSize; size*=4 )
+	{
+		bench("ecb_encrypt",algorithm,&ecbEncrypt,buffer,size);
+		bench("ecb_decrypt",algorithm,&ecbDecrypt,buffer,size);
+		bench("cbc_encrypt",algorithm,&cbcEncrypt,buffer,size);
+		bench("cbc_decrypt",algorithm,&cbcDecrypt,buffer,size);
+		bench("ctr",algorithm,&ctrCrypt,buffer,size);
+	}
+}
+
+/**
+ *  The compile-time mode templates. Compare with ecb_encrypt, cbc_encrypt and cbc_decrypt; the
+ *  difference is the cost of the runtime cipher dispatch.
+ */
+template <class Cipher>
+void benchTemplateModes(const char *algorithm, unsigned char *buffer, unsigned int maxSize)
+{
+	ECBModeT<Cipher> ecb(g_key);
+	CBCModeT<Cipher> cbc(g_key);
+	ECBTEncrypt<Cipher> ecbEncrypt(&ecb);
+	CBCTEncrypt<Cipher> cbcEncrypt(&cbc);
+	CBCTDecrypt<Cipher> cbcDecrypt(&cbc);
+
+	for ( unsigned int size=BENCH_MIN_SIZE; size<=maxSize; size*=4 )
+	{
+		bench("ecbt_encrypt",algorithm,&ecbEncrypt,buffer,size);
+		bench("cbct_encrypt",algorithm,&cbcEncrypt,buffer,size);
+		bench("cbct_decrypt",algorithm,&cbcDecrypt,buffer,size);
+	}
+}
+
+/**
+ *  The multi-core engine on buffers large enough to be sharded. Compare with ecb_encrypt and
+ *  ctr on one thread for the scaling.
+ */
+/**
+ *  XTS over 512-byte and 4 KiB sectors.
+ */
+void benchXTS(unsigned char *buffer, unsigned int maxSize)
+{
+	XTSMode xts(g_key,g_key2);
+	XTSCrypt encrypt512(&xts,512,false), decrypt512(&xts,512,true), encrypt4k(&xts,4096,false);
+
+	for ( unsigned int size=4096; size<=maxSize; size*=4 )
+	{
+		bench("xts512_encrypt","AES128",&encrypt512,buffer,size);
+		bench("xts512_decrypt","AES128",&decrypt512,buffer,size);
+		bench("xts4k_encrypt","AES128",&encrypt4k,buffer,size);
+	}
+}
+
+void benchBulk(BulkEngine *bulk, unsigned char *buffer, unsigned int maxSize)
+{
+	ECBMode ecb(atAES128,g_key);
+	CTRMode ctr(atAES128,g_key);
+	BulkECBEncrypt ecbEncrypt(bulk,&ecb);
+	BulkCTRCrypt ctrCrypt(bulk,&ctr);
+	XTSMode xts(g_key,g_key2);
+	BulkXTSCrypt xtsCrypt(bulk,&xts);
+	// PMAC splits large messages over threads itself
+	AES128_PMAC pmac(g_key2);
+	pmac.setThreads(bulk->threads());
+	PMACTag pmacTag(&pmac);
+	char algorithm[32];
+	snprintf(algorithm,sizeof(algorithm),"AES128-x%d",bulk->threads());
+
+	for ( unsigned int size=BULK_MIN_SHARD_BYTES*4; size<=maxSize; size*=4 )
+	{
+		bench("bulk_ecb",algorithm,&ecbEncrypt,buffer,size);
+		bench("bulk_ctr",algorithm,&ctrCrypt,buffer,size);
+		bench("bulk_xts",algorithm,&xtsCrypt,buffer,size);
+		bench("bulk_pmac",algorithm,&pmacTag,buffer,size);
+	}
+}
+
+void benchMACs(unsigned char *buffer, unsigned char *record, unsigned int maxSize)
+{
+	AES128_CMAC cmac(g_key2);
+	AES128CBC_CMAC_EtM etm(g_key,g_key2);
+	AES128_GCM gcm(g_key);
+	AES128_PMAC pmac(g_key2);
+	CMACTag cmacTag(&cmac);
+	PMACTag pmacTag(&pmac);
+	CMACVerify cmacVerify(&cmac,false), cmacVerifyBatch(&cmac,true);
+	EtMEncrypt etmEncrypt(&etm);
+	EtMDecrypt etmDecrypt(&etm,record);
+	GCMEncrypt gcmEncrypt(&gcm);
+	GCMDecrypt gcmDecrypt(&gcm,record);
+
+	for ( unsigned int size=BENCH_MIN_SIZE; size<=maxSize; size*=4 )
+	{
+		bench("cmac","AES128",&cmacTag,buffer,size);
+		bench("pmac","AES128",&pmacTag,buffer,size);
+		if ( size>=BENCH_FRAME_BYTES )
+		{
+			bench("cmac_verify","AES128",&cmacVerify,buffer,size);
+			bench("cmac_batch","AES128",&cmacVerifyBatch,buffer,size);
+		}
+
+		memset(record,0x5a,size);
+		etm.encryptAndTag(record,size,g_IV);
+		bench("etm_encrypt","AES128",&etmEncrypt,buffer,size);
+		bench("etm_decrypt","AES128",&etmDecrypt,buffer,size);
+
+		memset(record,0x5a,size);
+		gcm.encryptAndTag(record,size,g_IV,GCM_IV_BYTES,NULL,0,record+size);
+		bench("gcm_encrypt","AES128",&gcmEncrypt,buffer,size);
+		bench("gcm_decrypt","AES128",&gcmDecrypt,buffer,size);
+	}
+}
+
+/**
+ *  Pin the process to one CPU so the frequency and cache state do not change under a run.
+ */
+int pinCPU(int cpu)
+{
+#if defined(__linux__)
+	if ( cpu<0 )
+		cpu = sched_getcpu();
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu,&set);
+	if ( sched_setaffinity(0,sizeof(set),&set)!=0 )
+		return -1;
+	return cpu;
+#else
+	return -1;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int maxSize = BENCH_MAX_SIZE;
+	int cpu = -1;
+	int threads = 0;
+	for ( int i=1; i<argc; i++ )
+	{
+		if ( strcmp(argv[i],"--json")==0 )
+			g_json = true;
+		else if ( strcmp(argv[i],"--quick")==0 )
+			maxSize = BENCH_QUICK_SIZE;
+		else if ( strcmp(argv[i],"--cpu")==0 && i+1<argc )
+			cpu = atoi(argv[++i]);
+		else if ( strcmp(argv[i],"--threads")==0 && i+1<argc )
+			threads = atoi(argv[++i]);
+		else if ( strcmp(argv[i],"--filter")==0 && i+1<argc )
+			g_filter = argv[++i];
+		else
+		{
+			fprintf(stderr,"Usage: %s [--json] [--quick] [--cpu N] [--threads N] [--filter TEXT]\n",argv[0]);
+			return 1;
+		}
+	}
+	BulkEngine bulk(threads);
+	cpu = pinCPU(cpu);
+
+	// One block of slack for the EtM and GCM tags; touch every page before timing
+	unsigned char *buffer = (unsigned char *)malloc(maxSize+AES128_BLOCK_BYTES);
+	unsigned char *record = (unsigned char *)malloc(maxSize+AES128_BLOCK_BYTES);
+	if ( buffer==NULL || record==NULL )
+	{
+		fprintf(stderr,"Out of memory\n");
+		return 1;
+	}
+	memset(buffer,0xa5,maxSize+AES128_BLOCK_BYTES);
+	memset(record,0x5a,maxSize+AES128_BLOCK_BYTES);
+
+	AES128 aesni(g_key), tables(g_key), bitsliced(g_key);
+	XTEA xtea(g_key), xteaScalar(g_key);
+	xteaScalar.enableSIMD(false);
+	tables.enableAESNI(false);
+	tables.setConstantTime(false);
+	bitsliced.enableAESNI(false);
+	bool ct = bitsliced.setConstantTime(true);
+
+	if ( g_json )
+		printf("{\n  \"cpu\": %d,\n  \"aesni\": %s,\n  \"tsc\": %s,\n  \"results\": [",
+			cpu,aesni.usesAESNI() ? "true" : "false",cycles()!=0 ? "true" : "false");
+	else
+		printf("ACrypto benchmark, pinned to CPU %d, AES-NI %s\n\n",cpu,aesni.usesAESNI() ? "on" : "off");
+
+	if ( aesni.usesAESNI() )
+		benchCipher("AES128-NI",&aesni,buffer);
+	benchCipher("AES128-PORTABLE",&tables,buffer);
+	if ( ct )
+		benchCipher("AES128-CT",&bitsliced,buffer);
+	if ( xtea.usesSIMD() )
+		benchCipher("XTEA-SIMD",&xtea,buffer);
+	benchCipher("XTEA",&xteaScalar,buffer);
+	benchOneShot(buffer);
+
+	benchModes("AES128",atAES128,buffer,maxSize);
+	benchModes("XTEA",atXTEA,buffer,maxSize);
+	benchTemplateModes<AES128>("AES128",buffer,maxSize);
+	benchTemplateModes<XTEA>("XTEA",buffer,maxSize);
+	benchXTS(buffer,maxSize);
+	benchMACs(buffer,record,maxSize);
+	benchBulk(&bulk,buffer,maxSize);
+
+	if ( g_json )
+		printf("\n  ]\n}\n");
+
+	free(buffer);
+	free(record);
+	return 0;
+}
@@ -98,6 +98,120 @@ void AES_FIPS_Test()
     printf("AES-FIPS: FAILED DECRYPT\n\n");
 }
 
+/**
+ *  AES-128 backend test.
+ *
+ *  Runs the FIPS-197 vector through the portable code and, where the CPU supports it, the
+ *  AES-NI backend.
+ */
+void AES_Backend_Test()
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c}; // FIPS key
+  unsigned char plainRef[] = {0x32,0x43,0xf6,0xa8,0x88,0x5a,0x30,0x8d,0x31,0x31,0x98,0xa2,0xe0,0x37,0x07,0x34};
+  unsigned char cryptoRef[] = {0x39,0x25,0x84,0x1d,0x02,0xdc,0x09,0xfb,0xdc,0x11,0x85,0x97,0x19,0x6a,0x0b,0x32};
+  unsigned char text[16];
+
+  printf("AES Backend Test\n");
+
+  AES128 aes(key);
+  for ( int hw=0; hw<2; hw++ )
+  {
+    if ( aes.enableAESNI(hw==1)!=(hw==1) )
+    {
+      printf("AES-BACKEND: AES-NI not available, skipped\n\n");
+      break;
+    }
+    const char *name = hw ? "AES-NI" : "PORTABLE";
+
+    memcpy(text,plainRef,16);
+    aes.encrypt(text);
+    if ( memcmp(text,cryptoRef,16)==0 )
+      printf("AES-BACKEND: PASSED %s ENCRYPT\n",name);
+    else
+      printf("AES-BACKEND: FAILED %s ENCRYPT\n",name);
+
+    aes.decrypt(text);
+    if ( memcmp(text,plainRef,16)==0 )
+      printf("AES-BACKEND: PASSED %s DECRYPT\n\n",name);
+    else
+      printf("AES-BACKEND: FAILED %s DECRYPT\n\n",name);
+  }
+}
+
+/**
+ *  AES-128 bitsliced engine test.
+ *
+ *  Runs the NIST 800-38A ECB vectors through the multi-block API with the portable code,
+ *  which uses the constant-time bitsliced engine, and the FIPS-197 vector through the
+ *  single block API in constant-time mode.
+ */
+void AES_Bitsliced_Test()
+{
+  unsigned char text[] = {0x6b,0xc1,0xbe,0xe2,0x2e,0x40,0x9f,0x96,0xe9,0x3d,0x7e,0x11,0x73,0x93,0x17,0x2a,
+                          0xae,0x2d,0x8a,0x57,0x1e,0x03,0xac,0x9c,0x9e,0xb7,0x6f,0xac,0x45,0xaf,0x8e,0x51,
+                          0x30,0xc8,0x1c,0x46,0xa3,0x5c,0xe4,0x11,0xe5,0xfb,0xc1,0x19,0x1a,0x0a,0x52,0xef,
+                          0xf6,0x9f,0x24,0x45,0xdf,0x4f,0x9b,0x17,0xad,0x2b,0x41,0x7b,0xe6,0x6c,0x37,0x10};
+  unsigned char key[] =  {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char cryptoRef[] = {0x3a,0xd7,0x7b,0xb4,0x0d,0x7a,0x36,0x60,0xa8,0x9e,0xca,0xf3,0x24,0x66,0xef,0x97,
+                               0xf5,0xd3,0xd5,0x85,0x03,0xb9,0x69,0x9d,0xe7,0x85,0x89,0x5a,0x96,0xfd,0xba,0xaf,
+                               0x43,0xb1,0xcd,0x7f,0x59,0x8e,0xce,0x23,0x88,0x1b,0x00,0xe3,0xed,0x03,0x06,0x88,
+                               0x7b,0x0c,0x78,0x5e,0x27,0xe8,0xad,0x3f,0x82,0x23,0x20,0x71,0x04,0x72,0x5d,0xd4};
+  unsigned char fipsPlain[] = {0x32,0x43,0xf6,0xa8,0x88,0x5a,0x30,0x8d,0x31,0x31,0x98,0xa2,0xe0,0x37,0x07,0x34};
+  unsigned char fipsRef[] = {0x39,0x25,0x84,0x1d,0x02,0xdc,0x09,0xfb,0xdc,0x11,0x85,0x97,0x19,0x6a,0x0b,0x32};
+  unsigned char buf[128];
+
+  printf("AES Bitsliced Test\n");
+
+  AES128 aes(key);
+  aes.enableAESNI(false);
+  // A short batch goes through the bitsliced engine in constant-time mode and through the
+  // table engine otherwise
+  if ( aes.setConstantTime(true) )
+  {
+    aes.encryptBlocks(text,buf,2);
+    aes.setConstantTime(false);
+    memcpy(buf+32,text,32);
+    aes.encryptBlocks(buf+32,buf+32,2);
+    aes.setConstantTime(true);
+    if ( memcmp(buf,cryptoRef,32)==0 && memcmp(buf+32,cryptoRef,32)==0 )
+      printf("AES-BITSLICED: PASSED SHORT BATCH\n");
+    else
+      printf("AES-BITSLICED: FAILED SHORT BATCH\n");
+  }
+
+  // Eight blocks: the four vectors twice over, so both groups of the engine are used
+  memcpy(buf,text,64);
+  memcpy(buf+64,text,64);
+  aes.encryptBlocks(buf,buf,8);
+  if ( memcmp(buf,cryptoRef,64)==0 && memcmp(buf+64,cryptoRef,64)==0 )
+    printf("AES-BITSLICED: PASSED ENCRYPT\n");
+  else
+    printf("AES-BITSLICED: FAILED ENCRYPT\n");
+
+  aes.decryptBlocks(cryptoRef,buf,4);
+  if ( memcmp(buf,text,64)==0 )
+    printf("AES-BITSLICED: PASSED DECRYPT\n");
+  else
+    printf("AES-BITSLICED: FAILED DECRYPT\n");
+
+  if ( !aes.setConstantTime(true) )
+  {
+    printf("AES-BITSLICED: constant-time mode not available, skipped\n\n");
+    return;
+  }
+  memcpy(buf,fipsPlain,16);
+  aes.encrypt(buf);
+  if ( memcmp(buf,fipsRef,16)==0 )
+    printf("AES-BITSLICED: PASSED CONSTANT-TIME ENCRYPT\n");
+  else
+    printf("AES-BITSLICED: FAILED CONSTANT-TIME ENCRYPT\n");
+  aes.decrypt(buf);
+  if ( memcmp(buf,fipsPlain,16)==0 )
+    printf("AES-BITSLICED: PASSED CONSTANT-TIME DECRYPT\n\n");
+  else
+    printf("AES-BITSLICED: FAILED CONSTANT-TIME DECRYPT\n\n");
+}
+
 /**
  *  AES-128 ECB test
  *
@@ -185,6 +299,827 @@ void AES_CBC_Test()
     printf("AES-CBC: FAILED DECRYPT\n\n");
 }
 
+/**
+ *  CBC decryption of a large buffer
+ *
+ *  Decryption runs in chunks through the multi-block API, and over several threads when the
+ *  library is built with ACRYPTO_THREADS. The result must match a block-at-a-time reference.
+ */
+void CBC_Large_Decrypt_Test(const char *name, AlgorithmType type, int threads)
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char IV[] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+  const unsigned int length = 4*CBC_PARALLEL_MIN_BYTES+3*16; // Not a multiple of the segments
+
+  unsigned char *original = (unsigned char *)malloc(length);
+  unsigned char *buf = (unsigned char *)malloc(length);
+  for ( unsigned int i=0; i<length; i++ )
+    original[i] = (unsigned char)(i*31+(i>>8));
+  memcpy(buf,original,length);
+
+  CBCMode cbc(type,key);
+  cbc.setThreads(threads);
+  cbc.encrypt(buf,length,IV);
+
+  // Reference: one block at a time
+  ECBMode ecb(type,key);
+  unsigned char *ref = (unsigned char *)malloc(length);
+  memcpy(ref,buf,length);
+  int bl = (type==atAES128) ? 16 : 8;
+  ecb.decrypt(ref,length);
+  for ( unsigned int i=0; i<length; i++ )
+    ref[i] ^= (i<(unsigned int)bl) ? IV[i] : buf[i-bl];
+
+  cbc.decrypt(buf,length,IV);
+  if ( memcmp(buf,original,length)==0 && memcmp(ref,original,length)==0 )
+    printf("%s CBC LARGE (%d threads): PASSED DECRYPT\n\n",name,threads);
+  else
+    printf("%s CBC LARGE (%d threads): FAILED DECRYPT\n\n",name,threads);
+
+  free(ref);
+  free(buf);
+  free(original);
+}
+
+/**
+ *  Batch CBC encryption
+ *
+ *  Messages of different lengths are encrypted as a batch and must come out as if each had
+ *  been encrypted separately. More messages than lanes makes the lanes refill.
+ */
+void CBC_Batch_Encrypt_Test(const char *name, AlgorithmType type)
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  const int count = 13;
+  CBCJob jobs[count];
+  unsigned char *ref[count];
+  unsigned char IV[count][16];
+
+  CBCMode cbc(type,key);
+  for ( int j=0; j<count; j++ )
+  {
+    jobs[j].length = 16*((j*5)%7);   // 0 to 96 bytes
+    jobs[j].message = (unsigned char *)malloc(jobs[j].length+16);
+    ref[j] = (unsigned char *)malloc(jobs[j].length+16);
+    for ( unsigned int i=0; i<jobs[j].length; i++ )
+      jobs[j].message[i] = (unsigned char)(i+j*17);
+    for ( int i=0; i<16; i++ )
+      IV[j][i] = (unsigned char)(i*j);
+    jobs[j].IV = IV[j];
+    memcpy(ref[j],jobs[j].message,jobs[j].length);
+    cbc.encrypt(ref[j],jobs[j].length,IV[j]);
+  }
+
+  cbc.encryptBatch(jobs,count);
+
+  bool ok = true;
+  for ( int j=0; j<count; j++ )
+  {
+    if ( memcmp(jobs[j].message,ref[j],jobs[j].length)!=0 )
+      ok = false;
+    free(jobs[j].message);
+    free(ref[j]);
+  }
+  if ( ok )
+    printf("%s CBC BATCH: PASSED ENCRYPT\n\n",name);
+  else
+    printf("%s CBC BATCH: FAILED ENCRYPT\n\n",name);
+}
+
+/**
+ *  AES CTR test
+ *
+ *  NIST SP 800-38A, F.5.1 CTR-AES128.Encrypt, cut to 60 bytes to end in a partial block. The
+ *  keystream is also applied piecewise at odd offsets, and with XTEA, to exercise seeking.
+ */
+void AES_CTR_Test()
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char IV[] = {0xf0,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa,0xfb,0xfc,0xfd,0xfe,0xff};
+  unsigned char plain[] = {0x6b,0xc1,0xbe,0xe2,0x2e,0x40,0x9f,0x96,0xe9,0x3d,0x7e,0x11,0x73,0x93,0x17,0x2a,
+                           0xae,0x2d,0x8a,0x57,0x1e,0x03,0xac,0x9c,0x9e,0xb7,0x6f,0xac,0x45,0xaf,0x8e,0x51,
+                           0x30,0xc8,0x1c,0x46,0xa3,0x5c,0xe4,0x11,0xe5,0xfb,0xc1,0x19,0x1a,0x0a,0x52,0xef,
+                           0xf6,0x9f,0x24,0x45,0xdf,0x4f,0x9b,0x17,0xad,0x2b,0x41,0x7b,0xe6,0x6c,0x37,0x10};
+  unsigned char cipher[] = {0x87,0x4d,0x61,0x91,0xb6,0x20,0xe3,0x26,0x1b,0xef,0x68,0x64,0x99,0x0d,0xb6,0xce,
+                            0x98,0x06,0xf6,0x6b,0x79,0x70,0xfd,0xff,0x86,0x17,0x18,0x7b,0xb9,0xff,0xfd,0xff,
+                            0x5a,0xe4,0xdf,0x3e,0xdb,0xd5,0xd3,0x5e,0x5b,0x4f,0x09,0x02,0x0d,0xb0,0x3e,0xab,
+                            0x1e,0x03,0x1d,0xda,0x2f,0xbe,0x03,0xd1,0x79,0x21,0x70,0xa0,0xf3,0x00,0x9c,0xee};
+  const unsigned int length = 60;
+  unsigned char buffer[64];
+
+  CTRMode ctr(atAES128,key);
+  memcpy(buffer,plain,length);
+  ctr.encrypt(buffer,length,IV);
+  if ( memcmp(buffer,cipher,length)==0 )
+    printf("AES128 CTR: PASSED ENCRYPT\n");
+  else
+    printf("AES128 CTR: FAILED ENCRYPT\n");
+
+  // Decrypt in pieces which straddle block boundaries
+  ctr.decrypt(buffer+37,length-37,IV,37);
+  ctr.decrypt(buffer,5,IV);
+  ctr.decrypt(buffer+5,32,IV,5);
+  if ( memcmp(buffer,plain,length)==0 )
+    printf("AES128 CTR: PASSED SEEK\n");
+  else
+    printf("AES128 CTR: FAILED SEEK\n");
+
+  // Seeking past the end of a 64 bit block must carry through the whole XTEA counter
+  unsigned char xteaIV[] = {0x00,0x00,0x00,0xff,0xff,0xff,0xff,0xfe};
+  unsigned char whole[200], part[200];
+  CTRMode xctr(atXTEA,key);
+  for ( int i=0; i<200; i++ )
+    whole[i] = (unsigned char)i;
+  memcpy(part,whole,200);
+  xctr.encrypt(whole,200,xteaIV,0x7fffffff0ULL);
+  xctr.encrypt(part,77,xteaIV,0x7fffffff0ULL);
+  xctr.encrypt(part+77,123,xteaIV,0x7fffffff0ULL+77);
+  if ( memcmp(whole,part,200)==0 )
+    printf("XTEA CTR: PASSED SEEK\n\n");
+  else
+    printf("XTEA CTR: FAILED SEEK\n\n");
+}
+
+/**
+ *  XTS test
+ *
+ *  IEEE 1619-2007 vectors 1 to 4 (the first 32 bytes of vector 4) and 15 to 18, which end in
+ *  ciphertext stealing. Then sector batches of 512 and 4096 bytes, and of 520 bytes which
+ *  steal in every sector, against one sector at a time, in place and out of place, and over
+ *  BulkEngine.
+ */
+void AES_XTS_Test()
+{
+  unsigned char K1[16], K2[16], buf[512], out[512];
+  unsigned char ct1[] =
+    {0x91,0x7c,0xf6,0x9e,0xbd,0x68,0xb2,0xec,0x9b,0x9f,0xe9,0xa3,0xea,0xdd,0xa6,0x92,
+     0xcd,0x43,0xd2,0xf5,0x95,0x98,0xed,0x85,0x8c,0x02,0xc2,0x65,0x2f,0xbf,0x92,0x2e};
+  unsigned char ct2[] =
+    {0xc4,0x54,0x18,0x5e,0x6a,0x16,0x93,0x6e,0x39,0x33,0x40,0x38,0xac,0xef,0x83,0x8b,
+     0xfb,0x18,0x6f,0xff,0x74,0x80,0xad,0xc4,0x28,0x93,0x82,0xec,0xd6,0xd3,0x94,0xf0};
+  unsigned char ct3[] =
+    {0xaf,0x85,0x33,0x6b,0x59,0x7a,0xfc,0x1a,0x90,0x0b,0x2e,0xb2,0x1e,0xc9,0x49,0xd2,
+     0x92,0xdf,0x4c,0x04,0x7e,0x0b,0x21,0x53,0x21,0x86,0xa5,0x97,0x1a,0x22,0x7a,0x89};
+  unsigned char ct4[] =
+    {0x27,0xa7,0x47,0x9b,0xef,0xa1,0xd4,0x76,0x48,0x9f,0x30,0x8c,0xd4,0xcf,0xa6,0xe2,
+     0xa9,0x6e,0x4b,0xbe,0x32,0x08,0xff,0x25,0x28,0x7d,0xd3,0x81,0x96,0x16,0xe8,0x9c};
+  unsigned char key4a[] = {0x27,0x18,0x28,0x18,0x28,0x45,0x90,0x45,0x23,0x53,0x60,0x28,0x74,0x71,0x35,0x26};
+  unsigned char key4b[] = {0x31,0x41,0x59,0x26,0x53,0x58,0x97,0x93,0x23,0x84,0x62,0x64,0x33,0x83,0x27,0x95};
+  unsigned char ct18[] =
+    {0x9d,0x84,0xc8,0x13,0xf7,0x19,0xaa,0x2c,0x7b,0xe3,0xf6,0x61,0x71,0xc7,0xc5,0xc2,
+     0xed,0xbf,0x9d,0xac};
+  unsigned char ct15[] = {0x6c,0x16,0x25,0xdb,0x46,0x71,0x52,0x2d,0x3d,0x75,0x99,0x60,0x1d,0xe7,0xca,0x09,0xed};
+  bool ok = true;
+
+  memset(K1,0,16);
+  memset(K2,0,16);
+  XTSMode xts1(K1,K2);
+  memset(buf,0,32);
+  xts1.encrypt(buf,32,0);
+  ok = ok && memcmp(buf,ct1,32)==0;
+  xts1.decrypt(buf,32,0);
+  for ( int i=0; i<32; i++ )
+    ok = ok && buf[i]==0;
+
+  memset(K1,0x11,16);
+  memset(K2,0x22,16);
+  XTSMode xts2(K1,K2);
+  memset(buf,0x44,32);
+  xts2.encrypt(buf,32,0x3333333333ULL);
+  ok = ok && memcmp(buf,ct2,32)==0;
+
+  for ( int i=0; i<16; i++ )
+    K1[i] = (unsigned char)(0xff-i);
+  xts2.rekey(K1,K2);
+  memset(buf,0x44,32);
+  xts2.encrypt(buf,32,0x3333333333ULL);
+  ok = ok && memcmp(buf,ct3,32)==0;
+
+  XTSMode xts4(key4a,key4b);
+  for ( int i=0; i<512; i++ )
+    buf[i] = (unsigned char)i;
+  xts4.encrypt(buf,512,0);
+  ok = ok && memcmp(buf,ct4,32)==0;
+  xts4.decrypt(buf,512,0);
+  for ( int i=0; i<512; i++ )
+    ok = ok && buf[i]==(unsigned char)i;
+
+  // Vectors 15 to 18: the same message of 17 to 20 bytes, so each ciphertext extends the last
+  for ( int i=0; i<16; i++ )
+  {
+    K1[i] = (unsigned char)(0xff-i);
+    K2[i] = (unsigned char)(0xbf-i);
+  }
+  XTSMode xts15(K1,K2);
+  for ( unsigned int length=17; length<=20; length++ )
+  {
+    for ( unsigned int i=0; i<length; i++ )
+      buf[i] = (unsigned char)i;
+    xts15.encrypt(buf,length,out,0x123456789aULL);
+    ok = ok && memcmp(out+16,ct18+16,length-16)==0;
+    if ( length==17 )
+      ok = ok && memcmp(out,ct15,17)==0;
+    if ( length==20 )
+      ok = ok && memcmp(out,ct18,20)==0;
+    xts15.decrypt(out,length,buf,0x123456789aULL);
+    for ( unsigned int i=0; i<length; i++ )
+      ok = ok && buf[i]==(unsigned char)i;
+  }
+  // Sectors shorter than a block are refused and left alone
+  memcpy(out,buf,15);
+  ok = ok && !xts15.encrypt(out,15,0) && memcmp(out,buf,15)==0;
+  ok = ok && !xts15.encryptSectors(out,15,1,0) && memcmp(out,buf,15)==0;
+  printf("XTS VECTORS: %s\n",ok ? "PASSED" : "FAILED");
+
+  // Sector batches against single sectors, and BulkEngine
+  unsigned int sectorLengths[] = {512,4096,520};
+  BulkEngine bulk(4);
+  bool batchOk = true;
+  for ( int v=0; v<3; v++ )
+  {
+    unsigned int sectorLength = sectorLengths[v], count = 37, length = count*sectorLength;
+    unsigned char *a = (unsigned char *)malloc(length);
+    unsigned char *b = (unsigned char *)malloc(length);
+    unsigned char *c = (unsigned char *)malloc(length);
+    for ( unsigned int i=0; i<length; i++ )
+      a[i] = b[i] = c[i] = (unsigned char)(i*13+i/509);
+
+    xts4.encryptSectors(a,sectorLength,count,1000);
+    for ( unsigned int s=0; s<count; s++ )
+      xts4.encrypt(b+s*sectorLength,sectorLength,c+s*sectorLength,1000+s);
+    batchOk = batchOk && memcmp(a,c,length)==0;
+    batchOk = batchOk && bulk.xtsEncrypt(&xts4,b,sectorLength,count,1000);
+    batchOk = batchOk && memcmp(a,b,length)==0;
+
+    // Random access: one sector rewritten on its own decrypts with the rest
+    xts4.decrypt(a+5*sectorLength,sectorLength,5+1000);
+    memset(a+5*sectorLength,0x77,sectorLength);
+    xts4.encrypt(a+5*sectorLength,sectorLength,5+1000);
+    bulk.xtsDecrypt(&xts4,a,sectorLength,count,1000);
+    xts4.decryptSectors(b,sectorLength,count,1000);
+    for ( unsigned int i=0; i<length; i++ )
+    {
+      unsigned char expected = (i/sectorLength==5) ? 0x77 : (unsigned char)(i*13+i/509);
+      if ( a[i]!=expected || (i/sectorLength!=5 && b[i]!=expected) )
+        batchOk = false;
+    }
+    free(a);
+    free(b);
+    free(c);
+  }
+  batchOk = batchOk && !bulk.xtsEncrypt(&xts4,buf,8,2,0);
+  printf("XTS SECTORS: %s\n\n",batchOk ? "PASSED" : "FAILED");
+}
+
+/**
+ *  AES GCM test
+ *
+ *  Test cases 1-4 from McGrew and Viega, "The Galois/Counter Mode of Operation (GCM)", run
+ *  with both GHASH implementations. A tampered tag must fail and leave the ciphertext intact.
+ */
+void AES_GCM_Test()
+{
+  unsigned char zeroKey[16], zeroIV[12], zero[16];
+  memset(zeroKey,0,16); memset(zeroIV,0,12); memset(zero,0,16);
+  unsigned char key[] = {0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08};
+  unsigned char IV[] = {0xca,0xfe,0xba,0xbe,0xfa,0xce,0xdb,0xad,0xde,0xca,0xf8,0x88};
+  unsigned char aad[] = {0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,
+                         0xab,0xad,0xda,0xd2};
+  unsigned char plain[] = {0xd9,0x31,0x32,0x25,0xf8,0x84,0x06,0xe5,0xa5,0x59,0x09,0xc5,0xaf,0xf5,0x26,0x9a,
+                           0x86,0xa7,0xa9,0x53,0x15,0x34,0xf7,0xda,0x2e,0x4c,0x30,0x3d,0x8a,0x31,0x8a,0x72,
+                           0x1c,0x3c,0x0c,0x95,0x95,0x68,0x09,0x53,0x2f,0xcf,0x0e,0x24,0x49,0xa6,0xb5,0x25,
+                           0xb1,0x6a,0xed,0xf5,0xaa,0x0d,0xe6,0x57,0xba,0x63,0x7b,0x39,0x1a,0xaf,0xd2,0x55};
+  unsigned char cipher[] = {0x42,0x83,0x1e,0xc2,0x21,0x77,0x74,0x24,0x4b,0x72,0x21,0xb7,0x84,0xd0,0xd4,0x9c,
+                            0xe3,0xaa,0x21,0x2f,0x2c,0x02,0xa4,0xe0,0x35,0xc1,0x7e,0x23,0x29,0xac,0xa1,0x2e,
+                            0x21,0xd5,0x14,0xb2,0x54,0x66,0x93,0x1c,0x7d,0x8f,0x6a,0x5a,0xac,0x84,0xaa,0x05,
+                            0x1b,0xa3,0x0b,0x39,0x6a,0x0a,0xac,0x97,0x3d,0x58,0xe0,0x91,0x47,0x3f,0x59,0x85};
+  unsigned char cipher2[] = {0x03,0x88,0xda,0xce,0x60,0xb6,0xa3,0x92,0xf3,0x28,0xc2,0xb9,0x71,0xb2,0xfe,0x78};
+  unsigned char tag1[] = {0x58,0xe2,0xfc,0xce,0xfa,0x7e,0x30,0x61,0x36,0x7f,0x1d,0x57,0xa4,0xe7,0x45,0x5a};
+  unsigned char tag2[] = {0xab,0x6e,0x47,0xd4,0x2c,0xec,0x13,0xbd,0xf5,0x3a,0x67,0xb2,0x12,0x57,0xbd,0xdf};
+  unsigned char tag3[] = {0x4d,0x5c,0x2a,0xf3,0x27,0xcd,0x64,0xa6,0x2c,0xf3,0x5a,0xbd,0x2b,0xa6,0xfa,0xb4};
+  unsigned char tag4[] = {0x5b,0xc9,0x4f,0xbc,0x32,0x21,0xa5,0xdb,0x94,0xfa,0xe9,0x5a,0xe7,0x12,0x1a,0x47};
+  unsigned char buffer[64], tag[16];
+
+  AES128_GCM gcm0(zeroKey), gcm(key);
+  for ( int pass=0; pass<2; pass++ )
+  {
+    const char *name = gcm.enableCLMUL(pass==0) ? "CLMUL" : "TABLE";
+    gcm0.enableCLMUL(pass==0);
+    bool ok = true;
+
+    gcm0.encryptAndTag(buffer,0,zeroIV,12,NULL,0,tag);
+    ok = ok && memcmp(tag,tag1,16)==0;
+
+    memcpy(buffer,zero,16);
+    gcm0.encryptAndTag(buffer,16,zeroIV,12,NULL,0,tag);
+    ok = ok && memcmp(buffer,cipher2,16)==0 && memcmp(tag,tag2,16)==0;
+
+    memcpy(buffer,plain,64);
+    gcm.encryptAndTag(buffer,64,IV,12,NULL,0,tag);
+    ok = ok && memcmp(buffer,cipher,64)==0 && memcmp(tag,tag3,16)==0;
+    ok = ok && gcm.decryptAndVerify(buffer,64,IV,12,NULL,0,tag) && memcmp(buffer,plain,64)==0;
+
+    memcpy(buffer,plain,60);
+    gcm.encryptAndTag(buffer,60,IV,12,aad,20,tag);
+    ok = ok && memcmp(buffer,cipher,60)==0 && memcmp(tag,tag4,16)==0;
+    tag[15] ^= 1;
+    ok = ok && !gcm.decryptAndVerify(buffer,60,IV,12,aad,20,tag) && memcmp(buffer,cipher,60)==0;
+    tag[15] ^= 1;
+    ok = ok && gcm.decryptAndVerify(buffer,60,IV,12,aad,20,tag) && memcmp(buffer,plain,60)==0;
+
+    if ( ok )
+      printf("AES128 GCM %s: PASSED\n",name);
+    else
+      printf("AES128 GCM %s: FAILED\n",name);
+  }
+
+  // Both GHASH implementations must agree on long messages and odd IV lengths
+  unsigned char *a = (unsigned char *)malloc(1000), *b = (unsigned char *)malloc(1000);
+  unsigned char tagA[16], tagB[16];
+  for ( int i=0; i<1000; i++ )
+    a[i] = b[i] = (unsigned char)(i*7);
+  gcm.enableCLMUL(true);
+  gcm.encryptAndTag(a,999,plain,60,aad,20,tagA);
+  gcm.enableCLMUL(false);
+  gcm.encryptAndTag(b,999,plain,60,aad,20,tagB);
+  if ( memcmp(a,b,999)==0 && memcmp(tagA,tagB,16)==0 && gcm.decryptAndVerify(b,999,plain,60,aad,20,tagA) )
+    printf("AES128 GCM: PASSED CROSS CHECK\n\n");
+  else
+    printf("AES128 GCM: FAILED CROSS CHECK\n\n");
+  free(a);
+  free(b);
+}
+
+/**
+ *  Bulk engine test
+ *
+ *  Sharded and batched work on a pool of four threads must give the same bytes as the mode
+ *  classes on one thread. Without ACRYPTO_THREADS the engine runs serially on one, which is
+ *  the count reported.
+ */
+void Bulk_Engine_Test()
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char IV[] = {0xf0,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa,0xfb,0xfc,0xfd,0xfe,0xff};
+  const unsigned int length = 1000003;
+  unsigned char *a = (unsigned char *)malloc(length+16);
+  unsigned char *b = (unsigned char *)malloc(length+16);
+  for ( unsigned int i=0; i<length; i++ )
+    a[i] = b[i] = (unsigned char)(i*31);
+
+  BulkEngine bulk(4);
+  ECBMode ecb(atAES128,key);
+  CTRMode ctr(atXTEA,key);
+  bool ok = true;
+
+  bulk.ecbEncrypt(&ecb,a,length);
+  ecb.encrypt(b,length-3);   // The serial reference on whole blocks, then the padded tail
+  memset(b+length,0,13);
+  ecb.encrypt(b+length-3,16);
+  ok = ok && memcmp(a,b,length+13)==0;
+  bulk.ecbDecrypt(&ecb,a,length+13);
+  ecb.decrypt(b,length+13);
+  ok = ok && memcmp(a,b,length)==0;
+  bulk.ctrCrypt(&ctr,a,length,IV,5);
+  ctr.encrypt(b,length,IV,5);
+  ok = ok && memcmp(a,b,length)==0;
+  if ( ok )
+    printf("BULK ENGINE: PASSED SHARDS (%d threads)\n",bulk.threads());
+  else
+    printf("BULK ENGINE: FAILED SHARDS (%d threads)\n",bulk.threads());
+  free(a);
+  free(b);
+
+  // Batches: 37 messages of 16 to 4096 bytes
+  const unsigned int count = 37;
+  CBCJob jobs[count], ref[count];
+  bool results[count];
+  CBCMode cbc(atAES128,key);
+  AES128CBC_CMAC_EtM etm(key,IV);
+  for ( unsigned int j=0; j<count; j++ )
+  {
+    unsigned int len = 16*(1+(j*37)%256);
+    jobs[j].message = (unsigned char *)malloc(len+16);
+    ref[j].message = (unsigned char *)malloc(len+16);
+    for ( unsigned int i=0; i<len; i++ )
+      jobs[j].message[i] = ref[j].message[i] = (unsigned char)(i+j);
+    jobs[j].length = ref[j].length = len;
+    jobs[j].IV = ref[j].IV = IV;
+  }
+  ok = true;
+  bulk.cbcEncryptBatch(&cbc,jobs,count);
+  for ( unsigned int j=0; j<count; j++ )
+  {
+    cbc.encrypt(ref[j].message,ref[j].length,IV);
+    ok = ok && memcmp(jobs[j].message,ref[j].message,ref[j].length)==0;
+  }
+  bulk.cbcDecryptBatch(&cbc,jobs,count);
+  bulk.etmEncryptBatch(&etm,jobs,count);
+  jobs[11].message[jobs[11].length] ^= 1;   // Break one tag
+  bulk.etmDecryptBatch(&etm,jobs,count,results);
+  for ( unsigned int j=0; j<count; j++ )
+  {
+    ok = ok && results[j]==(j!=11);
+    if ( j!=11 )
+      for ( unsigned int i=0; i<jobs[j].length; i++ )
+        ok = ok && jobs[j].message[i]==(unsigned char)(i+j);
+    free(jobs[j].message);
+    free(ref[j].message);
+  }
+  if ( ok )
+    printf("BULK ENGINE: PASSED BATCHES\n\n");
+  else
+    printf("BULK ENGINE: FAILED BATCHES\n\n");
+}
+
+/**
+ *  Padding test
+ *
+ *  Each padding type on every tail length, in place and out of place, must round trip and
+ *  never write past the padded length. Malformed padding must be rejected.
+ */
+void Padding_Test()
+{
+  PaddingType types[] = {ptZero,ptISO7816,ptPKCS7};
+  const char *names[] = {"ZERO","ISO7816","PKCS7"};
+  unsigned char in[48], out[64], inplace[64];
+  for ( int i=0; i<48; i++ )
+    in[i] = (unsigned char)(i+1);
+
+  for ( int t=0; t<3; t++ )
+  {
+    bool ok = true;
+    for ( unsigned int length=0; length<=32; length++ )
+    {
+      unsigned int padlen = CryptoModeBase::paddedLength(length,16,types[t]);
+      memset(out,0xee,64);
+      memset(inplace,0xee,64);
+      memcpy(inplace,in,length);
+      int n = CryptoModeBase::pad(in,length,out,64,16,types[t]);
+      int m = CryptoModeBase::pad(inplace,length,inplace,padlen,16,types[t]);
+      ok = ok && n==(int)padlen && m==(int)padlen && padlen%16==0 && padlen>=length;
+      ok = ok && memcmp(out,in,length)==0 && memcmp(out,inplace,64)==0 && out[padlen]==0xee;
+      if ( types[t]!=ptZero )
+        ok = ok && padlen>length && CryptoModeBase::unpaddedLength(out,padlen,16,types[t])==(int)length;
+      ok = ok && (padlen==0 || CryptoModeBase::pad(in,length,out,padlen-1,16,types[t])==-1);
+    }
+    if ( ok )
+      printf("PADDING %s: PASSED\n",names[t]);
+    else
+      printf("PADDING %s: FAILED\n",names[t]);
+  }
+
+  unsigned char bad1[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,3,2,3};
+  unsigned char bad2[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0x11};
+  unsigned char bad3[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0x80,0,1};
+  if ( CryptoModeBase::unpaddedLength(bad1,16,16,ptPKCS7)==-1 &&
+       CryptoModeBase::unpaddedLength(bad2,16,16,ptPKCS7)==-1 &&
+       CryptoModeBase::unpaddedLength(bad3,16,16,ptISO7816)==-1 &&
+       CryptoModeBase::unpaddedLength(bad2,15,16,ptPKCS7)==-1 )
+    printf("PADDING: PASSED MALFORMED\n");
+  else
+    printf("PADDING: FAILED MALFORMED\n");
+
+  // CBC with PKCS#7 on a stack buffer (the old padding reallocated it)
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char IV[16];
+  memset(IV,0,16);
+  CBCMode cbc(atAES128,key);
+  cbc.setPadding(ptPKCS7);
+  memcpy(inplace,in,32);
+  cbc.encrypt(inplace,32,IV);
+  cbc.decrypt(inplace,48,IV);
+  if ( memcmp(inplace,in,32)==0 && CryptoModeBase::unpaddedLength(inplace,48,16,ptPKCS7)==32 )
+    printf("PADDING: PASSED CBC PKCS7\n\n");
+  else
+    printf("PADDING: FAILED CBC PKCS7\n\n");
+}
+
+/**
+ *  Out-of-place test
+ *
+ *  The const in -> out variants must give the same bytes as the in-place calls and leave the
+ *  input untouched, including with non-temporal stores on a buffer large enough to use them.
+ */
+void OutOfPlace_Test()
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char key2[] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+  unsigned char IV[16];
+  unsigned int length = 512*1024 + 40;
+  unsigned char *in = new unsigned char[length+32];
+  unsigned char *copy = new unsigned char[length+32];
+  unsigned char *inplace = new unsigned char[length+32];
+  unsigned char *out = new unsigned char[length+32];
+  for ( unsigned int i=0; i<length+32; i++ )
+    in[i] = (unsigned char)(i*7+3);
+  memcpy(copy,in,length+32);
+  for ( int i=0; i<16; i++ )
+    IV[i] = (unsigned char)(0xf0+i);
+
+  for ( int nt=0; nt<2; nt++ )
+  {
+    const char *label = nt ? "NONTEMPORAL" : "REGULAR";
+    ECBMode ecb(atAES128,key);
+    CBCMode cbc(atAES128,key);
+    CTRMode ctr(atAES128,key);
+    ecb.setNonTemporal(nt!=0);
+    cbc.setNonTemporal(nt!=0);
+    ctr.setNonTemporal(nt!=0);
+    ecb.setPadding(ptPKCS7);
+    cbc.setPadding(ptPKCS7);
+    unsigned int padlen = CryptoModeBase::paddedLength(length,16,ptPKCS7);
+
+    memcpy(inplace,in,length);
+    ecb.encrypt(inplace,length);
+    bool ok = ecb.encrypt(in,length,out,length+32)==(int)padlen && memcmp(out,inplace,padlen)==0;
+    ok = ok && ecb.encrypt(in,length,out,padlen-1)==-1;
+    ecb.decrypt(inplace,padlen,out);
+    ok = ok && memcmp(out,in,length)==0 && memcmp(in,copy,length+32)==0;
+    printf("OUT-OF-PLACE ECB %s: %s\n",label,ok ? "PASSED" : "FAILED");
+
+    memcpy(inplace,in,length);
+    cbc.encrypt(inplace,length,IV);
+    ok = cbc.encrypt(in,length,out,length+32,IV)==(int)padlen && memcmp(out,inplace,padlen)==0;
+    ok = ok && cbc.encrypt(in,length,out,padlen-1,IV)==-1;
+    cbc.decrypt(inplace,padlen,out,IV);
+    ok = ok && memcmp(out,in,length)==0 && memcmp(in,copy,length+32)==0;
+    printf("OUT-OF-PLACE CBC %s: %s\n",label,ok ? "PASSED" : "FAILED");
+
+    memcpy(inplace,in,length);
+    ctr.encrypt(inplace,length,IV);
+    ctr.encrypt(in+3,length-3,out,IV,3);
+    ok = memcmp(out,inplace+3,length-3)==0;
+    ctr.decrypt(inplace,length,out,IV);
+    ok = ok && memcmp(out,in,length)==0 && memcmp(in,copy,length+32)==0;
+    printf("OUT-OF-PLACE CTR %s: %s\n",label,ok ? "PASSED" : "FAILED");
+  }
+
+  // EtM on whole blocks (fused) and on a partial block (two pass); the tag follows the data
+  AES128CBC_CMAC_EtM etm(key,key2);
+  bool ok = true;
+  unsigned int sizes[] = {16,160,4096,40};
+  for ( int s=0; s<4; s++ )
+  {
+    unsigned int n = sizes[s];
+    unsigned int room = n%16 ? n+16-n%16 : n;
+    memset(inplace,0,room+16);
+    memset(out,0,room+16);
+    memcpy(inplace,in,n);
+    etm.encryptAndTag(inplace,room,IV);
+    memcpy(copy,in,room);
+    memset(copy+n,0,room-n);
+    etm.encryptAndTag(copy,room,out,IV);
+    ok = ok && memcmp(out,inplace,room+16)==0;
+    ok = ok && etm.decryptAndVerify(out,room,copy,IV) && memcmp(copy,in,n)==0;
+    out[room] ^= 1;
+    ok = ok && !etm.decryptAndVerify(out,room,copy,IV) && copy[0]==0 && copy[room-1]==0;
+  }
+  printf("OUT-OF-PLACE EtM: %s\n",ok ? "PASSED" : "FAILED");
+
+  // GCM
+  AES128_GCM gcm(key);
+  unsigned char tag1[GCM_TAG_BYTES], tag2[GCM_TAG_BYTES];
+  memcpy(inplace,in,1000);
+  gcm.encryptAndTag(inplace,1000,IV,GCM_IV_BYTES,key2,16,tag1);
+  gcm.encryptAndTag(in,1000,out,IV,GCM_IV_BYTES,key2,16,tag2);
+  ok = memcmp(out,inplace,1000)==0 && memcmp(tag1,tag2,GCM_TAG_BYTES)==0;
+  ok = ok && gcm.decryptAndVerify(out,1000,copy,IV,GCM_IV_BYTES,key2,16,tag2) && memcmp(copy,in,1000)==0;
+  tag2[0] ^= 1;
+  ok = ok && !gcm.decryptAndVerify(out,1000,copy,IV,GCM_IV_BYTES,key2,16,tag2) && copy[0]==0 && copy[999]==0;
+  printf("OUT-OF-PLACE GCM: %s\n\n",ok ? "PASSED" : "FAILED");
+
+  delete [] in;
+  delete [] copy;
+  delete [] inplace;
+  delete [] out;
+}
+
+/**
+ *  Mode template test
+ *
+ *  ECBModeT and CBCModeT must give the same output as the runtime ECBMode and CBCMode for the
+ *  same cipher, in place and out of place, for whole and partial last blocks.
+ */
+template <class Cipher>
+void Mode_Template_Test(const char *name, AlgorithmType type)
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char IV[16];
+  unsigned char in[300], a[320], b[320], c[320];
+  for ( int i=0; i<300; i++ )
+    in[i] = (unsigned char)(i*13+5);
+  for ( int i=0; i<16; i++ )
+    IV[i] = (unsigned char)(0xa0+i);
+
+  ECBMode ecb(type,key);
+  ECBModeT<Cipher> ecbt(key);
+  CBCMode cbc(type,key);
+  CBCModeT<Cipher> cbct(key);
+  ecb.setPadding(ptPKCS7);
+  ecbt.setPadding(ptPKCS7);
+  cbc.setPadding(ptPKCS7);
+  cbct.setPadding(ptPKCS7);
+
+  bool ecbOk = true, cbcOk = true;
+  unsigned int lengths[] = {0,8,16,37,256,300};
+  for ( int l=0; l<6; l++ )
+  {
+    unsigned int n = lengths[l];
+    unsigned int padlen = CryptoModeBase::paddedLength(n,Cipher::BLOCK_BYTES,ptPKCS7);
+
+    memcpy(a,in,n);
+    ecb.encrypt(a,n);
+    memcpy(b,in,n);
+    ecbt.encrypt(b,n);
+    ecbOk = ecbOk && memcmp(a,b,padlen)==0;
+    ecbOk = ecbOk && ecbt.encrypt(in,n,c,sizeof(c))==(int)padlen && memcmp(a,c,padlen)==0;
+    ecbOk = ecbOk && ecbt.encrypt(in,n,c,padlen-1)==-1;
+    ecbt.decrypt(a,padlen,c);
+    ecbt.decrypt(b,padlen);
+    ecbOk = ecbOk && memcmp(b,in,n)==0 && memcmp(c,in,n)==0;
+
+    memcpy(a,in,n);
+    cbc.encrypt(a,n,IV);
+    memcpy(b,in,n);
+    cbct.encrypt(b,n,IV);
+    cbcOk = cbcOk && memcmp(a,b,padlen)==0;
+    cbcOk = cbcOk && cbct.encrypt(in,n,c,sizeof(c),IV)==(int)padlen && memcmp(a,c,padlen)==0;
+    cbct.decrypt(a,padlen,c,IV);
+    cbct.decrypt(b,padlen,IV);
+    cbcOk = cbcOk && memcmp(b,in,n)==0 && memcmp(c,in,n)==0;
+  }
+  printf("TEMPLATE ECB %s: %s\n",name,ecbOk ? "PASSED" : "FAILED");
+  printf("TEMPLATE CBC %s: %s\n\n",name,cbcOk ? "PASSED" : "FAILED");
+}
+
+/**
+ *  Arena test
+ *
+ *  Contexts placed in an arena, with their ciphers, must work as heap ones do, be aligned, and
+ *  be deleted without freeing arena memory. A full arena falls back to the heap. Rekeying
+ *  EtM must reuse its instances.
+ */
+void Arena_Test()
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char key2[] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+  unsigned char IV[16] = {0};
+  unsigned char a[80], b[80];
+  static unsigned char buffer[4096];
+  for ( int i=0; i<80; i++ )
+    a[i] = (unsigned char)i;
+  memcpy(b,a,80);
+
+  CryptoArena arena(buffer,sizeof(buffer));
+  CBCMode *inArena = new (&arena) CBCMode(atAES128,key,&arena);
+  CBCMode *onHeap = new CBCMode(atAES128,key);
+  bool ok = (unsigned char *)inArena>=buffer && (unsigned char *)inArena<buffer+sizeof(buffer);
+  ok = ok && (unsigned char *)inArena->algorithm()>=buffer && (unsigned char *)inArena->algorithm()<buffer+sizeof(buffer);
+  ok = ok && ((uintptr_t)inArena % CRYPTO_ALIGN)==0 && ((uintptr_t)inArena->algorithm() % CRYPTO_ALIGN)==0;
+  ok = ok && ((uintptr_t)onHeap->algorithm() % CRYPTO_ALIGN)==0;
+  ok = ok && inArena->valid() && onHeap->valid();
+  inArena->encrypt(a,80,IV);
+  onHeap->encrypt(b,80,IV);
+  ok = ok && memcmp(a,b,80)==0;
+  delete inArena;
+  delete onHeap;
+  size_t used = arena.used();
+  ok = ok && used>0 && arena.fallbacks()==0;
+
+  // Full: the contexts go to the heap, and are counted
+  CryptoArena full(buffer,sizeof(void *));
+  ECBMode *spill = new (&full) ECBMode(atXTEA,key,&full);
+  ok = ok && full.used()==0 && ((unsigned char *)spill<buffer || (unsigned char *)spill>=buffer+sizeof(buffer));
+  ok = ok && full.fallbacks()==2;
+  delete spill;
+
+  // EtM in the arena, rekeyed in place
+  arena.reset();
+  AES128CBC_CMAC_EtM *etm = new (&arena) AES128CBC_CMAC_EtM(key,key2,&arena);
+  used = arena.used();
+  ok = ok && etm->valid();
+  etm->rekey(key2,key);
+  AES128CBC_CMAC_EtM fresh(key2,key);
+  memset(a,0x5a,80);
+  memset(b,0x5a,80);
+  etm->encryptAndTag(a,64,IV);
+  fresh.encryptAndTag(b,64,IV);
+  ok = ok && memcmp(a,b,80)==0 && arena.used()==used;
+  delete etm;
+  printf("ARENA: %s\n\n",ok ? "PASSED" : "FAILED");
+}
+
+/**
+ *  Expanded key test
+ *
+ *  Instances running on a shared AES128Key must match instances keyed with the raw key, on
+ *  every engine. The cache must hand back the same key for an ID, evict the least recently used
+ *  one, and keep evicted keys alive while they are in use.
+ */
+void AES128Key_Test()
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char key2[] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+  unsigned char IV[16], a[160], b[176], c[176];
+  for ( int i=0; i<16; i++ )
+    IV[i] = (unsigned char)i;
+  for ( int i=0; i<160; i++ )
+    a[i] = (unsigned char)(i*13);
+
+  AES128Key *expanded = new AES128Key(key);
+  AES128Key expanded2(key2);
+  AES128 raw(key);
+  AES128 shared(expanded);
+  bool ok = true;
+  for ( int engine=0; engine<3; engine++ )
+  {
+    raw.enableAESNI(engine==0);
+    shared.enableAESNI(engine==0);
+    raw.setConstantTime(engine==2);
+    shared.setConstantTime(engine==2);
+    raw.encryptBlocks(a,b,10);
+    shared.encryptBlocks(a,c,10);
+    ok = ok && memcmp(b,c,160)==0;
+    raw.decrypt(b);
+    shared.decrypt(c);
+    ok = ok && memcmp(b,a,16)==0 && memcmp(c,a,16)==0;
+  }
+  if ( ok )
+    printf("AES128Key: PASSED ENGINES\n");
+  else
+    printf("AES128Key: FAILED ENGINES\n");
+
+  CBCMode cbcRaw(atAES128,key), cbcShared(expanded);
+  memcpy(b,a,160);
+  memcpy(c,a,160);
+  cbcRaw.encrypt(b,160,IV);
+  cbcShared.encrypt(c,160,IV);
+  ok = memcmp(b,c,160)==0;
+  CTRMode ctrRaw(atAES128,key2), ctrShared(expanded);
+  ok = ok && ctrShared.rekey(&expanded2);
+  ctrRaw.encrypt(b,160,IV);
+  ctrShared.encrypt(c,160,IV);
+  ok = ok && memcmp(b,c,160)==0;
+  // An expanded AES key is refused by an XTEA instance
+  ECBMode ecbXTEA(atXTEA,key);
+  ok = ok && !ecbXTEA.rekey(&expanded2);
+  AES128CBC_CMAC_EtM etmRaw(key,key2), etmShared(expanded,&expanded2);
+  memcpy(b,a,160);
+  memcpy(c,a,160);
+  etmRaw.encryptAndTag(b,160,IV);
+  etmShared.encryptAndTag(c,160,IV);
+  ok = ok && memcmp(b,c,176)==0;
+  AES128_GCM gcmRaw(key), gcmShared(expanded);
+  gcmRaw.encryptAndTag(a,160,b,IV,GCM_IV_BYTES,NULL,0,b+160);
+  gcmShared.encryptAndTag(a,160,c,IV,GCM_IV_BYTES,NULL,0,c+160);
+  ok = ok && memcmp(b,c,176)==0;
+  // The instances hold their own references, so the creator can let go
+  expanded->release();
+  memcpy(c,a,160);
+  cbcShared.encrypt(c,160,IV);
+  memcpy(b,a,160);
+  cbcRaw.encrypt(b,160,IV);
+  ok = ok && memcmp(b,c,160)==0;
+  if ( ok )
+    printf("AES128Key: PASSED MODES\n");
+  else
+    printf("AES128Key: FAILED MODES\n");
+
+  AES128KeyCache cache(3);
+  unsigned char k[16];
+  memset(k,0,16);
+  const AES128Key *keys[5];
+  for ( int i=1; i<=3; i++ )
+  {
+    k[0] = (unsigned char)i;
+    keys[i] = cache.get(i,k);
+  }
+  const AES128Key *again = cache.get(1,NULL);  // Hit; 2 is now the oldest
+  k[0] = 4;
+  keys[4] = cache.get(4,k);
+  ok = again==keys[1] && cache.size()==3 && cache.hits()==1 && cache.misses()==4;
+  ok = ok && cache.get(2,NULL)==NULL && cache.remove(3) && !cache.remove(3) && cache.size()==2;
+  again->release();
+
+  // Keys dropped by the cache stay valid while referenced
+  CBCMode cbc2(keys[2]);
+  cache.clear();
+  for ( int i=1; i<=4; i++ )
+    keys[i]->release();
+  k[0] = 2;
+  CBCMode cbcRef(atAES128,k);
+  memcpy(b,a,160);
+  memcpy(c,a,160);
+  cbc2.encrypt(b,160,IV);
+  cbcRef.encrypt(c,160,IV);
+  ok = ok && memcmp(b,c,160)==0 && cache.size()==0;
+  if ( ok )
+    printf("AES128Key: PASSED CACHE\n\n");
+  else
+    printf("AES128Key: FAILED CACHE\n\n");
+}
+
 /**
  *  XTEA test
  *
@@ -273,6 +1208,164 @@ void XTEA_CBC_Test()
     printf("XTEA-CBC: FAILED DECRYPT\n\n");
 }
 
+/**
+ *  Multi-block API test
+ *
+ *  encryptBlocks/decryptBlocks must agree with the single block functions for every cipher
+ *  and engine. Nine blocks exercise both the eight-way kernels and the tail handling.
+ */
+/**
+ *  XTEA round key test
+ *
+ *  An instance runs on the expanded round keys. It must give the same ciphertext as the
+ *  static calls on the raw key. The expected value is the reference XTEA vector with the key
+ *  and block words read little-endian; the legacy schedule (first four key bytes as the
+ *  words) must still be available on request.
+ */
+void XTEA_RoundKeys_Test()
+{
+  unsigned char key[] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+  unsigned char expected[] = {0xca,0xe7,0x69,0x7e,0x00,0x6e,0xe9,0x21};
+  unsigned char expectedLegacy[] = {0x07,0xc1,0x62,0x7e,0x27,0xb5,0x70,0x3c};
+  unsigned char text[] = {0x41,0x42,0x43,0x44,0x45,0x46,0x47,0x48};
+  unsigned char a[8], b[8];
+
+  XTEA xtea(key);
+  memcpy(a,text,8);
+  xtea.encrypt(a);
+  bool ok = memcmp(a,expected,8)==0;
+  xtea.decrypt(a);
+  ok = ok && memcmp(a,text,8)==0;
+
+  // Every key byte must matter
+  unsigned char key2[16];
+  memcpy(key2,key,16);
+  key2[15] ^= 1;
+  memcpy(b,text,8);
+  XTEA::encrypt(key2,b,XTEA_DEFAULT_NUM_ROUNDS);
+  ok = ok && memcmp(b,expected,8)!=0;
+
+  xtea.setLegacyKeySchedule();
+  memcpy(a,text,8);
+  xtea.encrypt(a);
+  memcpy(b,text,8);
+  XTEA::encrypt(key,b,XTEA_DEFAULT_NUM_ROUNDS,true);
+  ok = ok && memcmp(a,expectedLegacy,8)==0 && memcmp(b,expectedLegacy,8)==0;
+  xtea.decrypt(a);
+  ok = ok && memcmp(a,text,8)==0;
+
+  unsigned short rounds[] = {1,16,64,100};
+  for ( int r=0; r<4; r++ )
+  {
+    XTEA x(key,rounds[r]);
+    memcpy(a,text,8);
+    memcpy(b,text,8);
+    x.encrypt(a);
+    XTEA::encrypt(key,b,rounds[r]);
+    ok = ok && memcmp(a,b,8)==0;
+    x.decrypt(a);
+    ok = ok && memcmp(a,text,8)==0;
+  }
+  printf("XTEA ROUND KEYS: %s\n\n",ok ? "PASSED" : "FAILED");
+}
+
+/**
+ *  XTEA vector backend test
+ *
+ *  The SSE2 and AVX2 kernels must match the scalar cipher for every run length, which takes
+ *  them through each group size and the scalar tail, in place and out of place.
+ */
+void XTEA_SIMD_Test()
+{
+  unsigned char key[] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+  unsigned char text[45*8], scalar[45*8], simd[45*8];
+  for ( int i=0; i<45*8; i++ )
+    text[i] = (unsigned char)(i*11+7);
+
+  uint32_t roundKeys[2*32];
+  XTEA::expandKey(key,32,roundKeys);
+  XTEA xtea(key);
+  XTEA xtea64(key,64);
+  if ( !xtea.usesSIMD() )
+  {
+    printf("XTEA SIMD: not supported on this CPU\n\n");
+    return;
+  }
+
+  bool ok = true;
+  for ( int avx2=0; avx2<2; avx2++ )
+  {
+    if ( avx2 && !XTEA_SIMD::availableAVX2() )
+      break;
+    for ( unsigned int n=0; n<=45; n++ )
+    {
+      memcpy(scalar,text,n*8);
+      for ( unsigned int i=0; i<n; i++ )
+        XTEA::encrypt(key,scalar+i*8,32);
+      unsigned int done = XTEA_SIMD::encryptBlocks(roundKeys,32,text,simd,n,avx2!=0);
+      ok = ok && done==n-n%4 && memcmp(scalar,simd,done*8)==0;
+      done = XTEA_SIMD::decryptBlocks(roundKeys,32,simd,simd,n,avx2!=0);
+      ok = ok && memcmp(text,simd,done*8)==0;
+    }
+  }
+
+  // Through the class, in place, with the scalar tail and a non-default round count
+  for ( unsigned int n=1; n<=45; n+=11 )
+  {
+    memcpy(scalar,text,n*8);
+    memcpy(simd,text,n*8);
+    for ( unsigned int i=0; i<n; i++ )
+      xtea64.encrypt(scalar+i*8);
+    xtea64.encryptBlocks(simd,simd,n);
+    ok = ok && memcmp(scalar,simd,n*8)==0;
+    xtea64.decryptBlocks(simd,simd,n);
+    ok = ok && memcmp(text,simd,n*8)==0;
+  }
+  printf("XTEA SIMD%s: %s\n\n",XTEA_SIMD::availableAVX2() ? " (SSE2+AVX2)" : " (SSE2)",ok ? "PASSED" : "FAILED");
+}
+
+void BlockCipher_Batch_Test(const char *name, BlockCipherAlgorithm *cipher)
+{
+  unsigned char text[9*16], single[9*16], batch[9*16];
+  int bl = cipher->blocklength();
+  for ( int i=0; i<9*bl; i++ )
+    text[i] = (unsigned char)(i*7+1);
+
+  memcpy(single,text,9*bl);
+  for ( int i=0; i<9; i++ )
+    cipher->encrypt(single+i*bl);
+  cipher->encryptBlocks(text,batch,9);
+
+  if ( memcmp(single,batch,9*bl)==0 )
+    printf("%s BATCH: PASSED ENCRYPT\n",name);
+  else
+    printf("%s BATCH: FAILED ENCRYPT\n",name);
+
+  cipher->decryptBlocks(batch,batch,9);
+  if ( memcmp(text,batch,9*bl)==0 )
+    printf("%s BATCH: PASSED DECRYPT\n\n",name);
+  else
+    printf("%s BATCH: FAILED DECRYPT\n\n",name);
+}
+
+void Batch_Test()
+{
+  unsigned char key[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+
+  printf("Multi-block API Test\n\n");
+
+  AES128 aes(key);
+  if ( aes.usesAESNI() )
+    BlockCipher_Batch_Test("AES128 AES-NI",&aes);
+  aes.enableAESNI(false);
+  BlockCipher_Batch_Test("AES128 PORTABLE",&aes);
+  aes.setConstantTime(false);
+  BlockCipher_Batch_Test("AES128 TABLES",&aes);
+
+  XTEA xtea(key);
+  BlockCipher_Batch_Test("XTEA",&xtea);
+}
+
 void AES128_CMAC_RFC4494_TEST()
 {
   printf("\nRFC-4494 test cases for cmac generation:\n");
@@ -358,6 +1451,346 @@ void AES128_CMAC_RFC4494_TEST()
     printf("AES128_CMAC_RFC4494_TEST: PASSED VERIFY 2\n");
 }
 
+/**
+ *  Streaming CMAC test
+ *
+ *  The RFC 4493 messages fed to init/update/final in chunks of every size from 1 to 17 bytes,
+ *  with an empty update between chunks, must give the reference tags.
+ */
+void AES128_CMAC_Stream_Test()
+{
+  unsigned char K[] =
+    {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char M[] =
+    {0x6b,0xc1,0xbe,0xe2,0x2e,0x40,0x9f,0x96,0xe9,0x3d,0x7e,0x11,0x73,0x93,0x17,0x2a,
+     0xae,0x2d,0x8a,0x57,0x1e,0x03,0xac,0x9c,0x9e,0xb7,0x6f,0xac,0x45,0xaf,0x8e,0x51,
+     0x30,0xc8,0x1c,0x46,0xa3,0x5c,0xe4,0x11,0xe5,0xfb,0xc1,0x19,0x1a,0x0a,0x52,0xef,
+     0xf6,0x9f,0x24,0x45,0xdf,0x4f,0x9b,0x17,0xad,0x2b,0x41,0x7b,0xe6,0x6c,0x37,0x10};
+  unsigned char ref[4][16] =
+    {{0xbb,0x1d,0x69,0x29,0xe9,0x59,0x37,0x28,0x7f,0xa3,0x7d,0x12,0x9b,0x75,0x67,0x46},
+     {0x07,0x0a,0x16,0xb4,0x6b,0x4d,0x41,0x44,0xf7,0x9b,0xdd,0x9d,0xd0,0x4a,0x28,0x7c},
+     {0xdf,0xa6,0x67,0x47,0xde,0x9a,0xe6,0x30,0x30,0xca,0x32,0x61,0x14,0x97,0xc8,0x27},
+     {0x51,0xf0,0xbe,0xbf,0x7e,0x3b,0x9d,0x92,0xfc,0x49,0x74,0x17,0x79,0x36,0x3c,0xfe}};
+  unsigned int lengths[] = {0,16,40,64};
+  unsigned char tag[16];
+
+  AES128_CMAC cmac(K);
+  bool ok = true;
+  for ( int v=0; v<4; v++ )
+  {
+    for ( unsigned int chunk=1; chunk<=17; chunk++ )
+    {
+      CMACContext ctx;
+      cmac.init(&ctx);
+      for ( unsigned int pos=0; pos<lengths[v]; pos+=chunk )
+      {
+        unsigned int n = lengths[v]-pos < chunk ? lengths[v]-pos : chunk;
+        cmac.update(&ctx,M+pos,n);
+        cmac.update(&ctx,M,0);
+      }
+      cmac.final(&ctx,tag);
+      if ( memcmp(tag,ref[v],16)!=0 )
+        ok = false;
+    }
+  }
+
+  // The cached subkeys must follow a rekey
+  unsigned char K2[16];
+  for ( int i=0; i<16; i++ )
+    K2[i] = (unsigned char)i;
+  AES128_CMAC other(K2);
+  unsigned char otherTag[16];
+  other.mac(M,40,otherTag);
+  cmac.rekey(K2);
+  cmac.mac(M,40,tag);
+  if ( memcmp(tag,otherTag,16)!=0 )
+    ok = false;
+
+  if ( ok )
+    printf("AES128_CMAC_Stream_Test: PASSED\n\n");
+  else
+    printf("AES128_CMAC_Stream_Test: FAILED\n\n");
+}
+
+/**
+ *  Batched CMAC verification test
+ *
+ *  Messages of every length from 0 to 40 bytes, every third one with a corrupted tag, run
+ *  through verifyBatch in batches of several sizes. The bitmask must agree with verify()
+ *  message by message.
+ */
+void AES128_CMAC_Batch_Verify_Test()
+{
+  const unsigned int count = 41;
+  unsigned char K[16], M[count][48], tags[count][16], valid[(count+7)/8];
+  CMACJob jobs[count];
+
+  for ( int i=0; i<16; i++ )
+    K[i] = (unsigned char)(i*17+3);
+  AES128_CMAC cmac(K);
+  for ( unsigned int m=0; m<count; m++ )
+  {
+    for ( int i=0; i<48; i++ )
+      M[m][i] = (unsigned char)(m*31+i);
+    cmac.mac(M[m],m,tags[m]);
+    if ( m%3==1 )
+      tags[m][m%16] ^= 0x01;
+    jobs[m].message = M[m];
+    jobs[m].length = m;
+    jobs[m].tag = tags[m];
+  }
+
+  bool ok = true;
+  unsigned int sizes[] = {1,2,7,8,9,count};
+  for ( int s=0; s<6; s++ )
+  {
+    for ( unsigned int first=0; first<count; first+=sizes[s] )
+    {
+      unsigned int n = count-first < sizes[s] ? count-first : sizes[s];
+      unsigned int expected = 0;
+      memset(valid,0xff,sizeof(valid));
+      unsigned int nvalid = cmac.verifyBatch(jobs+first,n,valid);
+      for ( unsigned int m=0; m<n; m++ )
+      {
+        bool single = cmac.verify(M[first+m],first+m,tags[first+m]);
+        bool batch = (valid[m/8]>>(m%8)) & 1;
+        if ( single!=batch || single!=(((first+m)%3)!=1) )
+          ok = false;
+        if ( single )
+          expected++;
+      }
+      // Bits past the end of the batch are cleared too
+      for ( unsigned int m=n; m<(n+7)/8*8; m++ )
+        if ( (valid[m/8]>>(m%8)) & 1 )
+          ok = false;
+      if ( nvalid!=expected )
+        ok = false;
+    }
+  }
+
+  if ( ok )
+    printf("AES128_CMAC_Batch_Verify_Test: PASSED\n\n");
+  else
+    printf("AES128_CMAC_Batch_Verify_Test: FAILED\n\n");
+}
+
+/**
+ *  Truncated tag test
+ *
+ *  A tag with a zero byte must still be checked in full. Tags truncated to 8 and 12 bytes must
+ *  be the leading bytes of the full tag, nothing may be written past them, and a change in
+ *  their last byte must be caught by CMAC verify, verifyBatch and the EtM composition.
+ */
+void AES128_CMAC_Truncated_Test()
+{
+  unsigned char K[16], KE[16], M[64], full[16], tag[17], record[64+17], copy[64+17], valid[1];
+  for ( int i=0; i<16; i++ )
+  {
+    K[i] = (unsigned char)(0x40+i);
+    KE[i] = (unsigned char)(0x80+i);
+  }
+  for ( int i=0; i<64; i++ )
+    M[i] = (unsigned char)i;
+
+  AES128_CMAC cmac(K);
+  bool ok = true;
+
+  // Find a message whose tag starts with a zero byte; a difference behind it must count
+  bool found = false;
+  for ( unsigned int n=0; n<65536 && !found; n++ )
+  {
+    M[0] = (unsigned char)n;
+    M[1] = (unsigned char)(n>>8);
+    cmac.mac(M,32,full);
+    if ( full[0]==0 )
+    {
+      found = true;
+      full[15] ^= 0x01;
+      if ( cmac.verify(M,32,full) || AES128_CMAC::verify(K,M,32,full) )
+        ok = false;
+      full[15] ^= 0x01;
+      if ( !cmac.verify(M,32,full) )
+        ok = false;
+    }
+  }
+  if ( !found )
+    ok = false;
+
+  if ( cmac.setTagLength(CMAC_MIN_TAG_BYTES-1) || cmac.setTagLength(17) || cmac.tagLength()!=16 )
+    ok = false;
+
+  unsigned int lengths[] = {8,12};
+  for ( int v=0; v<2; v++ )
+  {
+    unsigned int t = lengths[v];
+    if ( !cmac.setTagLength(t) || cmac.tagLength()!=t )
+      ok = false;
+
+    // mac and final write exactly t bytes, the prefix of the full tag
+    cmac.setTagLength(16);
+    cmac.mac(M,40,full);
+    cmac.setTagLength(t);
+    memset(tag,0xee,sizeof(tag));
+    cmac.mac(M,40,tag);
+    if ( memcmp(tag,full,t)!=0 || tag[t]!=0xee )
+      ok = false;
+    CMACContext ctx;
+    memset(tag,0xee,sizeof(tag));
+    cmac.init(&ctx);
+    cmac.update(&ctx,M,40);
+    cmac.final(&ctx,tag);
+    if ( memcmp(tag,full,t)!=0 || tag[t]!=0xee )
+      ok = false;
+
+    CMACJob job = {M,40,tag};
+    if ( !cmac.verify(M,40,tag) || cmac.verifyBatch(&job,1,valid)!=1 )
+      ok = false;
+    tag[t-1] ^= 0x80;
+    if ( cmac.verify(M,40,tag) || cmac.verifyBatch(&job,1,valid)!=0 )
+      ok = false;
+
+    // EtM, fused (whole blocks) and two pass (partial block)
+    for ( unsigned int length=48; length<=50; length+=2 )
+    {
+      AES128CBC_CMAC_EtM etm(KE,K), etmFull(KE,K);
+      unsigned char IV[16], fullRecord[64+17];
+      memset(IV,0x24,16);
+      if ( !etm.setTagLength(t) || etm.tagLength()!=t )
+        ok = false;
+      memset(record,0xee,sizeof(record));
+      memcpy(record,M,length);
+      memcpy(fullRecord,M,length);
+      etm.encryptAndTag(record,length,IV);
+      etmFull.encryptAndTag(fullRecord,length,IV);
+      if ( memcmp(record,fullRecord,length+t)!=0 )
+        ok = false;
+      // The padding of a partial block spills into the tag space, so only check the fused case
+      if ( length%16==0 && record[length+t]!=0xee )
+        ok = false;
+      memcpy(copy,record,sizeof(record));
+      if ( !etm.verify(record,length) || !etm.decryptAndVerify(copy,length,IV) )
+        ok = false;
+      record[length+t-1] ^= 0x01;
+      memcpy(copy,record,sizeof(record));
+      if ( etm.verify(record,length) || etm.decryptAndVerify(copy,length,IV) )
+        ok = false;
+    }
+  }
+
+  if ( ok )
+    printf("AES128_CMAC_Truncated_Test: PASSED\n\n");
+  else
+    printf("AES128_CMAC_Truncated_Test: FAILED\n\n");
+}
+
+/**
+ *  PMAC test
+ *
+ *  Reference tags for the empty message and one block, then every length up to 300 blocks
+ *  (past 2^8, so a ninth L(i) is used) against a plain serial PMAC1 with the offsets updated
+ *  block by block. Large messages split over threads must give the same tags.
+ */
+void AES128_PMAC_Test()
+{
+  unsigned char K[16], T0[16], T16[16], tag[16], ref[16];
+  unsigned char ref0[] =
+    {0x43,0x99,0x57,0x2c,0xd6,0xea,0x53,0x41,0xb8,0xd3,0x58,0x76,0xa7,0x09,0x8a,0xf7};
+  unsigned char ref16[] =
+    {0xeb,0xbd,0x82,0x2f,0xa4,0x58,0xda,0xf6,0xdf,0xda,0xd7,0xc2,0x7d,0xa7,0x63,0x38};
+  const unsigned int maxLength = 300*16;
+  unsigned char *M = new unsigned char[4*PMAC_PARALLEL_MIN_BYTES+40];
+  for ( int i=0; i<16; i++ )
+    K[i] = (unsigned char)i;
+  for ( unsigned int i=0; i<4*PMAC_PARALLEL_MIN_BYTES+40; i++ )
+    M[i] = (unsigned char)(i*7+i/251);
+  for ( int i=0; i<16; i++ )
+    M[i] = (unsigned char)i;
+
+  AES128_PMAC pmac(K);
+  bool ok = true;
+  pmac.mac(M,0,T0);
+  pmac.mac(M,16,T16);
+  if ( memcmp(T0,ref0,16)!=0 || memcmp(T16,ref16,16)!=0 )
+    ok = false;
+
+  // L(0) = E_K(0), L(-1) = L(0).x^-1
+  AES128 aes(K);
+  unsigned char L[16], Linv[16];
+  memset(L,0,16);
+  aes.encrypt(L);
+  for ( int i=0; i<16; i++ )
+    Linv[i] = (unsigned char)((L[i]>>1) | (i>0 ? L[i-1]<<7 : 0));
+  if ( L[15] & 1 )
+  {
+    Linv[0] ^= 0x80;
+    Linv[15] ^= 0x43;
+  }
+  for ( unsigned int length=0; length<=maxLength && ok; length+=(length<64 ? 1 : 13) )
+  {
+    unsigned int blocks = length==0 ? 1 : (length+15)/16;
+    unsigned char delta[16], sigma[16], X[16];
+    memset(delta,0,16);
+    memset(sigma,0,16);
+    for ( unsigned int i=1; i<blocks; i++ )
+    {
+      // delta ^= L.x^ntz(i)
+      unsigned char Li[16];
+      memcpy(Li,L,16);
+      for ( unsigned int n=i; (n&1)==0; n>>=1 )
+      {
+        unsigned char carry = Li[0] & 0x80;
+        for ( int bb=0; bb<15; bb++ )
+          Li[bb] = (unsigned char)((Li[bb]<<1) | (Li[bb+1]>>7));
+        Li[15] = (unsigned char)(Li[15]<<1);
+        if ( carry )
+          Li[15] ^= 0x87;
+      }
+      for ( int bb=0; bb<16; bb++ )
+      {
+        delta[bb] ^= Li[bb];
+        X[bb] = M[(i-1)*16+bb] ^ delta[bb];
+      }
+      aes.encrypt(X);
+      for ( int bb=0; bb<16; bb++ )
+        sigma[bb] ^= X[bb];
+    }
+    unsigned int tail = length-(blocks-1)*16;
+    for ( unsigned int bb=0; bb<tail; bb++ )
+      sigma[bb] ^= M[(blocks-1)*16+bb];
+    if ( tail==16 )
+      for ( int bb=0; bb<16; bb++ )
+        sigma[bb] ^= Linv[bb];
+    else
+      sigma[tail] ^= 0x80;
+    aes.encrypt(sigma);
+
+    pmac.mac(M,length,tag);
+    if ( memcmp(tag,sigma,16)!=0 || !pmac.verify(M,length,sigma) )
+      ok = false;
+    sigma[length%16] ^= 0x01;
+    if ( pmac.verify(M,length,sigma) )
+      ok = false;
+  }
+
+  // Split over threads (with ACRYPTO_THREADS) at lengths which do not divide evenly
+  unsigned int lengths[] = {2*PMAC_PARALLEL_MIN_BYTES, 4*PMAC_PARALLEL_MIN_BYTES+40, 3*PMAC_PARALLEL_MIN_BYTES+7};
+  for ( int v=0; v<3; v++ )
+  {
+    pmac.setThreads(1);
+    pmac.mac(M,lengths[v],ref);
+    pmac.setThreads(4);
+    pmac.mac(M,lengths[v],tag);
+    if ( memcmp(tag,ref,16)!=0 )
+      ok = false;
+  }
+  delete [] M;
+
+  if ( ok )
+    printf("AES128_PMAC_Test: PASSED\n\n");
+  else
+    printf("AES128_PMAC_Test: FAILED\n\n");
+}
+
 void AES_CMAC_EtM_Test()
 {
   // This is the FIPS test vector
@@ -406,17 +1839,164 @@ void AES_CMAC_EtM_Test()
   free(buf);
 }
 
+/**
+ *  One-shot test
+ *
+ *  The static AES128 and CMAC calls on a raw key must agree with instances, and with the
+ *  RFC 4493 tags.
+ */
+void AES_OneShot_Test()
+{
+  unsigned char K[] =
+    {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char M[] =
+    {0x6b,0xc1,0xbe,0xe2,0x2e,0x40,0x9f,0x96,0xe9,0x3d,0x7e,0x11,0x73,0x93,0x17,0x2a,
+     0xae,0x2d,0x8a,0x57,0x1e,0x03,0xac,0x9c,0x9e,0xb7,0x6f,0xac,0x45,0xaf,0x8e,0x51,
+     0x30,0xc8,0x1c,0x46,0xa3,0x5c,0xe4,0x11,0xe5,0xfb,0xc1,0x19,0x1a,0x0a,0x52,0xef,
+     0xf6,0x9f,0x24,0x45,0xdf,0x4f,0x9b,0x17,0xad,0x2b,0x41,0x7b,0xe6,0x6c,0x37,0x10};
+  unsigned char ref[4][16] =
+    {{0xbb,0x1d,0x69,0x29,0xe9,0x59,0x37,0x28,0x7f,0xa3,0x7d,0x12,0x9b,0x75,0x67,0x46},
+     {0x07,0x0a,0x16,0xb4,0x6b,0x4d,0x41,0x44,0xf7,0x9b,0xdd,0x9d,0xd0,0x4a,0x28,0x7c},
+     {0xdf,0xa6,0x67,0x47,0xde,0x9a,0xe6,0x30,0x30,0xca,0x32,0x61,0x14,0x97,0xc8,0x27},
+     {0x51,0xf0,0xbe,0xbf,0x7e,0x3b,0x9d,0x92,0xfc,0x49,0x74,0x17,0x79,0x36,0x3c,0xfe}};
+  unsigned int lengths[] = {0,16,40,64};
+  unsigned char key[16], a[16], b[16], tag[16];
+
+  bool ok = true;
+  for ( int n=0; n<64; n++ )
+  {
+    for ( int i=0; i<16; i++ )
+    {
+      key[i] = (unsigned char)(n*31+i*7);
+      a[i] = (unsigned char)(n+i*13);
+    }
+    AES128 aes(key);
+    memcpy(b,a,16);
+    aes.encrypt(a);
+    AES128::encrypt(key,b);
+    ok = ok && memcmp(a,b,16)==0;
+    aes.decrypt(a);
+    AES128::decrypt(key,b);
+    ok = ok && memcmp(a,b,16)==0 && a[0]==(unsigned char)n;
+  }
+  if ( ok )
+    printf("AES128 ONE-SHOT: PASSED\n");
+  else
+    printf("AES128 ONE-SHOT: FAILED\n");
+
+  AES128_CMAC cmac(K);
+  for ( int v=0; v<4; v++ )
+  {
+    AES128_CMAC::mac(K,M,lengths[v],tag);
+    ok = ok && memcmp(tag,ref[v],16)==0 && AES128_CMAC::verify(K,M,lengths[v],ref[v]);
+  }
+  for ( unsigned int length=0; length<=64; length++ )
+  {
+    unsigned char tag2[16];
+    AES128_CMAC::mac(K,M,length,tag);
+    cmac.mac(M,length,tag2);
+    ok = ok && memcmp(tag,tag2,16)==0;
+    tag2[15] ^= 1;
+    ok = ok && !AES128_CMAC::verify(K,M,length,tag2);
+  }
+  if ( ok )
+    printf("AES128-CMAC ONE-SHOT: PASSED\n\n");
+  else
+    printf("AES128-CMAC ONE-SHOT: FAILED\n\n");
+}
+
+/**
+ *  EtM single pass test
+ *
+ *  The fused CBC and CMAC pass must produce exactly what CBC followed by CMAC does, and a
+ *  message with a bad tag must be left as it was.
+ */
+void AES_CMAC_EtM_Fused_Test()
+{
+  unsigned char KE[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c};
+  unsigned char KM[] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f};
+  unsigned char IV[] = {0xf0,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa,0xfb,0xfc,0xfd,0xfe,0xff};
+  unsigned char buf[400], ref[400];
+
+  AES128CBC_CMAC_EtM etm(KE,KM);
+  CBCMode cbc(atAES128,KE);
+  AES128_CMAC cmac(KM);
+  bool ok = true;
+  for ( unsigned int length=16; length<=384; length+=16 )
+  {
+    for ( unsigned int i=0; i<length; i++ )
+      buf[i] = ref[i] = (unsigned char)(i*13+length);
+    etm.encryptAndTag(buf,length,IV);
+    cbc.encrypt(ref,length,IV);
+    cmac.mac(ref,length-16,ref+length);
+    if ( memcmp(buf,ref,length+16)!=0 )
+      ok = false;
+
+    buf[length+3] ^= 0x40;
+    if ( etm.decryptAndVerify(buf,length,IV) || memcmp(buf,ref,length)!=0 )
+      ok = false;
+    buf[length+3] ^= 0x40;
+    if ( !etm.decryptAndVerify(buf,length,IV) )
+      ok = false;
+    for ( unsigned int i=0; i<length; i++ )
+      if ( buf[i]!=(unsigned char)(i*13+length) )
+        ok = false;
+  }
+  // Less than a block is refused, leaving the buffers alone
+  for ( unsigned int length=0; length<16; length++ )
+  {
+    memset(buf,0x3c,48);
+    memset(ref,0x3c,48);
+    etm.encryptAndTag(buf,length,IV);
+    etm.encryptAndTag(ref,length,buf+16,IV);
+    if ( etm.decryptAndVerify(buf,length,IV) || etm.decryptAndVerify(ref,length,buf+32,IV) ||
+         etm.verify(buf,length) || memcmp(buf,ref,48)!=0 || buf[0]!=0x3c || buf[47]!=0x3c )
+      ok = false;
+  }
+  if ( ok )
+    printf("AES_CMAC_EtM_Fused_Test: PASSED\n\n");
+  else
+    printf("AES_CMAC_EtM_Fused_Test: FAILED\n\n");
+}
+
 int main()
 {
     AES_FIPS_Test();
+    AES_Backend_Test();
+    AES_Bitsliced_Test();
     AES_ECB_Test();
     AES_CBC_Test();
+    CBC_Large_Decrypt_Test("AES128",atAES128,1);
+    CBC_Large_Decrypt_Test("AES128",atAES128,4);
+    CBC_Large_Decrypt_Test("XTEA",atXTEA,3);
+    CBC_Batch_Encrypt_Test("AES128",atAES128);
+    CBC_Batch_Encrypt_Test("XTEA",atXTEA);
+    AES_CTR_Test();
+    AES_XTS_Test();
+    Padding_Test();
+    OutOfPlace_Test();
+    Mode_Template_Test<AES128>("AES128",atAES128);
+    Mode_Template_Test<XTEA>("XTEA",atXTEA);
+    AES128Key_Test();
+    Arena_Test();
+    Bulk_Engine_Test();
 
     XTEA_Test();
     XTEA_ECB_Test();
     XTEA_CBC_Test();
+    XTEA_RoundKeys_Test();
+    XTEA_SIMD_Test();
+
+    Batch_Test();
 
     AES128_CMAC_RFC4494_TEST();
+    AES128_CMAC_Stream_Test();
+    AES128_CMAC_Batch_Verify_Test();
+    AES128_CMAC_Truncated_Test();
+    AES128_PMAC_Test();
+    AES_OneShot_Test();
 
     AES_CMAC_EtM_Test();
+    AES_CMAC_EtM_Fused_Test();
+    AES_GCM_Test();
 };